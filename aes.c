@@ -35,6 +35,14 @@
  * Modified by Jari Ruusu,  April 21 2004
  *  - Added back code that avoids byte swaps on big endian boxes.
  */
+/*
+ * Modified for audio-entropyd-too
+ *  - aes_set_key() and aes_encrypt() are now aes_set_key_table() and
+ *    aes_encrypt_table(), the reference for the implementations in
+ *    aes_hw.c and aes_ct.c, which dispatches among them.
+ *  - AES_ENCRYPT_128 (see aes.h) leaves out 192- and 256-bit keys, the
+ *    decryption key schedule, aes_decrypt() and the inverse tables.
+ */
 
 #include "aes.h"
 
@@ -198,6 +206,13 @@
 #endif
 #endif
 
+// Nothing to decrypt with, so no decryption key schedule to mix
+
+#if defined(AES_ENCRYPT_128)
+#undef  ONE_IM_TABLE
+#undef  FOUR_IM_TABLES
+#endif
+
 // the finite field modular polynomial and elements
 
 #define ff_poly 0x011b
@@ -262,6 +277,8 @@ static const unsigned char s_box[256] =
     0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
 };
 
+#if !defined(AES_ENCRYPT_128)
+
 // the inverse S-Box table
 
 static const unsigned char inv_s_box[256] =
@@ -300,6 +317,8 @@ static const unsigned char inv_s_box[256] =
     0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
 };
 
+#endif
+
 // used to ensure table is generated in the right format
 // depending on the internal byte order required
 
@@ -523,6 +542,7 @@ static const u_int32_t ft_tab[4][256] =
 };
 #endif
 
+#if !defined(AES_ENCRYPT_128)
 #undef  r
 #define r   r0
 #if defined(ONE_TABLE)
@@ -542,6 +562,7 @@ static const u_int32_t it_tab[4][256] =
     {   i_table }
 };
 #endif
+#endif
 
 #endif
 
@@ -605,6 +626,7 @@ static const u_int32_t fl_tab[4][256] =
 };
 #endif
 
+#if !defined(AES_ENCRYPT_128)
 #undef  w
 #define w   w0
 #if defined(ONE_LR_TABLE)
@@ -624,6 +646,7 @@ static const u_int32_t il_tab[4][256] =
     {   li_table    }
 };
 #endif
+#endif
 
 #endif
 
@@ -723,24 +746,35 @@ static const u_int32_t im_tab[4][256] =
 static int tab_gen = 0;
 
 static unsigned char  s_box[256];            // the S box
-static unsigned char  inv_s_box[256];        // the inverse S box
 static u_int32_t  rcon_tab[AES_RC_LENGTH];   // table of round constants
 
 #if defined(ONE_TABLE)
 static u_int32_t  ft_tab[256];
-static u_int32_t  it_tab[256];
 #elif defined(FOUR_TABLES)
 static u_int32_t  ft_tab[4][256];
-static u_int32_t  it_tab[4][256];
 #endif
 
 #if defined(ONE_LR_TABLE)
 static u_int32_t  fl_tab[256];
-static u_int32_t  il_tab[256];
 #elif defined(FOUR_LR_TABLES)
 static u_int32_t  fl_tab[4][256];
+#endif
+
+#if !defined(AES_ENCRYPT_128)
+static unsigned char  inv_s_box[256];        // the inverse S box
+
+#if defined(ONE_TABLE)
+static u_int32_t  it_tab[256];
+#elif defined(FOUR_TABLES)
+static u_int32_t  it_tab[4][256];
+#endif
+
+#if defined(ONE_LR_TABLE)
+static u_int32_t  il_tab[256];
+#elif defined(FOUR_LR_TABLES)
 static u_int32_t  il_tab[4][256];
 #endif
+#endif
 
 #if defined(ONE_IM_TABLE)
 static u_int32_t  im_tab[256];
@@ -875,6 +909,7 @@ static void gen_tabs(void)
         ft_tab[2][i] = upr(w,2);
         ft_tab[3][i] = upr(w,3);
 #endif
+#if !defined(AES_ENCRYPT_128)
         inv_s_box[i] = b = FFinv(inv_affine((unsigned char)i));
 
         w = bytes2word(b, 0, 0, 0);
@@ -903,7 +938,7 @@ static void gen_tabs(void)
         im_tab[2][b] = upr(w,2);
         im_tab[3][b] = upr(w,3);
 #endif
-
+#endif
     }
 }
 
@@ -1023,13 +1058,16 @@ switch(nc) \
 
 #endif
 
-void aes_set_key(aes_context *cx, const unsigned char in_key[], int n_bytes, const int f)
+void aes_set_key_table(aes_context *cx, const unsigned char in_key[], int n_bytes, const int f)
 {   u_int32_t    *kf, *kt, rci;
 
 #if !defined(FIXED_TABLES)
     if(!tab_gen) { gen_tabs(); tab_gen = 1; }
 #endif
 
+#if defined(AES_ENCRYPT_128)
+    cx->aes_Nkey = 4;
+#else
     switch(n_bytes) {
     case 32:                    /* bytes */
     case 256:                   /* bits */
@@ -1045,6 +1083,7 @@ void aes_set_key(aes_context *cx, const unsigned char in_key[], int n_bytes, con
         cx->aes_Nkey = 4;
         break;
     }
+#endif
 
     cx->aes_Nrnd = (cx->aes_Nkey > nc ? cx->aes_Nkey : nc) + 6; 
 
@@ -1054,7 +1093,7 @@ void aes_set_key(aes_context *cx, const unsigned char in_key[], int n_bytes, con
     cx->aes_e_key[3] = word_in(in_key + 12);
 
     kf = cx->aes_e_key; 
-    kt = kf + nc * (cx->aes_Nrnd + 1) - cx->aes_Nkey; 
+    kt = kf + nc * (AES_NRND(cx) + 1) - cx->aes_Nkey; 
     rci = 0;
 
     switch(cx->aes_Nkey)
@@ -1069,6 +1108,7 @@ void aes_set_key(aes_context *cx, const unsigned char in_key[], int n_bytes, con
             while(kf < kt);
             break;
 
+#if !defined(AES_ENCRYPT_128)
     case 6: cx->aes_e_key[4] = word_in(in_key + 16);
             cx->aes_e_key[5] = word_in(in_key + 20);
             do
@@ -1100,8 +1140,10 @@ void aes_set_key(aes_context *cx, const unsigned char in_key[], int n_bytes, con
             }
             while (kf < kt);
             break;
+#endif
     }
 
+#if !defined(AES_ENCRYPT_128)
     if(!f)
     {   u_int32_t    i;
         
@@ -1125,6 +1167,7 @@ void aes_set_key(aes_context *cx, const unsigned char in_key[], int n_bytes, con
         
         cpy(kt, kf);
     }
+#endif
 }
 
 // y = output word, x = input word, r = row, c = column
@@ -1363,7 +1406,7 @@ switch(nc) \
 #endif
 #endif
 
-void aes_encrypt(const aes_context *cx, const unsigned char in_blk[], unsigned char out_blk[])
+void aes_encrypt_table(const aes_context *cx, const unsigned char in_blk[], unsigned char out_blk[])
 {   u_int32_t        locals(b0, b1);
     const u_int32_t  *kp = cx->aes_e_key;
 
@@ -1375,7 +1418,7 @@ void aes_encrypt(const aes_context *cx, const unsigned char in_blk[], unsigned c
 
 #if defined(UNROLL)
 
-    switch(cx->aes_Nrnd)
+    switch(AES_NRND(cx))
     {
     case 14:    round(fwd_rnd,  b1, b0, kp         ); 
                 round(fwd_rnd,  b0, b1, kp + nc    ); kp += 2 * nc;
@@ -1396,7 +1439,7 @@ void aes_encrypt(const aes_context *cx, const unsigned char in_blk[], unsigned c
 #elif defined(PARTIAL_UNROLL)
     {   u_int32_t    rnd;
 
-        for(rnd = 0; rnd < (cx->aes_Nrnd >> 1) - 1; ++rnd)
+        for(rnd = 0; rnd < (AES_NRND(cx) >> 1) - 1; ++rnd)
         {
             round(fwd_rnd, b1, b0, kp); 
             round(fwd_rnd, b0, b1, kp + nc); kp += 2 * nc;
@@ -1408,7 +1451,7 @@ void aes_encrypt(const aes_context *cx, const unsigned char in_blk[], unsigned c
 #else
     {   u_int32_t    rnd;
 
-        for(rnd = 0; rnd < cx->aes_Nrnd - 1; ++rnd)
+        for(rnd = 0; rnd < AES_NRND(cx) - 1; ++rnd)
         {
             round(fwd_rnd, b1, b0, kp); 
             l_copy(b0, b1); kp += nc;
@@ -1421,6 +1464,8 @@ void aes_encrypt(const aes_context *cx, const unsigned char in_blk[], unsigned c
     state_out(out_blk, b0);
 }
 
+#if !defined(AES_ENCRYPT_128)
+
 void aes_decrypt(const aes_context *cx, const unsigned char in_blk[], unsigned char out_blk[])
 {   u_int32_t        locals(b0, b1);
     const u_int32_t  *kp = cx->aes_d_key;
@@ -1478,3 +1523,5 @@ void aes_decrypt(const aes_context *cx, const unsigned char in_blk[], unsigned c
 
     state_out(out_blk, b0);
 }
+
+#endif
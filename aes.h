@@ -52,6 +52,12 @@
 
 #define AES_BLOCK_SIZE  16
 
+// Define AES_ENCRYPT_128 (the Makefile's AES_PROFILE does) for a build that
+// only encrypts, and only with 128-bit keys: the key length given is
+// ignored, there is no decryption key schedule and no aes_decrypt(), and
+// the number of rounds is the constant 10, so that loops over the rounds
+// unroll.  It changes aes_context, so every file must agree on it.
+
 // The number of key schedule words for different block and key lengths
 // allowing for method of computation which requires the length to be a
 // multiple of the key length
@@ -62,7 +68,12 @@
 //      6 |  96  90  96
 //      8 | 120 120 120
 
-#if !defined(AES_BLOCK_SIZE) || (AES_BLOCK_SIZE == 32)
+#if defined(AES_ENCRYPT_128) && defined(AES_BLOCK_SIZE) && (AES_BLOCK_SIZE == 16)
+#define AES_KS_LENGTH    44
+#define AES_RC_LENGTH    10
+#elif defined(AES_ENCRYPT_128)
+#error AES_ENCRYPT_128 needs an AES_BLOCK_SIZE of 16
+#elif !defined(AES_BLOCK_SIZE) || (AES_BLOCK_SIZE == 32)
 #define AES_KS_LENGTH   120
 #define AES_RC_LENGTH    29
 #else
@@ -70,12 +81,25 @@
 #define AES_RC_LENGTH   (9 * AES_BLOCK_SIZE) / 8 - 8
 #endif
 
+// The number of cipher rounds of a context, and the most there can be
+
+#if defined(AES_ENCRYPT_128)
+#define AES_NRND(cx)    10
+#define AES_MAX_NRND    10
+#else
+#define AES_NRND(cx)    ((cx)->aes_Nrnd)
+#define AES_MAX_NRND    14
+#endif
+
 typedef struct
 {
     u_int32_t    aes_Nkey;      // the number of words in the key input block
     u_int32_t    aes_Nrnd;      // the number of cipher rounds
     u_int32_t    aes_e_key[AES_KS_LENGTH];   // the encryption key schedule
+#if !defined(AES_ENCRYPT_128)
     u_int32_t    aes_d_key[AES_KS_LENGTH];   // the decryption key schedule
+#endif
+    u_int64_t    aes_ct_key[2 * 8 * (AES_MAX_NRND + 1)];   // the encryption key schedule, bitsliced (aes_ct.h)
 #if !defined(AES_BLOCK_SIZE)
     u_int32_t    aes_Ncol;      // the number of columns in the cipher state
 #endif
@@ -97,10 +121,18 @@ extern void aes_set_key(aes_context *, const unsigned char [], const int, const
 #endif
 extern void aes_encrypt(const aes_context *, const unsigned char [], unsigned char []);
 
+// The table driven aes_set_key() and aes_encrypt(), for reference (see
+// aes_hw.h).  The AES instructions take the same key schedule; the bitsliced
+// code has its own.
+extern void aes_set_key_table(aes_context *, const unsigned char [], const int, const int);
+extern void aes_encrypt_table(const aes_context *, const unsigned char [], unsigned char []);
+
+#if !defined(AES_ENCRYPT_128)
 #if defined(__linux__) && defined(__KERNEL__) && (defined(X86_ASM) || defined(AMD64_ASM))
  asmlinkage
 #endif
 extern void aes_decrypt(const aes_context *, const unsigned char [], unsigned char []);
+#endif
 
 // The block length inputs to aes_set_block and aes_set_key are in numbers
 // of bytes or bits.  The calls to subroutines must be made in the above
@@ -0,0 +1,567 @@
+#include <stdint.h>
+#include <string.h>
+#include "aes_ct.h"
+
+/* blocks 0-3 in the low lane, 4-7 in the high one */
+typedef uint64_t bs_word __attribute__((vector_size(16)));
+/* the same, by 32-bit and by 16-bit elements, for shuffles and shifts */
+typedef uint32_t bs_word32 __attribute__((vector_size(16)));
+typedef uint16_t bs_word16 __attribute__((vector_size(16)));
+
+#define BS_BLOCKS	8
+
+/* Boyar and Peralta's S-box circuit, 113 gates, bit 0 in q[0] */
+static inline void sbox(bs_word q[8])
+{
+	bs_word x0, x1, x2, x3, x4, x5, x6, x7;
+	bs_word y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11;
+	bs_word y12, y13, y14, y15, y16, y17, y18, y19, y20, y21;
+	bs_word z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+	bs_word z10, z11, z12, z13, z14, z15, z16, z17;
+	bs_word t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+	bs_word t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+	bs_word t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+	bs_word t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+	bs_word t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+	bs_word t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+	bs_word t60, t61, t62, t63, t64, t65, t66, t67;
+	bs_word s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+
+	/* top linear transformation */
+	y14 = x3 ^ x5;
+	y13 = x0 ^ x6;
+	y9 = x0 ^ x3;
+	y8 = x0 ^ x5;
+	t0 = x1 ^ x2;
+	y1 = t0 ^ x7;
+	y4 = y1 ^ x3;
+	y12 = y13 ^ y14;
+	y2 = y1 ^ x0;
+	y5 = y1 ^ x6;
+	y3 = y5 ^ y8;
+	t1 = x4 ^ y12;
+	y15 = t1 ^ x5;
+	y20 = t1 ^ x1;
+	y6 = y15 ^ x7;
+	y10 = y15 ^ t0;
+	y11 = y20 ^ y9;
+	y7 = x7 ^ y11;
+	y17 = y10 ^ y11;
+	y19 = y10 ^ y8;
+	y16 = t0 ^ y11;
+	y21 = y13 ^ y16;
+	y18 = x0 ^ y16;
+
+	/* non-linear section */
+	t2 = y12 & y15;
+	t3 = y3 & y6;
+	t4 = t3 ^ t2;
+	t5 = y4 & x7;
+	t6 = t5 ^ t2;
+	t7 = y13 & y16;
+	t8 = y5 & y1;
+	t9 = t8 ^ t7;
+	t10 = y2 & y7;
+	t11 = t10 ^ t7;
+	t12 = y9 & y11;
+	t13 = y14 & y17;
+	t14 = t13 ^ t12;
+	t15 = y8 & y10;
+	t16 = t15 ^ t12;
+	t17 = t4 ^ t14;
+	t18 = t6 ^ t16;
+	t19 = t9 ^ t14;
+	t20 = t11 ^ t16;
+	t21 = t17 ^ y20;
+	t22 = t18 ^ y19;
+	t23 = t19 ^ y21;
+	t24 = t20 ^ y18;
+
+	t25 = t21 ^ t22;
+	t26 = t21 & t23;
+	t27 = t24 ^ t26;
+	t28 = t25 & t27;
+	t29 = t28 ^ t22;
+	t30 = t23 ^ t24;
+	t31 = t22 ^ t26;
+	t32 = t31 & t30;
+	t33 = t32 ^ t24;
+	t34 = t23 ^ t33;
+	t35 = t27 ^ t33;
+	t36 = t24 & t35;
+	t37 = t36 ^ t34;
+	t38 = t27 ^ t36;
+	t39 = t29 & t38;
+	t40 = t25 ^ t39;
+
+	t41 = t40 ^ t37;
+	t42 = t29 ^ t33;
+	t43 = t29 ^ t40;
+	t44 = t33 ^ t37;
+	t45 = t42 ^ t41;
+	z0 = t44 & y15;
+	z1 = t37 & y6;
+	z2 = t33 & x7;
+	z3 = t43 & y16;
+	z4 = t40 & y1;
+	z5 = t29 & y7;
+	z6 = t42 & y11;
+	z7 = t45 & y17;
+	z8 = t41 & y10;
+	z9 = t44 & y12;
+	z10 = t37 & y3;
+	z11 = t33 & y4;
+	z12 = t43 & y13;
+	z13 = t40 & y5;
+	z14 = t29 & y2;
+	z15 = t42 & y9;
+	z16 = t45 & y14;
+	z17 = t41 & y8;
+
+	/* bottom linear transformation */
+	t46 = z15 ^ z16;
+	t47 = z10 ^ z11;
+	t48 = z5 ^ z13;
+	t49 = z9 ^ z10;
+	t50 = z2 ^ z12;
+	t51 = z2 ^ z5;
+	t52 = z7 ^ z8;
+	t53 = z0 ^ z3;
+	t54 = z6 ^ z7;
+	t55 = z16 ^ z17;
+	t56 = z12 ^ t48;
+	t57 = t50 ^ t53;
+	t58 = z4 ^ t46;
+	t59 = z3 ^ t54;
+	t60 = t46 ^ t57;
+	t61 = z14 ^ t57;
+	t62 = t52 ^ t58;
+	t63 = t49 ^ t58;
+	t64 = z4 ^ t59;
+	t65 = t61 ^ t62;
+	t66 = z1 ^ t63;
+	s0 = t59 ^ t63;
+	s6 = t56 ^ ~t62;
+	s7 = t48 ^ ~t60;
+	t67 = t64 ^ t65;
+	s3 = t53 ^ t66;
+	s4 = t51 ^ t66;
+	s5 = t47 ^ t65;
+	s1 = t64 ^ ~s3;
+	s2 = t55 ^ ~t67;
+
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+#define SWAPN(cl, ch, s, x, y)	do {					\
+	bs_word a = (x), b = (y);					\
+	(x) = (a & (uint64_t)(cl)) | ((b & (uint64_t)(cl)) << (s));	\
+	(y) = ((a & (uint64_t)(ch)) >> (s)) | (b & (uint64_t)(ch));	\
+} while (0)
+
+#define SWAP2(x, y)	SWAPN(0x5555555555555555ULL, 0xAAAAAAAAAAAAAAAAULL, 1, x, y)
+#define SWAP4(x, y)	SWAPN(0x3333333333333333ULL, 0xCCCCCCCCCCCCCCCCULL, 2, x, y)
+#define SWAP8(x, y)	SWAPN(0x0F0F0F0F0F0F0F0FULL, 0xF0F0F0F0F0F0F0F0ULL, 4, x, y)
+
+/* into bit planes and back: it's its own inverse */
+static void ortho(bs_word q[8])
+{
+	SWAP2(q[0], q[1]);
+	SWAP2(q[2], q[3]);
+	SWAP2(q[4], q[5]);
+	SWAP2(q[6], q[7]);
+
+	SWAP4(q[0], q[2]);
+	SWAP4(q[1], q[3]);
+	SWAP4(q[4], q[6]);
+	SWAP4(q[5], q[7]);
+
+	SWAP8(q[0], q[4]);
+	SWAP8(q[1], q[5]);
+	SWAP8(q[2], q[6]);
+	SWAP8(q[3], q[7]);
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+typedef uint8_t bs_bytes __attribute__((vector_size(16)));
+
+/* a block's bytes go to two words, the first eight interleaved with the
+ * last eight, leaving room for three more blocks in between: so a block is
+ * a shuffle of its bytes, and two blocks a shuffle into two lanes.
+ */
+static void load_blocks(bs_word q[8], const unsigned char *in, size_t n_blocks)
+{
+	static const unsigned char zero[16];
+	bs_word v[BS_BLOCKS];
+
+	for (size_t b = 0; b < BS_BLOCKS; ++b)
+	{
+		bs_bytes x;
+
+		memcpy(&x, b < n_blocks ? in + 16 * b : zero, sizeof x);
+		v[b] = (bs_word)__builtin_shuffle(x, (bs_bytes){ 0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15 });
+	}
+	for (int i = 0; i < 4; ++i)
+	{
+		q[i] = __builtin_shuffle(v[i], v[i + 4], (bs_word){ 0, 2 });
+		q[i + 4] = __builtin_shuffle(v[i], v[i + 4], (bs_word){ 1, 3 });
+	}
+	ortho(q);
+}
+
+static void store_blocks(unsigned char *out, bs_word q[8], size_t n_blocks)
+{
+	ortho(q);
+	for (size_t b = 0; b < n_blocks; ++b)
+	{
+		bs_word v = b < 4 ? __builtin_shuffle(q[b], q[b + 4], (bs_word){ 0, 2 }) : __builtin_shuffle(q[b - 4], q[b], (bs_word){ 1, 3 });
+		bs_bytes x = __builtin_shuffle((bs_bytes)v, (bs_bytes){ 0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15 });
+
+		memcpy(out + 16 * b, &x, sizeof x);
+	}
+}
+#else
+static inline uint32_t load_le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void store_le32(unsigned char *p, uint32_t x)
+{
+	p[0] = (unsigned char)x;
+	p[1] = (unsigned char)(x >> 8);
+	p[2] = (unsigned char)(x >> 16);
+	p[3] = (unsigned char)(x >> 24);
+}
+
+/* a block's 16 bytes, spread over two words with room for three more */
+static void interleave_in(uint64_t *q0, uint64_t *q1, const unsigned char *blk)
+{
+	uint64_t x0 = load_le32(blk), x1 = load_le32(blk + 4), x2 = load_le32(blk + 8), x3 = load_le32(blk + 12);
+
+	x0 |= x0 << 16;
+	x1 |= x1 << 16;
+	x2 |= x2 << 16;
+	x3 |= x3 << 16;
+	x0 &= 0x0000FFFF0000FFFFULL;
+	x1 &= 0x0000FFFF0000FFFFULL;
+	x2 &= 0x0000FFFF0000FFFFULL;
+	x3 &= 0x0000FFFF0000FFFFULL;
+	x0 |= x0 << 8;
+	x1 |= x1 << 8;
+	x2 |= x2 << 8;
+	x3 |= x3 << 8;
+	x0 &= 0x00FF00FF00FF00FFULL;
+	x1 &= 0x00FF00FF00FF00FFULL;
+	x2 &= 0x00FF00FF00FF00FFULL;
+	x3 &= 0x00FF00FF00FF00FFULL;
+	*q0 = x0 | (x2 << 8);
+	*q1 = x1 | (x3 << 8);
+}
+
+static void interleave_out(unsigned char *blk, uint64_t q0, uint64_t q1)
+{
+	uint64_t x0 = q0 & 0x00FF00FF00FF00FFULL, x1 = q1 & 0x00FF00FF00FF00FFULL;
+	uint64_t x2 = (q0 >> 8) & 0x00FF00FF00FF00FFULL, x3 = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+
+	x0 |= x0 >> 8;
+	x1 |= x1 >> 8;
+	x2 |= x2 >> 8;
+	x3 |= x3 >> 8;
+	x0 &= 0x0000FFFF0000FFFFULL;
+	x1 &= 0x0000FFFF0000FFFFULL;
+	x2 &= 0x0000FFFF0000FFFFULL;
+	x3 &= 0x0000FFFF0000FFFFULL;
+	store_le32(blk, (uint32_t)x0 | (uint32_t)(x0 >> 16));
+	store_le32(blk + 4, (uint32_t)x1 | (uint32_t)(x1 >> 16));
+	store_le32(blk + 8, (uint32_t)x2 | (uint32_t)(x2 >> 16));
+	store_le32(blk + 12, (uint32_t)x3 | (uint32_t)(x3 >> 16));
+}
+
+/* n_blocks of in, up to eight, into bit planes; the rest are zero */
+static void load_blocks(bs_word q[8], const unsigned char *in, size_t n_blocks)
+{
+	static const unsigned char zero[16];
+	uint64_t lane[2][8];
+
+	for (size_t b = 0; b < BS_BLOCKS; ++b)
+		interleave_in(&lane[b / 4][b % 4], &lane[b / 4][b % 4 + 4], b < n_blocks ? in + 16 * b : zero);
+	for (int i = 0; i < 8; ++i)
+		q[i] = (bs_word){ lane[0][i], lane[1][i] };
+	ortho(q);
+	memset(lane, 0, sizeof lane);
+}
+
+static void store_blocks(unsigned char *out, bs_word q[8], size_t n_blocks)
+{
+	ortho(q);
+	for (size_t b = 0; b < n_blocks; ++b)
+		interleave_out(out + 16 * b, q[b % 4][b / 4], q[b % 4 + 4][b / 4]);
+}
+#endif
+
+/* the round keys are stored for both lanes */
+static inline void add_round_key(bs_word q[8], const u_int64_t *sk)
+{
+	for (int i = 0; i < 8; ++i)
+	{
+		bs_word k;
+
+		memcpy(&k, sk + 2 * i, sizeof k);
+		q[i] ^= k;
+	}
+}
+
+/* each 16 bits of a lane is a row: rotate row r right by 4r bits.  where
+ * a vector can shift each of its parts by a different count (NEON), that's
+ * all it takes; elsewhere, rotate rows 1 and 3 by 4, then 2 and 3 by 8.
+ */
+#if defined(__ARM_NEON) || defined(BS_VARIABLE_SHIFTS)
+static inline void shift_rows(bs_word q[8])
+{
+	const bs_word16 right = { 0, 4, 8, 12, 0, 4, 8, 12 }, left = { 0, 12, 8, 4, 0, 12, 8, 4 };
+
+	for (int i = 0; i < 8; ++i)
+	{
+		bs_word16 y = (bs_word16)q[i];
+
+		q[i] = (bs_word)((y >> right) | (y << left));
+	}
+}
+#else
+static inline bs_word rotr16(bs_word x, int n)
+{
+	bs_word16 y = (bs_word16)x;
+
+	return (bs_word)((y >> n) | (y << (16 - n)));
+}
+
+static inline void shift_rows(bs_word q[8])
+{
+	const bs_word rows13 = { 0xFFFF0000FFFF0000ULL, 0xFFFF0000FFFF0000ULL };
+	const bs_word rows23 = { 0xFFFFFFFF00000000ULL, 0xFFFFFFFF00000000ULL };
+
+	for (int i = 0; i < 8; ++i)
+	{
+		bs_word x = q[i];
+
+		x ^= (x ^ rotr16(x, 4)) & rows13;
+		x ^= (x ^ rotr16(x, 8)) & rows23;
+		q[i] = x;
+	}
+}
+#endif
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/* the rotations of whole lanes are shuffles of their 16- and 32-bit parts */
+static inline bs_word rotr32(bs_word x)
+{
+	return (bs_word)__builtin_shuffle((bs_word32)x, (bs_word32){ 1, 0, 3, 2 });
+}
+
+static inline bs_word rotr64_16(bs_word x)
+{
+	return (bs_word)__builtin_shuffle((bs_word16)x, (bs_word16){ 1, 2, 3, 0, 5, 6, 7, 4 });
+}
+#else
+static inline bs_word rotr32(bs_word x)
+{
+	return (x << 32) | (x >> 32);
+}
+
+static inline bs_word rotr64_16(bs_word x)
+{
+	return (x >> 16) | (x << 48);
+}
+#endif
+
+static inline void mix_columns(bs_word q[8])
+{
+	bs_word q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3], q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+	bs_word r0 = rotr64_16(q0);
+	bs_word r1 = rotr64_16(q1);
+	bs_word r2 = rotr64_16(q2);
+	bs_word r3 = rotr64_16(q3);
+	bs_word r4 = rotr64_16(q4);
+	bs_word r5 = rotr64_16(q5);
+	bs_word r6 = rotr64_16(q6);
+	bs_word r7 = rotr64_16(q7);
+
+	q[0] = q7 ^ r7 ^ r0 ^ rotr32(q0 ^ r0);
+	q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ rotr32(q1 ^ r1);
+	q[2] = q1 ^ r1 ^ r2 ^ rotr32(q2 ^ r2);
+	q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ rotr32(q3 ^ r3);
+	q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ rotr32(q4 ^ r4);
+	q[5] = q4 ^ r4 ^ r5 ^ rotr32(q5 ^ r5);
+	q[6] = q5 ^ r5 ^ r6 ^ rotr32(q6 ^ r6);
+	q[7] = q6 ^ r6 ^ r7 ^ rotr32(q7 ^ r7);
+}
+
+static void encrypt_blocks(const aes_context *cx, bs_word q[8])
+{
+	const u_int64_t *sk = cx->aes_ct_key;
+
+	add_round_key(q, sk);
+	for (unsigned int r = 1; r < AES_NRND(cx); ++r)
+	{
+		sbox(q);
+		shift_rows(q);
+		mix_columns(q);
+		add_round_key(q, sk + 16 * r);
+	}
+	sbox(q);
+	shift_rows(q);
+	add_round_key(q, sk + 16 * AES_NRND(cx));
+}
+
+/* SubWord, by the circuit */
+static void sub_word(unsigned char w[4])
+{
+	unsigned char blk[16] = { 0 };
+	bs_word q[8];
+
+	memcpy(blk, w, 4);
+	load_blocks(q, blk, 1);
+	sbox(q);
+	store_blocks(blk, q, 1);
+	memcpy(w, blk, 4);
+	memset(blk, 0, sizeof blk);
+	memset(q, 0, sizeof q);
+}
+
+void aes_ct_set_key(aes_context *cx, const unsigned char in_key[], int n_bytes, int f)
+{
+	static const unsigned char rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+	unsigned char w[4 * (AES_MAX_NRND + 1)][4], rk[BS_BLOCKS][16];
+	unsigned int nk, n_words;
+	bs_word q[8];
+
+	(void)f;	/* nothing to decrypt with */
+#if defined(AES_ENCRYPT_128)
+	(void)n_bytes;
+	nk = 4;
+#else
+	switch (n_bytes)
+	{
+	case 32:
+	case 256:
+		nk = 8;
+		break;
+	case 24:
+	case 192:
+		nk = 6;
+		break;
+	default:
+		nk = 4;
+		break;
+	}
+#endif
+	cx->aes_Nkey = nk;
+	cx->aes_Nrnd = nk + 6;
+	n_words = 4 * (AES_NRND(cx) + 1);
+
+	/* FIPS-197 5.2, a byte at a time */
+	memcpy(w, in_key, 4 * nk);
+	for (unsigned int i = nk; i < n_words; ++i)
+	{
+		unsigned char t[4];
+
+		memcpy(t, w[i - 1], 4);
+		if (i % nk == 0)
+		{
+			unsigned char t0 = t[0];
+
+			t[0] = t[1];
+			t[1] = t[2];
+			t[2] = t[3];
+			t[3] = t0;
+			sub_word(t);
+			t[0] ^= rcon[i / nk - 1];
+		}
+		else if (nk > 6 && i % nk == 4)
+			sub_word(t);
+		for (int j = 0; j < 4; ++j)
+			w[i][j] = w[i - nk][j] ^ t[j];
+	}
+
+	/* each round key as though it were every block */
+	for (unsigned int r = 0; r <= AES_NRND(cx); ++r)
+	{
+		for (int b = 0; b < BS_BLOCKS; ++b)
+			memcpy(rk[b], w[4 * r], 16);
+		load_blocks(q, &rk[0][0], BS_BLOCKS);
+		memcpy(cx->aes_ct_key + 16 * r, q, sizeof q);
+	}
+
+	memset(w, 0, sizeof w);
+	memset(rk, 0, sizeof rk);
+	memset(q, 0, sizeof q);
+}
+
+void aes_ct_encrypt(const aes_context *cx, const unsigned char in[], unsigned char out[])
+{
+	bs_word q[8];
+
+	load_blocks(q, in, 1);
+	encrypt_blocks(cx, q);
+	store_blocks(out, q, 1);
+}
+
+/* a block a pass: the next one's input is this one's output */
+void aes_ct_cbc(const aes_context *cx, unsigned char iv[], const unsigned char *in, unsigned char *out, size_t n_blocks)
+{
+	unsigned char x[16];
+
+	for (size_t b = 0; b < n_blocks; ++b)
+	{
+		bs_word q[8];
+
+		for (int i = 0; i < 16; ++i)
+			x[i] = iv[i] ^ in[16 * b + i];
+		load_blocks(q, x, 1);
+		encrypt_blocks(cx, q);
+		store_blocks(iv, q, 1);
+		if (out)
+			memcpy(out + 16 * b, iv, 16);
+	}
+	memset(x, 0, sizeof x);
+}
+
+void aes_ct_ctr(const aes_context *cx, unsigned char ctr[], unsigned char *out, size_t n_blocks)
+{
+	unsigned char counters[BS_BLOCKS][16];
+
+	while (n_blocks)
+	{
+		const size_t n = n_blocks < BS_BLOCKS ? n_blocks : BS_BLOCKS;
+		bs_word q[8];
+
+		for (size_t b = 0; b < n; ++b)
+		{
+			memcpy(counters[b], ctr, 16);
+			for (int i = 15; i >= 0 && !++ctr[i]; --i)
+				;
+		}
+		load_blocks(q, &counters[0][0], n);
+		encrypt_blocks(cx, q);
+		store_blocks(out, q, n);
+		out += 16 * n;
+		n_blocks -= n;
+	}
+}
@@ -0,0 +1,29 @@
+/*
+ * Bitsliced AES encryption, for cpus without AES instructions.
+ *
+ * The state of eight blocks is held as eight 128-bit words, one for each
+ * bit of a byte, and the S-box is a circuit of logic operations on them
+ * (Boyar and Peralta's), after Kasper and Schwabe; the layout of the bits
+ * is BearSSL's ct64, on two lanes.  Nothing is looked up by a secret
+ * index and nothing branches on one, key schedule included, so there's no
+ * timing to leak through the cache.
+ *
+ * A pass costs the same for one block as for eight: CTR and independent
+ * blocks fill it, a CBC chain only gets one block a pass.
+ */
+
+#ifndef _AES_CT_H
+#define _AES_CT_H
+
+#include <stddef.h>
+#include "aes.h"
+
+/* the round keys, into aes_ct_key.  aes_e_key and aes_d_key are left
+ * alone, so aes_encrypt_table() can't use the context.
+ */
+void aes_ct_set_key(aes_context *cx, const unsigned char in_key[], int n_bytes, int f);
+void aes_ct_encrypt(const aes_context *cx, const unsigned char in[], unsigned char out[]);
+void aes_ct_cbc(const aes_context *cx, unsigned char iv[], const unsigned char *in, unsigned char *out, size_t n_blocks);
+void aes_ct_ctr(const aes_context *cx, unsigned char ctr[], unsigned char *out, size_t n_blocks);
+
+#endif
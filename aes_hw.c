@@ -0,0 +1,574 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "aes.h"
+#include "aes_hw.h"
+#include "aes_ct.h"
+
+/* the instructions take the round keys as the bytes of FIPS-197, which is
+ * how aes.c lays out its words on a little-endian cpu
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <immintrin.h>
+#define HAVE_AESNI 1
+#endif
+#if defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_AES
+#define HWCAP_AES	(1 << 3)
+#endif
+#define HAVE_ARMCE 1
+#endif
+
+typedef void (*aes_set_key_fn)(aes_context *cx, const unsigned char in_key[], int n_bytes, int f);
+typedef void (*aes_encrypt_fn)(const aes_context *cx, const unsigned char in[], unsigned char out[]);
+typedef void (*aes_cbc_fn)(const aes_context *cx, unsigned char iv[], const unsigned char *in, unsigned char *out, size_t n_blocks);
+typedef void (*aes_ctr_fn)(const aes_context *cx, unsigned char ctr[], unsigned char *out, size_t n_blocks);
+
+/* CTR counters are big-endian 128-bit numbers; the vector code keeps them
+ * as two halves
+ */
+static inline uint64_t load_be64(const unsigned char *p)
+{
+	uint64_t x = 0;
+
+	for (int i = 0; i < 8; ++i)
+		x = (x << 8) | p[i];
+	return x;
+}
+
+static inline void store_be64(unsigned char *p, uint64_t x)
+{
+	for (int i = 7; i >= 0; --i, x >>= 8)
+		p[i] = (unsigned char)x;
+}
+
+static void cbc_table(const aes_context *cx, unsigned char iv[], const unsigned char *in, unsigned char *out, size_t n_blocks)
+{
+	unsigned char x[16];
+
+	for (size_t b = 0; b < n_blocks; ++b)
+	{
+		for (int i = 0; i < 16; ++i)
+			x[i] = iv[i] ^ in[16 * b + i];
+		aes_encrypt_table(cx, x, iv);
+		if (out)
+			memcpy(out + 16 * b, iv, 16);
+	}
+	memset(x, 0, sizeof x);
+}
+
+static void ctr_table(const aes_context *cx, unsigned char ctr[], unsigned char *out, size_t n_blocks)
+{
+	for (size_t b = 0; b < n_blocks; ++b)
+	{
+		aes_encrypt_table(cx, ctr, out + 16 * b);
+		for (int i = 15; i >= 0 && !++ctr[i]; --i)
+			;
+	}
+}
+
+#ifdef HAVE_AESNI
+#define AESNI	__attribute__((target("aes,sse2")))
+
+static AESNI void encrypt_aesni(const aes_context *cx, const unsigned char in[], unsigned char out[])
+{
+	const __m128i *rk = (const __m128i *)cx->aes_e_key;
+	__m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in), _mm_loadu_si128(rk));
+	unsigned int r;
+
+	for (r = 1; r < AES_NRND(cx); ++r)
+		s = _mm_aesenc_si128(s, _mm_loadu_si128(rk + r));
+	s = _mm_aesenclast_si128(s, _mm_loadu_si128(rk + r));
+	_mm_storeu_si128((__m128i *)out, s);
+}
+
+/* each block depends on the last, so the round keys are all there is to
+ * hoist out of the loop
+ */
+static AESNI void cbc_aesni(const aes_context *cx, unsigned char iv[], const unsigned char *in, unsigned char *out, size_t n_blocks)
+{
+	const unsigned int nr = AES_NRND(cx);
+	__m128i rk[AES_MAX_NRND + 1], c = _mm_loadu_si128((const __m128i *)iv);
+	unsigned int r;
+
+	for (r = 0; r <= nr; ++r)
+		rk[r] = _mm_loadu_si128((const __m128i *)cx->aes_e_key + r);
+	for (size_t b = 0; b < n_blocks; ++b)
+	{
+		c = _mm_xor_si128(c, _mm_loadu_si128((const __m128i *)in + b));
+		c = _mm_xor_si128(c, rk[0]);
+		for (r = 1; r < nr; ++r)
+			c = _mm_aesenc_si128(c, rk[r]);
+		c = _mm_aesenclast_si128(c, rk[nr]);
+		if (out)
+			_mm_storeu_si128((__m128i *)out + b, c);
+	}
+	_mm_storeu_si128((__m128i *)iv, c);
+}
+
+static inline AESNI __m128i ctr_block_aesni(uint64_t hi, uint64_t lo)
+{
+	return _mm_set_epi64x((long long)__builtin_bswap64(lo), (long long)__builtin_bswap64(hi));
+}
+
+/* four blocks in flight, to cover the latency of aesenc */
+static AESNI void ctr_aesni(const aes_context *cx, unsigned char ctr[], unsigned char *out, size_t n_blocks)
+{
+	const unsigned int nr = AES_NRND(cx);
+	uint64_t hi = load_be64(ctr), lo = load_be64(ctr + 8);
+	__m128i rk[AES_MAX_NRND + 1], s[4];
+	unsigned int r;
+	size_t b = 0;
+
+	for (r = 0; r <= nr; ++r)
+		rk[r] = _mm_loadu_si128((const __m128i *)cx->aes_e_key + r);
+	for (; b + 4 <= n_blocks; b += 4)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			s[j] = _mm_xor_si128(ctr_block_aesni(hi, lo), rk[0]);
+			hi += !++lo;
+		}
+		for (r = 1; r < nr; ++r)
+		{
+			s[0] = _mm_aesenc_si128(s[0], rk[r]);
+			s[1] = _mm_aesenc_si128(s[1], rk[r]);
+			s[2] = _mm_aesenc_si128(s[2], rk[r]);
+			s[3] = _mm_aesenc_si128(s[3], rk[r]);
+		}
+		for (int j = 0; j < 4; ++j)
+			_mm_storeu_si128((__m128i *)out + b + j, _mm_aesenclast_si128(s[j], rk[nr]));
+	}
+	for (; b < n_blocks; ++b)
+	{
+		s[0] = _mm_xor_si128(ctr_block_aesni(hi, lo), rk[0]);
+		hi += !++lo;
+		for (r = 1; r < nr; ++r)
+			s[0] = _mm_aesenc_si128(s[0], rk[r]);
+		_mm_storeu_si128((__m128i *)out + b, _mm_aesenclast_si128(s[0], rk[nr]));
+	}
+	store_be64(ctr, hi);
+	store_be64(ctr + 8, lo);
+}
+
+static int have_aesni(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("aes");
+}
+#endif
+
+#ifdef HAVE_ARMCE
+#define ARMCE	__attribute__((target("+crypto")))
+
+/* aese adds the round key before substituting, so the last key is a plain xor */
+static ARMCE void encrypt_armce(const aes_context *cx, const unsigned char in[], unsigned char out[])
+{
+	const uint8_t *rk = (const uint8_t *)cx->aes_e_key;
+	uint8x16_t s = vld1q_u8(in);
+	unsigned int r;
+
+	for (r = 0; r < AES_NRND(cx) - 1; ++r)
+		s = vaesmcq_u8(vaeseq_u8(s, vld1q_u8(rk + 16 * r)));
+	s = vaeseq_u8(s, vld1q_u8(rk + 16 * r));
+	s = veorq_u8(s, vld1q_u8(rk + 16 * (r + 1)));
+	vst1q_u8(out, s);
+}
+
+static ARMCE void cbc_armce(const aes_context *cx, unsigned char iv[], const unsigned char *in, unsigned char *out, size_t n_blocks)
+{
+	const unsigned int nr = AES_NRND(cx);
+	uint8x16_t rk[AES_MAX_NRND + 1], c = vld1q_u8(iv);
+	unsigned int r;
+
+	for (r = 0; r <= nr; ++r)
+		rk[r] = vld1q_u8((const uint8_t *)cx->aes_e_key + 16 * r);
+	for (size_t b = 0; b < n_blocks; ++b)
+	{
+		c = veorq_u8(c, vld1q_u8(in + 16 * b));
+		for (r = 0; r < nr - 1; ++r)
+			c = vaesmcq_u8(vaeseq_u8(c, rk[r]));
+		c = veorq_u8(vaeseq_u8(c, rk[nr - 1]), rk[nr]);
+		if (out)
+			vst1q_u8(out + 16 * b, c);
+	}
+	vst1q_u8(iv, c);
+}
+
+static inline ARMCE uint8x16_t ctr_block_armce(uint64_t hi, uint64_t lo)
+{
+	return vcombine_u8(vcreate_u8(__builtin_bswap64(hi)), vcreate_u8(__builtin_bswap64(lo)));
+}
+
+static ARMCE void ctr_armce(const aes_context *cx, unsigned char ctr[], unsigned char *out, size_t n_blocks)
+{
+	const unsigned int nr = AES_NRND(cx);
+	uint64_t hi = load_be64(ctr), lo = load_be64(ctr + 8);
+	uint8x16_t rk[AES_MAX_NRND + 1], s[4];
+	unsigned int r;
+	size_t b = 0;
+
+	for (r = 0; r <= nr; ++r)
+		rk[r] = vld1q_u8((const uint8_t *)cx->aes_e_key + 16 * r);
+	for (; b + 4 <= n_blocks; b += 4)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			s[j] = ctr_block_armce(hi, lo);
+			hi += !++lo;
+		}
+		for (r = 0; r < nr - 1; ++r)
+		{
+			s[0] = vaesmcq_u8(vaeseq_u8(s[0], rk[r]));
+			s[1] = vaesmcq_u8(vaeseq_u8(s[1], rk[r]));
+			s[2] = vaesmcq_u8(vaeseq_u8(s[2], rk[r]));
+			s[3] = vaesmcq_u8(vaeseq_u8(s[3], rk[r]));
+		}
+		for (int j = 0; j < 4; ++j)
+			vst1q_u8(out + 16 * (b + j), veorq_u8(vaeseq_u8(s[j], rk[nr - 1]), rk[nr]));
+	}
+	for (; b < n_blocks; ++b)
+	{
+		s[0] = ctr_block_armce(hi, lo);
+		hi += !++lo;
+		for (r = 0; r < nr - 1; ++r)
+			s[0] = vaesmcq_u8(vaeseq_u8(s[0], rk[r]));
+		vst1q_u8(out + 16 * b, veorq_u8(vaeseq_u8(s[0], rk[nr - 1]), rk[nr]));
+	}
+	store_be64(ctr, hi);
+	store_be64(ctr + 8, lo);
+}
+
+static int have_armce(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+}
+#endif
+
+static int have_portable(void)
+{
+	return 1;
+}
+
+/* in order of preference.  the tables come last, for reference: they're
+ * never chosen while the bitsliced code works, since what they look up
+ * gives away the key through the cache.
+ */
+static const struct aes_implementation
+{
+	const char *name;
+	aes_set_key_fn set_key;
+	aes_encrypt_fn encrypt;
+	aes_cbc_fn cbc;
+	aes_ctr_fn ctr;
+	int (*available)(void);
+} implementations[] = {
+#ifdef HAVE_AESNI
+	{ "aesni", aes_set_key_table, encrypt_aesni, cbc_aesni, ctr_aesni, have_aesni },
+#endif
+#ifdef HAVE_ARMCE
+	{ "armv8-ce", aes_set_key_table, encrypt_armce, cbc_armce, ctr_armce, have_armce },
+#endif
+	{ "bitsliced", aes_ct_set_key, aes_ct_encrypt, aes_ct_cbc, aes_ct_ctr, have_portable },
+	{ "table", aes_set_key_table, aes_encrypt_table, cbc_table, ctr_table, have_portable },
+};
+
+#define N_IMPLEMENTATIONS	(sizeof implementations / sizeof implementations[0])
+
+/* the key lengths the build takes, from 128 bits up by 64 */
+#if defined(AES_ENCRYPT_128)
+#define N_KEY_LENGTHS	1
+#else
+#define N_KEY_LENGTHS	3
+#endif
+
+static const struct aes_implementation *selected = &implementations[N_IMPLEMENTATIONS - 1];
+
+void aes_set_key(aes_context *cx, const unsigned char in_key[], const int n_bytes, const int f)
+{
+	selected->set_key(cx, in_key, n_bytes, f);
+}
+
+void aes_encrypt(const aes_context *cx, const unsigned char in_blk[], unsigned char out_blk[])
+{
+	selected->encrypt(cx, in_blk, out_blk);
+}
+
+void aes_cbc_encrypt(const aes_context *cx, unsigned char iv[AES_BLOCK_SIZE], const unsigned char *in, unsigned char *out, size_t n_blocks)
+{
+	selected->cbc(cx, iv, in, out, n_blocks);
+}
+
+void aes_cbc_mac(const aes_context *cx, unsigned char mac[AES_BLOCK_SIZE], const unsigned char *in, size_t n_blocks)
+{
+	selected->cbc(cx, mac, in, NULL, n_blocks);
+}
+
+void aes_ctr_keystream(const aes_context *cx, unsigned char ctr[AES_BLOCK_SIZE], unsigned char *out, size_t n_blocks)
+{
+	selected->ctr(cx, ctr, out, n_blocks);
+}
+
+/* FIPS-197 appendix C, and SP 800-38A F.2.1 and F.5.1 for the modes */
+static int known_answers(const struct aes_implementation *impl)
+{
+	static const unsigned char plaintext[16] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+	};
+	static const unsigned char ciphertext[3][16] = {
+		{ 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a },
+		{ 0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0, 0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91 },
+		{ 0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89 },
+	};
+	static const unsigned char mode_key[16] = {
+		0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+	};
+	static const unsigned char mode_plaintext[64] = {
+		0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+		0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+		0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+		0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10,
+	};
+	static const unsigned char cbc_ciphertext[64] = {
+		0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+		0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+		0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+		0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7,
+	};
+	static const unsigned char ctr_ciphertext[64] = {
+		0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+		0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+		0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+		0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee,
+	};
+	unsigned char key[32], out[64], iv[16];
+	aes_context cx;
+
+	for (int i = 0; i < 32; ++i)
+		key[i] = (unsigned char)i;
+	for (int k = 0; k < N_KEY_LENGTHS; ++k)
+	{
+		impl->set_key(&cx, key, 16 + 8 * k, 1);
+		impl->encrypt(&cx, plaintext, out);
+		if (memcmp(out, ciphertext[k], 16))
+			return 0;
+	}
+
+	impl->set_key(&cx, mode_key, sizeof mode_key, 1);
+	for (int i = 0; i < 16; ++i)
+		iv[i] = (unsigned char)i;
+	impl->cbc(&cx, iv, mode_plaintext, out, 4);
+	if (memcmp(out, cbc_ciphertext, sizeof out) || memcmp(iv, cbc_ciphertext + 48, sizeof iv))
+		return 0;
+
+	for (int i = 0; i < 16; ++i)
+		iv[i] = (unsigned char)(0xf0 + i);
+	impl->ctr(&cx, iv, out, 4);
+	for (int i = 0; i < 64; ++i)
+		out[i] ^= mode_plaintext[i];
+	return memcmp(out, ctr_ciphertext, sizeof out) == 0;
+}
+
+const char *aes_select_implementation(void)
+{
+	for (size_t i = 0; i < N_IMPLEMENTATIONS; ++i)
+	{
+		if (implementations[i].available() && known_answers(&implementations[i]))
+		{
+			selected = &implementations[i];
+			return selected->name;
+		}
+	}
+	/* not even the tables: leave them, and let the self-test say so */
+	selected = &implementations[N_IMPLEMENTATIONS - 1];
+	return selected->name;
+}
+
+static uint64_t xorshift(uint64_t *x)
+{
+	*x ^= *x << 13; *x ^= *x >> 7; *x ^= *x << 17;
+	return *x;
+}
+
+static void random_bytes(uint64_t *x, unsigned char *p, size_t n)
+{
+	for (size_t j = 0; j < n; j += 8)
+	{
+		uint64_t r = xorshift(x);
+		memcpy(p + j, &r, n - j < 8 ? n - j : 8);
+	}
+}
+
+/* against the tables, on random keys of every length, random runs of
+ * blocks, and counters about to carry out of their low half
+ */
+static int agrees_with_table(const struct aes_implementation *impl, uint64_t *x)
+{
+	enum { N_KEYS = 48, MAX_BLOCKS = 37 };
+	unsigned char key[32], in[MAX_BLOCKS * 16], got[MAX_BLOCKS * 16], want[MAX_BLOCKS * 16];
+	unsigned char iv_got[16], iv_want[16];
+	aes_context cx, ref;
+
+	for (int k = 0; k < N_KEYS; ++k)
+	{
+		const int key_bits = 128 + 64 * (k % N_KEY_LENGTHS);
+		const size_t n = (size_t)(xorshift(x) % (MAX_BLOCKS + 1));
+
+		random_bytes(x, key, sizeof key);
+		impl->set_key(&cx, key, key_bits / 8, 1);
+		aes_set_key_table(&ref, key, key_bits / 8, 1);
+		random_bytes(x, in, sizeof in);
+
+		for (size_t b = 0; b < n; ++b)
+		{
+			impl->encrypt(&cx, in + 16 * b, got + 16 * b);
+			aes_encrypt_table(&ref, in + 16 * b, want + 16 * b);
+		}
+		if (memcmp(got, want, n * 16))
+		{
+			fprintf(stderr, "aes (%s): %d-bit key %d: a block differs from the tables\n", impl->name, key_bits, k);
+			return 0;
+		}
+
+		/* in place, as the whitening does it */
+		random_bytes(x, iv_got, sizeof iv_got);
+		memcpy(iv_want, iv_got, sizeof iv_want);
+		memcpy(got, in, n * 16);
+		impl->cbc(&cx, iv_got, got, got, n);
+		cbc_table(&ref, iv_want, in, want, n);
+		if (memcmp(got, want, n * 16) || memcmp(iv_got, iv_want, 16))
+		{
+			fprintf(stderr, "aes (%s): %d-bit key %d: CBC of %zu blocks differs from the tables\n", impl->name, key_bits, k, n);
+			return 0;
+		}
+
+		random_bytes(x, iv_got, sizeof iv_got);
+		if (k & 1)
+			memset(iv_got + 8 + k % 5, 0xff, 8 - k % 5);
+		memcpy(iv_want, iv_got, sizeof iv_want);
+		impl->ctr(&cx, iv_got, got, n);
+		ctr_table(&ref, iv_want, want, n);
+		if (memcmp(got, want, n * 16) || memcmp(iv_got, iv_want, 16))
+		{
+			fprintf(stderr, "aes (%s): %d-bit key %d: CTR of %zu blocks differs from the tables\n", impl->name, key_bits, k, n);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int aes_self_test(void)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	int all_ok = 1;
+
+	for (size_t i = 0; i < N_IMPLEMENTATIONS; ++i)
+	{
+		const struct aes_implementation *impl = &implementations[i];
+		int ok;
+
+		if (!impl->available())
+			continue;
+
+		ok = known_answers(impl);
+		if (!ok)
+			fprintf(stderr, "aes (%s): wrong FIPS-197 or SP 800-38A known answer\n", impl->name);
+		else
+			ok = agrees_with_table(impl, &x);
+
+		printf("aes self-test (%s): %s\n", impl->name, ok ? "ok" : "FAILED");
+		all_ok &= ok;
+	}
+	return all_ok;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* --aes-benchmark: "block" chains single aes_encrypt() calls, each on the
+ * block before, so that's latency, as was the whitening; "cbc" is the bulk
+ * call, still serial, and "ctr" the bulk call with blocks in flight
+ * together.  cycles are the time stamp counter's, where there is one.
+ */
+void aes_benchmark(void)
+{
+	enum { N_BLOCKS = 256, N_CALLS = 256 };
+	static const char *const modes[] = { "block", "cbc", "ctr" };
+	static unsigned char buf[N_BLOCKS * 16];
+	unsigned char key[32], iv[16] = { 0 };
+
+	for (int i = 0; i < 32; ++i)
+		key[i] = (unsigned char)(i * 37);
+
+#ifdef HAVE_AESNI
+	printf("aes, cycles per block\n");
+#else
+	printf("aes, ns per block\n");
+#endif
+	printf("%-16s", "");
+	for (int k = 0; k < N_KEY_LENGTHS; ++k)
+		printf("  %4d-bit", 128 + 64 * k);
+	printf("\n");
+	for (size_t i = 0; i < N_IMPLEMENTATIONS; ++i)
+	{
+		const struct aes_implementation *impl = &implementations[i];
+
+		if (!impl->available())
+			continue;
+
+		for (int m = 0; m < 3; ++m)
+		{
+			printf("%-10s %-5s", impl->name, modes[m]);
+			for (int k = 0; k < N_KEY_LENGTHS; ++k)
+			{
+				aes_context cx;
+				size_t n_runs = 0;
+				double start, elapsed;
+#ifdef HAVE_AESNI
+				uint64_t start_tsc;
+#endif
+
+				impl->set_key(&cx, key, 16 + 8 * k, 1);
+#ifdef HAVE_AESNI
+				start_tsc = __rdtsc();
+#endif
+				start = now_ns();
+				do
+				{
+					for (int c = 0; c < N_CALLS; ++c)
+					{
+						if (m == 0)
+						{
+							for (int b = 0; b < N_BLOCKS; ++b)
+								impl->encrypt(&cx, buf, buf);
+						}
+						else if (m == 1)
+							impl->cbc(&cx, iv, buf, buf, N_BLOCKS);
+						else
+							impl->ctr(&cx, iv, buf, N_BLOCKS);
+					}
+					/* the results are never used: keep them */
+					__asm__ __volatile__("" : : "r"(buf) : "memory");
+					++n_runs;
+					elapsed = now_ns() - start;
+				}
+				while (elapsed < 1e8);
+
+#ifdef HAVE_AESNI
+				printf("  %8.1f", (double)(__rdtsc() - start_tsc) / ((double)n_runs * N_CALLS * N_BLOCKS));
+#else
+				printf("  %8.2f", elapsed / ((double)n_runs * N_CALLS * N_BLOCKS));
+#endif
+			}
+			printf("\n");
+		}
+	}
+}
@@ -0,0 +1,45 @@
+/*
+ * The implementations behind aes.h's aes_set_key() and aes_encrypt().
+ *
+ * Both run whichever one aes_select_implementation() chose: AES-NI on
+ * x86-64, the ARMv8 crypto extension on aarch64, and otherwise the
+ * constant-time bitsliced code in aes_ct.c.  Gladman's tables are kept
+ * only to check the others against, and until something selects.  A key
+ * schedule is only good for the implementation that made it, so select
+ * before setting any key.  Only encryption is provided; nothing here
+ * decrypts.
+ *
+ * The bulk calls take runs of whole blocks, with the round keys loaded
+ * once.  CBC can't start a block before the last one is done, but CTR's
+ * blocks are independent, and go through the rounds several at a time.
+ */
+
+#ifndef _AES_HW_H
+#define _AES_HW_H
+
+#include <stddef.h>
+#include "aes.h"
+
+/* pick the fastest implementation the cpu has that gets the FIPS-197 and
+ * SP 800-38A known answers right, and return its name.  call it at
+ * startup, before any key is set or any other thread encrypts.
+ */
+const char *aes_select_implementation(void);
+
+/* CBC from in to out, which may be the same; iv is left as the last block
+ * out, to carry on from
+ */
+void aes_cbc_encrypt(const aes_context *cx, unsigned char iv[AES_BLOCK_SIZE], const unsigned char *in, unsigned char *out, size_t n_blocks);
+/* CBC, keeping only the last block, in mac */
+void aes_cbc_mac(const aes_context *cx, unsigned char mac[AES_BLOCK_SIZE], const unsigned char *in, size_t n_blocks);
+/* keystream from a big-endian 128-bit counter, left at the next block's */
+void aes_ctr_keystream(const aes_context *cx, unsigned char ctr[AES_BLOCK_SIZE], unsigned char *out, size_t n_blocks);
+
+/* the known answers, and agreement with the tables, for every implementation
+ * the cpu runs
+ */
+int aes_self_test(void);
+/* print the time per block of each implementation, a block at a time and in bulk */
+void aes_benchmark(void);
+
+#endif
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <limits.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <string.h>
@@ -26,7 +27,10 @@
 #include <sys/wait.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <poll.h>
 #include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include <alsa/asoundlib.h>
 #include <linux/soundcard.h>
@@ -38,8 +42,17 @@
 #include "val.h"
 #include "RNGTEST.h"
 #include "error.h"
+#include "ring.h"
+#include "source.h"
+#include "debias_simd.h"
+#include "spike_simd.h"
+#include "spike_event.h"
+#include "extract.h"
 
 #include "aes.h"
+#include "aes_hw.h"
+#include "krng.h"
+#include "reservoir.h"
 #if AES_BLOCK_SIZE != 16
 #error expecting compiled-in 128 bit AES.
 #endif
@@ -53,6 +66,7 @@
 
 void dolog(int level, char *format, ...);
 
+
 extern int loggingstate;
 char skip_test = 0;
 int error_state = 0;
@@ -73,26 +87,177 @@ static char *spike_log_path = 0;
 static FILE *spike_log_file = 0;
 static double spike_log_interval_seconds = 3600.0;
 
-static char *cdevice = "hw:0";				/* capture device */
-const char *id = "capture";
-int err;
+/* optional auto-calibration: the threshold and edge delta follow each
+ * channel's noise floor and pulse height, within these bounds (percent).
+ */
+static int spike_auto_calibrate = 0;
+static double spike_threshold_bounds[2], spike_edge_min_delta_bounds[2] = { -1, -1 };
+#define SPIKE_CALIBRATION_INTERVAL_SECONDS	1
+#define SPIKE_CALIBRATION_NOISE_SAMPLES		4096	/* per channel, per chunk read */
+#define SPIKE_CALIBRATION_NOISE_WEIGHT		(1.0 / 16.0)
+#define SPIKE_CALIBRATION_HEIGHT_WEIGHT		(1.0 / 64.0)
+#define SPIKE_CALIBRATION_MIN_PULSES		16
+#define SPIKE_CALIBRATION_NOISE_SIGMAS		6.0	/* threshold at least this far above the baseline */
+#define SPIKE_CALIBRATION_HEIGHT_FRACTION	0.5	/* ...and this far up the pulse */
+#define SPIKE_CALIBRATION_EDGE_FRACTION		0.4	/* edge delta, relative to the threshold */
+#define SPIKE_CALIBRATION_HYSTERESIS		0.5	/* percent of full scale */
+#define SPIKE_EVENTS_PER_BATCH			256	/* extracted early if a period has more */
+
+/* optional sub-sample onset timing: the threshold crossing is found on a
+ * cubic through the last four samples, to this many bits of a sample.
+ */
+static int spike_onset_fraction_bits = 0;
+#define SPIKE_ONSET_MAX_FRACTION_BITS		12
+static double (*spike_onset_weights)[SPIKE_EVENT_TAPS];
+
+#define DEFAULT_CAPTURE_DEVICE			"hw:0"
+#define MAX_CAPTURE_DEVICES			16
+static char *cdevices[MAX_CAPTURE_DEVICES];		/* capture devices */
+static int n_cdevices = 0;
+#define MAX_CHANNELS				32
+static struct source_params source_params =
+{
+	.format = SND_PCM_FORMAT_UNKNOWN,
+	.channels = 2,
+};
+
+/* optional dedicated capture thread, feeding the processing loop through
+ * a lock-free ring of capture_period slots.
+ */
+struct capture_period
+{
+	snd_pcm_uframes_t n_frames;
+	snd_pcm_uframes_t n_frames_lost;	/* missing just before this period: ring overflow, or lost by the device */
+	char frames[];
+};
+#define DEFAULT_CAPTURE_RING_PERIODS		64
+#define CAPTURE_PERIODS_PER_SECOND		20
+static int use_capture_thread = 0;
+static size_t capture_ring_periods = DEFAULT_CAPTURE_RING_PERIODS;
+static int self_test = 0;
+
+/* whitened output goes to the kernel in batches of this many bytes, or
+ * after this long
+ */
+#define DEFAULT_KRNG_BATCH_BYTES		512
+#define DEFAULT_KRNG_BATCH_MS			1000
+static size_t krng_batch_bytes = DEFAULT_KRNG_BATCH_BYTES;
+static long krng_batch_ms = DEFAULT_KRNG_BATCH_MS;
+static struct krng_batch krng_out;
+/* whether this run's output goes to the kernel at all */
+static int credit_kernel = 0;
+
+/* ...but first wait in the reservoir for the kernel to want them, unless
+ * it's 0 bytes.  classic mode resumes capture below the low watermark.
+ */
+#define DEFAULT_RESERVOIR_BYTES			65536
+#define DEFAULT_RESERVOIR_LOW_PERCENT		50
+static size_t reservoir_bytes = DEFAULT_RESERVOIR_BYTES;
+static double reservoir_low_percent = DEFAULT_RESERVOIR_LOW_PERCENT;
+static struct reservoir reservoir;
+
+static int spike_benchmark = 0;
+static int aes_benchmark_only = 0;
+static enum extractor extractor = EXTRACTOR_VON_NEUMANN;
+
+/* --extractor lsb: the low lsb_bits of the first two channels, through
+ * AES CBC-MAC -- lsb_ratio blocks in for each block out.  the credit
+ * assumes lsb_entropy_per_bit of min-entropy in each harvested bit.
+ */
+static unsigned int lsb_bits = 2;
+static unsigned int lsb_ratio = 16;
+static double lsb_entropy_per_bit = 0.05;
+static double lsb_credit_per_bit;
+#define LSB_MAC_RUN_BLOCKS	16
+
+/* --debias-threads: classic mode debiases each batch in shards of
+ * DEBIAS_SHARD_FRAMES, on this thread and debias_threads - 1 others.
+ */
+#define DEBIAS_SHARD_FRAMES	4096
+#define MAX_DEBIAS_THREADS	64
+static int debias_threads = 0;
+
+struct debias_state
+{
+	long psl, psr;		/* previous samples */
+	char a;			/* alternater */
+	unsigned char byte_out;
+	int bits_out;
+	int raw;		/* self-test: just collect the bytes */
+
+	/* --extractor peres or elias: order bits waiting for a whole block */
+	extract_fn extract;
+	uint64_t block;
+	unsigned int block_bits;
+
+	/* --extractor lsb: harvested bits, and the CBC-MAC conditioning them,
+	 * a run of up to LSB_MAC_RUN_BLOCKS blocks at a time */
+	unsigned int lsb_acc, lsb_acc_bits;
+	unsigned char lsb_block[LSB_MAC_RUN_BLOCKS * AES_BLOCK_SIZE], lsb_mac[AES_BLOCK_SIZE];
+	unsigned int lsb_block_len, lsb_n_blocks;
+	int lsb_keyed;
+	int lsb_harvest;	/* a --debias-threads shard: pass the lsbs out unconditioned */
+	aes_context lsb_key;
+
+	uint64_t n_bytes_out;	/* yield, before the RNG test */
+};
+
+/* inner loops, specialized for each (format, channel count) */
+typedef void (*debias_kernel_t)(struct debias_state *ds, const char *frames, snd_pcm_uframes_t n_frames, unsigned int channels, char *output, int *n_output_bytes);
+struct spike_source;
+typedef void (*spike_scan_kernel_t)(struct spike_source *ss, const char *frames, snd_pcm_uframes_t n_frames);
+typedef void (*spike_noise_kernel_t)(struct spike_source *ss, const char *frames, snd_pcm_uframes_t n_frames);
+typedef long (*spike_load_t)(const char *p);
+
+/* everything that belongs to one --device */
+struct capture_source
+{
+	struct sample_source in;
+
+	struct debias_state debias;		/* classic mode */
+	debias_kernel_t debias_kernel;
+	uint64_t n_frames_debiased;
+
+	int capture_thread_running;
+	struct ring ring;
+	snd_pcm_uframes_t period_frames;
+	atomic_size_t frames_lost;
+	struct capture_period *cur;		/* slot being consumed */
+	snd_pcm_uframes_t cur_pos;
+
+	snd_pcm_uframes_t gap_frames;		/* missing before the frames from the last capture_begin() */
+};
+
+static struct capture_source sources[MAX_CAPTURE_DEVICES];
+
 int verbose=0;
-int format = -1;
 
 #define max(x, y)	((x)>(y)?(x):(y))
+#define min(x,y) ({ typeof(x) _x = (x); typeof(y) _y = (y); (_x < _y) ? _x : _y; })
 
 /* Prototypes */
-void main_loop(const char *cdevice, int sample_rate);
-int setparams(snd_pcm_t *chandle, int sample_rate);
+void main_loop(int sample_rate);
+static void parse_pcm_size(const char *option, const char *arg, struct pcm_size *size);
+static void parse_percent_range(const char *option, const char *arg, double range[2]);
+void open_capture(struct capture_source *src, const char *cdevice, int sample_rate, int skip_samples);
+snd_pcm_uframes_t capture_begin(struct capture_source *src, snd_pcm_uframes_t max_frames, snd_pcm_uframes_t granule, const char **frames, snd_pcm_uframes_t *offset);
+void capture_commit(struct capture_source *src, snd_pcm_uframes_t offset, snd_pcm_uframes_t n_frames);
+snd_pcm_uframes_t capture_take_gap(struct capture_source *src);
+void start_capture_thread(struct capture_source *src);
 void usage(void);
 void credit_krng(int random_fd, struct rand_pool_info *entropy);
 void daemonise(void);
 void gracefully_exit(int signum);
 void logging_handler(int signum);
-void get_random_data(int sample_rate, int skip_samples, int process_samples, int *n_output_bytes, char **output_buffer);
+void get_random_data(struct capture_source *src, int process_samples, int *n_output_bytes, char **output_buffer);
 int add_to_kernel_entropyspool(int handle, char *buffer, int nbytes);
+static int kernel_channels_index(unsigned int channels);
+static debias_kernel_t select_debias_kernel(snd_pcm_format_t format, unsigned int channels);
+static int debias_self_test(void);
+static void start_debias_pool(void);
 
-static void seed_continually_with_random_spike_data(int sample_rate, int skip_samples, int random_fd);
+static void seed_continually_with_random_spike_data(int sample_rate, int skip_samples);
+static void run_spike_benchmark(void);
 
 /* Functions */
 
@@ -100,6 +265,7 @@ int main(int argc, char **argv)
 {
 	int sample_rate = DEFAULT_SAMPLE_RATE;
 	int c;
+	const char *aes_name;
 	static struct option long_options[] =
 	{
 		{"device",	1, NULL, 'd' },
@@ -113,6 +279,28 @@ int main(int argc, char **argv)
 		{"spike-test-mode", no_argument, 0, 256 },
 		{"spike-log", required_argument, 0, 257 },
 		{"spike-log-interval-seconds", required_argument, 0, 258 },
+		{"mmap", no_argument, 0, 259 },
+		{"capture-thread", no_argument, 0, 260 },
+		{"capture-ring-periods", required_argument, 0, 261 },
+		{"channels", required_argument, 0, 262 },
+		{"sample-format", required_argument, 0, 263 },
+		{"period-size", required_argument, 0, 264 },
+		{"buffer-size", required_argument, 0, 265 },
+		{"spike-auto-threshold", required_argument, 0, 266 },
+		{"spike-auto-edge-min-delta", required_argument, 0, 267 },
+		{"self-test", no_argument, 0, 268 },
+		{"extractor", required_argument, 0, 269 },
+		{"lsb-bits", required_argument, 0, 270 },
+		{"lsb-ratio", required_argument, 0, 271 },
+		{"lsb-entropy-per-bit", required_argument, 0, 272 },
+		{"debias-threads", required_argument, 0, 273 },
+		{"spike-benchmark", no_argument, 0, 274 },
+		{"spike-onset-interpolation", required_argument, 0, 275 },
+		{"krng-batch-bytes", required_argument, 0, 276 },
+		{"krng-batch-ms", required_argument, 0, 277 },
+		{"aes-benchmark", no_argument, 0, 278 },
+		{"reservoir-bytes", required_argument, 0, 279 },
+		{"reservoir-low-percent", required_argument, 0, 280 },
 		{"skip-test",	0, NULL, 's' },
 		{"file",	1, NULL, 'f' },
 		{"verbose",	0, NULL, 'v' },
@@ -147,7 +335,7 @@ int main(int argc, char **argv)
 			case 't': {
 				char *cp;
 				spike_threshold = strtod(optarg,&cp);
-				if (*cp || (spike_threshold < 0) || (spike_threshold > 100)) {
+				if (*cp || (spike_threshold < -100) || (spike_threshold > 100)) {
 					fprintf(stderr, "invalid threshold percentage \"%s\".\n",optarg);
 					exit(1);
 				}
@@ -164,9 +352,9 @@ int main(int argc, char **argv)
 			}
 			case 'c': {
 				char *cp;
-				spike_channel_mask = (int)strtoul(optarg, &cp, 0);
-				if (*cp || (! (spike_channel_mask & 0x3))) {
-					fprintf(stderr,"invalid spike detection channel mask \"%s\" -- must set at least one of bit 0 and bit 1.\n",optarg);
+				spike_channel_mask = (uint32_t)strtoul(optarg, &cp, 0);
+				if (*cp || (! spike_channel_mask)) {
+					fprintf(stderr,"invalid spike detection channel mask \"%s\" -- must set at least one channel bit.\n",optarg);
 					exit(1);
 				}
 				break;
@@ -199,6 +387,154 @@ int main(int argc, char **argv)
 				}
 				break;
 			}
+			case 259:
+				source_params.use_mmap = 1;
+				break;
+			case 260:
+				use_capture_thread = 1;
+				break;
+			case 261: {
+				char *cp;
+				capture_ring_periods = strtoul(optarg, &cp, 0);
+				if (*cp || (capture_ring_periods < 2) || (capture_ring_periods & (capture_ring_periods - 1))) {
+					fprintf(stderr,"invalid capture-ring-periods \"%s\" -- must be a power of two, at least 2.\n",optarg);
+					exit(1);
+				}
+				break;
+			}
+			case 262: {
+				char *cp;
+				source_params.channels = (unsigned int)strtoul(optarg, &cp, 0);
+				if (*cp || (source_params.channels < 1) || (source_params.channels > MAX_CHANNELS)) {
+					fprintf(stderr,"invalid channel count \"%s\" -- must be 1 to %d.\n",optarg,MAX_CHANNELS);
+					exit(1);
+				}
+				break;
+			}
+			case 263:
+				source_params.format = snd_pcm_format_value(optarg);
+				switch (source_params.format) {
+#define X(fmt, bytes, bits) case SND_PCM_FORMAT_##fmt:
+				SAMPLE_FORMATS(X)
+#undef X
+					break;
+				default:
+					fprintf(stderr,"unsupported sample format \"%s\" -- must be one of S16_LE, S16_BE, S24_3LE, S24_LE, S32_LE or FLOAT_LE.\n",optarg);
+					exit(1);
+				}
+				break;
+			case 264:
+				parse_pcm_size("period-size", optarg, &source_params.period_size);
+				break;
+			case 265:
+				parse_pcm_size("buffer-size", optarg, &source_params.buffer_size);
+				break;
+			case 266:
+				parse_percent_range("spike-auto-threshold", optarg, spike_threshold_bounds);
+				spike_auto_calibrate = 1;
+				break;
+			case 267:
+				parse_percent_range("spike-auto-edge-min-delta", optarg, spike_edge_min_delta_bounds);
+				break;
+			case 268:
+				self_test = 1;
+				break;
+			case 269: {
+				int e = extractor_value(optarg);
+				if (e < 0) {
+					fprintf(stderr,"unknown extractor \"%s\" -- must be vn, peres, elias or lsb.\n",optarg);
+					exit(1);
+				}
+				extractor = (enum extractor)e;
+				break;
+			}
+			case 270: {
+				char *cp;
+				lsb_bits = (unsigned int)strtoul(optarg, &cp, 0);
+				if (*cp || lsb_bits < 1 || lsb_bits > 8) {
+					fprintf(stderr,"invalid lsb-bits \"%s\" -- must be 1 to 8.\n",optarg);
+					exit(1);
+				}
+				break;
+			}
+			case 271: {
+				char *cp;
+				lsb_ratio = (unsigned int)strtoul(optarg, &cp, 0);
+				if (*cp || lsb_ratio < 2 || lsb_ratio > 1024) {
+					fprintf(stderr,"invalid lsb-ratio \"%s\" -- must be 2 to 1024.\n",optarg);
+					exit(1);
+				}
+				break;
+			}
+			case 272: {
+				char *cp;
+				lsb_entropy_per_bit = strtod(optarg, &cp);
+				if (*cp || lsb_entropy_per_bit <= 0 || lsb_entropy_per_bit > 1) {
+					fprintf(stderr,"invalid lsb-entropy-per-bit \"%s\" -- must be more than 0, at most 1.\n",optarg);
+					exit(1);
+				}
+				break;
+			}
+			case 273: {
+				char *cp;
+				debias_threads = (int)strtol(optarg, &cp, 0);
+				if (*cp || debias_threads < 1 || debias_threads > MAX_DEBIAS_THREADS) {
+					fprintf(stderr,"invalid debias-threads \"%s\" -- must be 1 to %d.\n",optarg,MAX_DEBIAS_THREADS);
+					exit(1);
+				}
+				break;
+			}
+			case 274:
+				spike_benchmark = 1;
+				break;
+			case 275: {
+				char *cp;
+				spike_onset_fraction_bits = (int)strtol(optarg, &cp, 0);
+				if (*cp || spike_onset_fraction_bits < 1 || spike_onset_fraction_bits > SPIKE_ONSET_MAX_FRACTION_BITS) {
+					fprintf(stderr,"invalid spike-onset-interpolation \"%s\" -- must be 1 to %d bits.\n",optarg,SPIKE_ONSET_MAX_FRACTION_BITS);
+					exit(1);
+				}
+				break;
+			}
+			case 276: {
+				char *cp;
+				krng_batch_bytes = strtoul(optarg, &cp, 0);
+				if (*cp || krng_batch_bytes < KRNG_BATCH_MIN_BYTES || krng_batch_bytes > KRNG_BATCH_MAX_BYTES) {
+					fprintf(stderr,"invalid krng-batch-bytes \"%s\" -- must be %d to %d.\n",optarg,KRNG_BATCH_MIN_BYTES,KRNG_BATCH_MAX_BYTES);
+					exit(1);
+				}
+				break;
+			}
+			case 277: {
+				char *cp;
+				krng_batch_ms = strtol(optarg, &cp, 0);
+				if (*cp || krng_batch_ms < 0) {
+					fprintf(stderr,"invalid krng-batch-ms \"%s\" -- must be 0 or more.\n",optarg);
+					exit(1);
+				}
+				break;
+			}
+			case 278:
+				aes_benchmark_only = 1;
+				break;
+			case 279: {
+				char *cp;
+				reservoir_bytes = strtoul(optarg, &cp, 0);
+				if (*cp || (reservoir_bytes && (reservoir_bytes < RESERVOIR_MIN_BYTES || reservoir_bytes > RESERVOIR_MAX_BYTES))) {
+					fprintf(stderr,"invalid reservoir-bytes \"%s\" -- must be 0, or %d to %d.\n",optarg,RESERVOIR_MIN_BYTES,RESERVOIR_MAX_BYTES);
+					exit(1);
+				}
+				break;
+			}
+			case 280: {
+				char *cp;
+				reservoir_low_percent = strtod(optarg, &cp);
+				if (*cp || cp == optarg || reservoir_low_percent < 0 || reservoir_low_percent >= 100) {
+					fprintf(stderr,"invalid reservoir-low-percent \"%s\" -- must be at least 0, and below 100.\n",optarg);
+					exit(1);
+				}
+				break;
+			}
 			case 'v':
 				loggingstate = 1;
 				verbose++;
@@ -209,7 +545,11 @@ int main(int argc, char **argv)
 				break;
 
 			case 'd':
-				cdevice = strdup(optarg);
+				if (n_cdevices >= MAX_CAPTURE_DEVICES) {
+					fprintf(stderr, "too many --device options (at most %d).\n", MAX_CAPTURE_DEVICES);
+					exit(1);
+				}
+				cdevices[n_cdevices++] = strdup(optarg);
 				break;
 
 			case 'h':
@@ -224,6 +564,49 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (n_cdevices == 0)
+		cdevices[n_cdevices++] = DEFAULT_CAPTURE_DEVICE;
+
+	if (use_capture_thread && !spike_mode) {
+		fprintf(stderr, "--capture-thread is only supported in --spike-mode.\n");
+		exit(1);
+	}
+
+	aes_name = aes_select_implementation();
+	if (verbose)
+		dolog(LOG_INFO, "aes: %s", aes_name);
+
+	if (self_test)
+		exit((debias_self_test() & spike_prescan_self_test() & aes_self_test()) ? 0 : 1);
+	if (aes_benchmark_only) {
+		aes_benchmark();
+		exit(0);
+	}
+	if (spike_benchmark) {
+		run_spike_benchmark();
+		exit(0);
+	}
+
+	credit_kernel = spike_mode ? !spike_test_mode : !file;
+	for (int i = 0; credit_kernel && i < n_cdevices; ++i) {
+		if (! source_may_credit(cdevices[i])) {
+			fprintf(stderr, "%s can't be credited to the kernel -- use it with --spike-test-mode, or with --file outside spike mode.\n", cdevices[i]);
+			exit(1);
+		}
+	}
+
+	if (extractor == EXTRACTOR_LSB) {
+		/* only full entropy out of a vetted conditioner with 64 bits to
+		 * spare going in (SP 800-90B 3.1.5.1.2); short of that, never
+		 * more than went in, nor quite a bit per bit.
+		 */
+		double h_in = (double)(AES_BLOCK_SIZE * 8) * lsb_ratio * lsb_entropy_per_bit;
+		double h_out = (h_in >= AES_BLOCK_SIZE * 8 + 64) ? AES_BLOCK_SIZE * 8 : min(h_in, AES_BLOCK_SIZE * 8 - 1);
+		lsb_credit_per_bit = floor(h_out) / (AES_BLOCK_SIZE * 8);
+		if (verbose)
+			dolog(LOG_INFO, "lsb: %u bits a sample, %u:1 through AES CBC-MAC, credit %.3f bits a bit", lsb_bits, lsb_ratio, lsb_credit_per_bit);
+	}
+
 	RNGTEST_init();
 
 	signal(SIGPIPE, SIG_IGN);
@@ -249,76 +632,233 @@ int main(int argc, char **argv)
 	if (dofork)
 		daemonise();
 
-	main_loop(cdevice, sample_rate);
+	main_loop(sample_rate);
 
 	exit(0);
 }
 
-int setparams(snd_pcm_t *chandle, int sample_rate)
+static void parse_pcm_size(const char *option, const char *arg, struct pcm_size *size)
+{
+	char *cp;
+
+	size->value = strtoul(arg, &cp, 0);
+	size->is_us = (strcmp(cp, "us") == 0);
+	if ((*cp && !size->is_us) || size->value == 0 || (size->is_us && size->value > UINT_MAX))
+	{
+		fprintf(stderr, "invalid %s \"%s\" -- must be a positive number of frames, or of microseconds with a \"us\" suffix.\n", option, arg);
+		exit(1);
+	}
+}
+
+/* "min:max", in percent of full scale */
+static void parse_percent_range(const char *option, const char *arg, double range[2])
+{
+	char *cp, *max;
+
+	range[0] = strtod(arg, &cp);
+	if (cp == arg || *cp != ':' || (range[1] = strtod(max = cp + 1, &cp), cp == max))
+	{
+		fprintf(stderr, "invalid %s \"%s\" -- give both ends of the range, as min:max.\n", option, arg);
+		exit(1);
+	}
+	if (*cp || range[0] < 0 || range[1] > 100 || range[0] > range[1])
+	{
+		fprintf(stderr, "invalid %s \"%s\" -- must be min:max, in percent of full scale.\n", option, arg);
+		exit(1);
+	}
+}
+
+void open_capture(struct capture_source *src, const char *cdevice, int sample_rate, int skip_samples)
+{
+	struct source_params p = source_params;
+
+	src->debias.a = 1;
+
+	p.sample_rate = sample_rate;
+	source_open(&src->in, cdevice, &p);
+
+	/* a WAV file brings its own channel count */
+	if (spike_mode && src->in.channels < 32 && (spike_channel_mask >> src->in.channels))
+		error_exit("--spike-channel-mask 0x%x names channels beyond the %u of %s", spike_channel_mask, src->in.channels, cdevice);
+	if (!spike_mode)
+	{
+		if (src->in.channels < 2)
+			error_exit("classic mode needs at least 2 channels, %s has %u", cdevice, src->in.channels);
+		src->debias_kernel = select_debias_kernel(src->in.format, src->in.channels);
+		src->debias.extract = extractor_fn(extractor);
+	}
+
+	/* Discard the first data read */
+	/* it often contains weird looking data - probably a click from */
+	/* driver loading / card initialisation */
+	while (skip_samples > 0)
+	{
+		const char *frames;
+		snd_pcm_uframes_t offset, n_frames;
+
+		n_frames = capture_begin(src, skip_samples, 1, &frames, &offset);
+		capture_commit(src, offset, n_frames);
+		skip_samples -= n_frames;
+	}
+}
+
+/* capture_begin()/capture_commit() go straight to the sample source when
+ * capture is inline, or consume the capture thread's ring when it's running.
+ */
+snd_pcm_uframes_t capture_begin(struct capture_source *src, snd_pcm_uframes_t max_frames, snd_pcm_uframes_t granule, const char **frames, snd_pcm_uframes_t *offset)
+{
+	snd_pcm_uframes_t n_frames;
+
+	if (!src->capture_thread_running)
+	{
+		n_frames = src->in.ops->begin(&src->in, max_frames, granule, frames, offset);
+		src->gap_frames += source_take_gap(&src->in);
+		return n_frames;
+	}
+
+	/* only spike mode reads the ring, a frame at a time.  a larger granule
+	 * could leave the end of a slot that's never taken, and no progress */
+	if (granule != 1)
+		error_exit("capture_begin: the capture ring can't be read %lu frames at a time", (unsigned long)granule);
+
+	if (!src->cur)
+	{
+		src->cur = (struct capture_period *)ring_read_begin(&src->ring);
+		src->cur_pos = 0;
+		src->gap_frames += src->cur->n_frames_lost;
+	}
+
+	n_frames = src->cur->n_frames - src->cur_pos;
+	if (n_frames > max_frames)
+		n_frames = max_frames;
+
+	*frames = src->cur->frames + src->cur_pos * src->in.frame_bytes;
+	*offset = 0;
+	return n_frames;
+}
+
+void capture_commit(struct capture_source *src, snd_pcm_uframes_t offset, snd_pcm_uframes_t n_frames)
+{
+	if (!src->capture_thread_running)
+	{
+		src->in.ops->commit(&src->in, offset, n_frames);
+		return;
+	}
+
+	src->cur_pos += n_frames;
+	if (src->cur_pos >= src->cur->n_frames)
+	{
+		ring_read_commit(&src->ring);
+		src->cur = NULL;
+	}
+}
+
+/* frames lost since the last call, just before the frames that
+ * capture_begin() last returned.
+ */
+snd_pcm_uframes_t capture_take_gap(struct capture_source *src)
+{
+	snd_pcm_uframes_t gap = src->gap_frames;
+
+	src->gap_frames = 0;
+	return gap;
+}
+
+static void *capture_thread(void *arg)
 {
-	snd_pcm_hw_params_t *ct_params;		/* templates with rate, format and channels */
-	snd_pcm_hw_params_alloca(&ct_params);
-
-	err = snd_pcm_hw_params_any(chandle, ct_params);
-	if (err < 0)
-		error_exit("Broken configuration for %s PCM: no configurations available: %s", id, snd_strerror(err));
-
-	/* Disable rate resampling */
-	err = snd_pcm_hw_params_set_rate_resample(chandle, ct_params, 0);
-	if (err < 0)
-		error_exit("Could not disable rate resampling: %s", snd_strerror(err));
-
-	/* Set access to SND_PCM_ACCESS_RW_INTERLEAVED */
-	err = snd_pcm_hw_params_set_access(chandle, ct_params, SND_PCM_ACCESS_RW_INTERLEAVED);
-	if (err < 0)
-		error_exit("Could not set access to SND_PCM_ACCESS_RW_INTERLEAVED: %s", snd_strerror(err));
-
-	/* Restrict a configuration space to have rate nearest to our target rate */
-	err = snd_pcm_hw_params_set_rate_near(chandle, ct_params, &sample_rate, 0);
-	if (err < 0)
-		error_exit("Rate %iHz not available for %s: %s", sample_rate, id, snd_strerror(err));
-
-	/* Set sample format */
-	format = SND_PCM_FORMAT_S16_LE;
-	err = snd_pcm_hw_params_set_format(chandle, ct_params, format);
-	if (err < 0)
+	struct capture_source *src = (struct capture_source *)arg;
+	struct capture_period *scratch;
+	snd_pcm_uframes_t n_lost = 0, n_gap = 0;
+
+	/* where the period goes when the ring is full, so that we keep
+	 * draining the device and the loss is counted, rather than xrunning.
+	 */
+	scratch = (struct capture_period *)malloc(src->ring.slot_size);
+	if (!scratch)
+		error_exit("problem allocating %zu bytes of memory", src->ring.slot_size);
+
+	for(;;)
 	{
-		format = SND_PCM_FORMAT_S16_BE;
-		err = snd_pcm_hw_params_set_format(chandle, ct_params, format);
+		struct capture_period *period = (struct capture_period *)ring_write_begin(&src->ring);
+		snd_pcm_uframes_t n_frames;
+
+		if (!period)
+		{
+			if (!n_lost)
+				dolog(LOG_WARNING, "capture ring overflow on %s, processing is falling behind", src->in.name);
+			period = scratch;
+		}
+
+		/* a short period when frames were lost after it: the gap
+		 * goes before the next one */
+		n_frames = src->in.ops->read(&src->in, period->frames, src->period_frames);
+		n_gap += source_take_gap(&src->in);
+
+		if (period == scratch)
+		{
+			n_lost += n_frames;
+			atomic_fetch_add_explicit(&src->frames_lost, n_frames, memory_order_relaxed);
+			continue;
+		}
+
+		period->n_frames = n_frames;
+		period->n_frames_lost = n_lost + n_gap;
+		n_lost = n_gap = 0;
+		ring_write_commit(&src->ring);
 	}
-	if (err < 0)
-		error_exit("Sample format (SND_PCM_FORMAT_S16_BE and _LE) not available for %s: %s", id, snd_strerror(err));
 
-	/* Set stereo */
-	err = snd_pcm_hw_params_set_channels(chandle, ct_params, 2);
-	if (err < 0)
-		error_exit("Channels count (%i) not available for %s: %s", 2, id, snd_strerror(err));
+	return NULL;
+}
+
+void start_capture_thread(struct capture_source *src)
+{
+	static const struct sched_param sp = { .sched_priority = 2 };
+	pthread_attr_t attr;
+	pthread_t tid;
+	int err;
+
+	src->period_frames = src->in.rate / CAPTURE_PERIODS_PER_SECOND;
+	ring_init(&src->ring, capture_ring_periods, sizeof(struct capture_period) + src->period_frames * src->in.frame_bytes);
+	atomic_init(&src->frames_lost, 0);
 
+	/* capture runs one notch above the processing loop, so that slow
+	 * logging or ioctls can't make it miss a period.
+	 */
+	pthread_attr_init(&attr);
+	pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+	pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+	pthread_attr_setschedparam(&attr, &sp);
+	if ((err = pthread_create(&tid, &attr, capture_thread, src)) != 0)
 	{
-	  snd_pcm_uframes_t buf_sz = 1L<<20L;
-	  if ((err = snd_pcm_hw_params_set_buffer_size_max(chandle, ct_params, &buf_sz)) < 0)
-	    error_exit("buf sz not settable for %s: %s", id, snd_strerror(err));
+		dolog(LOG_WARNING, "couldn't start SCHED_FIFO capture thread (%s), starting it with default scheduling", strerror(err));
+		if ((err = pthread_create(&tid, NULL, capture_thread, src)) != 0)
+			error_exit("pthread_create failed: %s", strerror(err));
 	}
+	pthread_attr_destroy(&attr);
 
-	/* Apply settings to sound device */
-	err = snd_pcm_hw_params(chandle, ct_params);
-	if (err < 0)
-		error_exit("Could not apply settings to sound device: %s", snd_strerror(err));
+	src->capture_thread_running = 1;
 
-	return 0;
+	if (verbose)
+		dolog(LOG_INFO, "capture thread started for %s, %zu periods of %lu frames", src->in.name, capture_ring_periods, (unsigned long)src->period_frames);
 }
 
-void main_loop(const char *cdevice, int sample_rate)
+void main_loop(int sample_rate)
 {
-	unsigned char *output_buffer = NULL;
+	char *output_buffer = NULL;
 	int n_output_bytes = -1;
 	int random_fd = -1, max_bits;
 	FILE *poolsize_fh;
-
-	/* Open kernel random device */
-	random_fd = open(RANDOM_DEVICE, O_RDWR);
-	if (random_fd == -1)
-		error_exit("Couldn't open random device: %m");
+	int cur_source = 0, i;
+
+	/* Open kernel random device, unless nothing is going to it */
+	if (credit_kernel) {
+		random_fd = open(RANDOM_DEVICE, O_RDWR);
+		if (random_fd == -1)
+			error_exit("Couldn't open random device: %m");
+		/* spike mode has always credited with RNDADDTOENTCNT as well */
+		if (! krng_batch_init(&krng_out, random_fd, krng_batch_bytes, krng_batch_ms, spike_mode))
+			dolog(LOG_WARNING, "couldn't lock the %zu byte output batch in memory: %m", krng_batch_bytes);
+	}
 
 	/* find out poolsize */
 	poolsize_fh = fopen(DEFAULT_POOLSIZE_FN, "rb");
@@ -327,20 +867,65 @@ void main_loop(const char *cdevice, int sample_rate)
 	fscanf(poolsize_fh, "%d", &max_bits);
 	fclose(poolsize_fh);
 
+	/* only output that goes to the kernel needs holding for it */
+	if (reservoir_bytes && credit_kernel) {
+		if (! reservoir_init(&reservoir, reservoir_bytes, (size_t)((double)reservoir_bytes * reservoir_low_percent / 100.0)))
+			dolog(LOG_WARNING, "couldn't lock the %zu byte reservoir in memory: %m", reservoir_bytes);
+		reservoir_start_drain(&reservoir, &krng_out, max_bits);
+	}
+	else
+		reservoir_bytes = 0;
+
 	if (spike_mode) {
-		seed_continually_with_random_spike_data(sample_rate, DEFAULT_CLICK_READ, random_fd);
+		seed_continually_with_random_spike_data(sample_rate, DEFAULT_CLICK_READ);
 		__builtin_unreachable();
 		return;
 	}
 
+	/* the capture devices stay open for the life of the daemon, so the
+	 * startup click is only discarded once.
+	 */
+	for(i=0; i<n_cdevices; i++)
+		open_capture(&sources[i], cdevices[i], sample_rate, DEFAULT_CLICK_READ);
+	if (debias_threads)
+		start_debias_pool();
+
 	/* first get some data so that we can immediately submit something when the
 	 * kernel entropy-buffer gets below some limit
 	 */
-	get_random_data(sample_rate, DEFAULT_CLICK_READ, DEFAULT_SAMPLE_RATE, &n_output_bytes, &output_buffer);
+	get_random_data(&sources[cur_source], DEFAULT_SAMPLE_RATE, &n_output_bytes, &output_buffer);
+
+	/* the drain thread feeds the kernel: just keep the reservoir filled,
+	 * stopping capture while it's full, rather than letting the ring buffer
+	 * overrun, until it's drained to the low watermark.
+	 */
+	if (reservoir_bytes) {
+		for(;;)
+		{
+			if (n_output_bytes > 0 && ! reservoir_has_room(&reservoir, (size_t)n_output_bytes))
+			{
+				for(i=0; i<n_cdevices; i++)
+					sources[i].in.ops->stop(&sources[i].in);
+				reservoir_wait_low(&reservoir);
+				for(i=0; i<n_cdevices; i++)
+					sources[i].in.ops->restart(&sources[i].in);
+			}
+
+			if (n_output_bytes > 0)
+				add_to_kernel_entropyspool(random_fd, output_buffer, n_output_bytes);
+
+			free(output_buffer);
+			output_buffer = NULL;
+
+			/* take turns with each device */
+			cur_source = (cur_source + 1) % n_cdevices;
+			get_random_data(&sources[cur_source], DEFAULT_SAMPLE_RATE, &n_output_bytes, &output_buffer);
+		}
+	}
 
 	/* Main read loop */
 	for(;;)
-	{	
+	{
 		int added = 0, before, loop, after;
 
 		if (!file)
@@ -348,14 +933,24 @@ void main_loop(const char *cdevice, int sample_rate)
 			fd_set write_fd;
 			FD_ZERO(&write_fd);
 			FD_SET(random_fd, &write_fd);
-			for(;;) 
-			{ 
-				int rc = select(random_fd+1, NULL, &write_fd, NULL, NULL); /* wait for krng */ 
-				if (rc >= 0) break; 
-				if (errno != EINTR) 
-					error_exit("Select error: %m"); 
+
+			/* the pool is full -- stop capturing while we sleep, rather
+			 * than letting the ring buffer overrun, and restart on wakeup.
+			 */
+			for(i=0; i<n_cdevices; i++)
+				sources[i].in.ops->stop(&sources[i].in);
+
+			for(;;)
+			{
+				int rc = select(random_fd+1, NULL, &write_fd, NULL, NULL); /* wait for krng */
+				if (rc >= 0) break;
+				if (errno != EINTR)
+					error_exit("Select error: %m");
 			}
 
+			for(i=0; i<n_cdevices; i++)
+				sources[i].in.ops->restart(&sources[i].in);
+
 			/* find out how many bits to add */
 			if (ioctl(random_fd, RNDGETENTCNT, &before) == -1)
 				error_exit("Couldn't query entropy-level from kernel");
@@ -404,6 +999,8 @@ void main_loop(const char *cdevice, int sample_rate)
 			}
 
 			if (! file) {
+				krng_batch_flush(&krng_out);
+
 				/* Get number of bits in KRNG after credit */
 				if (ioctl(random_fd, RNDGETENTCNT, &after) == -1)
 					error_exit("Coundn't query entropy-level from kernel: %m");
@@ -414,7 +1011,10 @@ void main_loop(const char *cdevice, int sample_rate)
 
 			free(output_buffer);
 			output_buffer = NULL;
-			get_random_data(sample_rate, DEFAULT_CLICK_READ, DEFAULT_SAMPLE_RATE, &n_output_bytes, &output_buffer);
+
+			/* take turns with each device */
+			cur_source = (cur_source + 1) % n_cdevices;
+			get_random_data(&sources[cur_source], DEFAULT_SAMPLE_RATE, &n_output_bytes, &output_buffer);
 		}
 
 		if (! file)
@@ -422,587 +1022,2024 @@ void main_loop(const char *cdevice, int sample_rate)
 	}
 }
 
+/* conditioned output, and its credit, into the reservoir if there is one,
+ * else straight on to the kernel
+ */
+static void credit_output(const void *data, size_t n_bytes, double credit_bits)
+{
+	if (! credit_kernel)
+		return;
+	if (reservoir_bytes)
+		reservoir_add(&reservoir, data, n_bytes, credit_bits);
+	else
+		krng_batch_add(&krng_out, data, n_bytes, credit_bits);
+}
+
 int add_to_kernel_entropyspool(int handle, char *buffer, int nbytes)
 {
 	double nbits;
-	struct rand_pool_info *output;
 
-	output = (struct rand_pool_info *)malloc(sizeof(struct rand_pool_info) + nbytes);
-	if (!output)
-		error_exit("malloc failure in add_to_kernel_entropyspool");
+	(void)handle;	/* krng_out has it */
 
 	// calculate number of bits in the block of
 	// data. put in structure
 	nbits = calc_nbits_in_data((unsigned char *)buffer, nbytes);
+	/* conditioned lsbs look perfect -- credit what went in, instead */
+	if (extractor == EXTRACTOR_LSB)
+		nbits = min(nbits, (double)nbytes * 8.0 * lsb_credit_per_bit);
 	if (nbits >= 1.0)
-	{
-		output -> entropy_count = (int)nbits;
-		output -> buf_size      = nbytes;
-		memcpy(output -> buf, buffer, nbytes);
-
-		if (ioctl(handle, RNDADDENTROPY, output) == -1)
-			error_exit("RNDADDENTROPY failed!");
-	}
-
-	free(output);
+		credit_output(buffer, (size_t)nbytes, (double)(int)nbits);
 
 	return (int)nbits;
 }
 
 #define order(a, b)     (((a) == (b)) ? -1 : (((a) > (b)) ? 1 : 0))
 
-void get_random_data(int sample_rate, int skip_samples, int process_samples, int *n_output_bytes, char **output_buffer)
-{
-	int n_to_do, bits_out=0, loop;
-	char *dummy;
-	static short psl=0, psr=0; /* previous samples */
-	static char a=1; /* alternater */
-	unsigned char byte_out=0;
-	int input_buffer_size;
-	char *input_buffer;
-	snd_pcm_t *chandle;
-
-	if (verbose > 1)
-		dolog(LOG_DEBUG, "get_random_data(%p, %d, %d, %p, %p)", chandle, skip_samples, process_samples, n_output_bytes, output_buffer);
-
-	if ((err = snd_pcm_open(&chandle, cdevice, SND_PCM_STREAM_CAPTURE, 0)) < 0)
-		error_exit("Record open error: %s", snd_strerror(err));
+/* sample loaders, one per SAMPLE_FORMATS entry. */
+#define LOAD_S16_LE(p)		((long)*(const int16_t *)(p))
+#define LOAD_S16_BE(p)		((long)(int16_t)__builtin_bswap16(*(const uint16_t *)(p)))
+#define LOAD_S24_3LE(p)		((long)((int32_t)(((uint32_t)((const unsigned char *)(p))[0] << 8) | ((uint32_t)((const unsigned char *)(p))[1] << 16) | ((uint32_t)((const unsigned char *)(p))[2] << 24)) >> 8))
+#define LOAD_S24_LE(p)		((long)((int32_t)(*(const uint32_t *)(p) << 8) >> 8))
+#define LOAD_S32_LE(p)		((long)*(const int32_t *)(p))
+#define LOAD_FLOAT_LE(p)	float_to_s24(*(const float *)(p))
 
-	/* Open and set up ALSA device for reading */
-	setparams(chandle, sample_rate);
+static inline long float_to_s24(float f)
+{
+	if (f >= 1.0f)
+		return 8388607L;
+	if (f <= -1.0f)
+		return -8388607L;
+	return (long)(f * 8388607.0f);
+}
 
-	*n_output_bytes=0;
+/* the debias loop has always assembled 16 bit words bytewise, and kept the
+ * previous samples as shorts -- keep doing exactly that for S16.
+ */
+#define DEBIAS_LOAD_S16_LE(p)	((((const char *)(p))[1]<<8) + ((const char *)(p))[0])
+#define DEBIAS_LOAD_S16_BE(p)	((((const char *)(p))[0]<<8) + ((const char *)(p))[1])
+#define DEBIAS_LOAD_S24_3LE	LOAD_S24_3LE
+#define DEBIAS_LOAD_S24_LE	LOAD_S24_LE
+#define DEBIAS_LOAD_S32_LE	LOAD_S32_LE
+#define DEBIAS_LOAD_FLOAT_LE	LOAD_FLOAT_LE
+#define DEBIAS_PREV_S16_LE(w)	((short)(w))
+#define DEBIAS_PREV_S16_BE(w)	((short)(w))
+#define DEBIAS_PREV_S24_3LE(w)	(w)
+#define DEBIAS_PREV_S24_LE(w)	(w)
+#define DEBIAS_PREV_S32_LE(w)	(w)
+#define DEBIAS_PREV_FLOAT_LE(w)	(w)
+
+/* a whole byte out of the debias loop: keep it, and test it */
+static void debias_emit_byte(struct debias_state *ds, unsigned char byte, char *output, int *n_output_bytes)
+{
+	ds->n_bytes_out++;
+	if (ds->raw)
+	{
+		output[(*n_output_bytes)++] = byte;
+		return;
+	}
 
-	input_buffer_size = snd_pcm_frames_to_bytes(chandle, max(skip_samples, process_samples)) * 2; /* *2: stereo! */
-	input_buffer = (char *)malloc(input_buffer_size);
-	*output_buffer = (char *)malloc(input_buffer_size);
-	if (!input_buffer || !output_buffer)
-		error_exit("problem allocating %d bytes of memory", input_buffer_size);
-	if (verbose > 1)
-		dolog(LOG_DEBUG, "Input buffer size: %d bytes", input_buffer_size);
+	if (error_state == 0 || skip_test == 0)
+	{
+		output[*n_output_bytes]=byte;
+		(*n_output_bytes)++;
+	}
 
-	/* Discard the first data read */
-	/* it often contains weird looking data - probably a click from */
-	/* driver loading / card initialisation */
-	snd_pcm_sframes_t garbage_frames_read = snd_pcm_readi(chandle, input_buffer, skip_samples);
-	/* Make sure we aren't hitting a disconnect/suspend case */
-	if (garbage_frames_read < 0)
-		snd_pcm_recover(chandle, garbage_frames_read, 0);
-	/* Nope, something else is wrong. Bail. */
-	if (garbage_frames_read < 0)
-		error_exit("Get random data: read error: %m");
-
-	/* Read a buffer of audio */
-	n_to_do = process_samples * 2;
-	dummy = input_buffer;
-	while (n_to_do > 0)
+	RNGTEST_add(byte);
+	if (skip_test == 0 && RNGTEST() == -1)
 	{
-		snd_pcm_sframes_t frames_read = snd_pcm_readi(chandle, dummy, n_to_do);
-		/* Make	sure we	aren't hitting a disconnect/suspend case */
-		if (frames_read < 0)
-			frames_read = snd_pcm_recover(chandle, frames_read, 0);
-		/* Nope, something else is wrong. Bail.	*/
-		if (frames_read < 0)
-			error_exit("Read error: %m");
-		if (frames_read == -1) 
-		{
-			if (errno != EINTR)
-				error_exit("Read error: %m");
-		}
-		else
+		if (error_state == 0)
+			dolog(LOG_CRIT, "test of random data failed, skipping %d bytes before re-using data-stream (%d bytes in flush)", RNGTEST_PENALTY, error_state);
+		error_state = RNGTEST_PENALTY;
+		*n_output_bytes = 0;
+	}
+	else
+	{
+		if (error_state > 0)
 		{
-			n_to_do -= frames_read;
-			dummy += frames_read;	
+			error_state--;
+
+			if (error_state == 0)
+				dolog(LOG_INFO, "Restarting fetching of entropy data");
 		}
 	}
-	snd_pcm_close(chandle);
+}
 
-	/* de-biase the data */
-	for(loop=0; loop<(process_samples * 2/*16bits*/ * 2/*stereo*/ * 2); loop+=8)
+static inline __attribute__((always_inline)) void debias_step(struct debias_state *ds, int o1, int o2, char *output, int *n_output_bytes)
+{
+	/* If both samples have the same order, there is bias in the samples, so we
+	 * discard them; if both channels are equal on either sample, we discard
+	 * them too; additionally, alternate the sample we'll use next (even more
+	 * bias removal) */
+	if (o1 == o2 || o1 < 0 || o2 < 0)
+	{
+		ds->a = -ds->a;
+	}
+	else
 	{
-		int w1, w2, w3, w4, o1, o2;
+		/* We've got a random bit; the bit is either the order from the first or
+		 * the second sample, determined by the alternator 'a' */
+		char bit = (ds->a > 0) ? o1 : o2;
 
-		if (format == SND_PCM_FORMAT_S16_BE)
-		{
-			w1 = (input_buffer[loop+0]<<8) + input_buffer[loop+1];
-			w2 = (input_buffer[loop+2]<<8) + input_buffer[loop+3];
-			w3 = (input_buffer[loop+4]<<8) + input_buffer[loop+5];
-			w4 = (input_buffer[loop+6]<<8) + input_buffer[loop+7];
-		}
-		else
-		{
-			w1 = (input_buffer[loop+1]<<8) + input_buffer[loop+0];
-			w2 = (input_buffer[loop+3]<<8) + input_buffer[loop+2];
-			w3 = (input_buffer[loop+5]<<8) + input_buffer[loop+4];
-			w4 = (input_buffer[loop+7]<<8) + input_buffer[loop+6];
-		}
+		ds->byte_out <<= 1;
+		ds->byte_out += bit;
 
-		/* Determine order of channels for each sample, subtract previous sample
-		 * to compensate for unbalanced audio devices */
-		o1 = order(w1-psl, w2-psr);
-		o2 = order(w3-psl, w4-psr);
-		if (a > 0)
-		{
-			psl = w3;
-			psr = w4;
-		}
-		else
-		{
-			psl = w1;
-			psr = w2;
-		}
+		ds->bits_out++;
 
-		/* If both samples have the same order, there is bias in the samples, so we
-		 * discard them; if both channels are equal on either sample, we discard
-		 * them too; additionally, alternate the sample we'll use next (even more
-		 * bias removal) */
-		if (o1 == o2 || o1 < 0 || o2 < 0)
+		if (ds->bits_out>=8)
 		{
-			a = -a;
+			ds->bits_out=0;
+			debias_emit_byte(ds, ds->byte_out, output, n_output_bytes);
 		}
-		else
+	}
+}
+
+/* de-bias n_frames (an even number) of interleaved frames, comparing the
+ * first two channels, and appending whole bytes to output.  nch is the
+ * channel count the kernel is specialized for, or 0 for any.
+ */
+#define DEFINE_DEBIAS_KERNEL(fmt, bytes, nch)									\
+static void debias_##fmt##_##nch(struct debias_state *ds, const char *frames, snd_pcm_uframes_t n_frames, unsigned int channels, char *output, int *n_output_bytes) \
+{														\
+	const size_t frame_bytes = (size_t)(bytes) * ((nch) ? (nch) : channels);				\
+	snd_pcm_uframes_t loop;											\
+														\
+	for(loop=0; loop<n_frames; loop+=2, frames+=2*frame_bytes)						\
+	{													\
+		long w1, w2, w3, w4;										\
+														\
+		w1 = DEBIAS_LOAD_##fmt(frames);									\
+		w2 = DEBIAS_LOAD_##fmt(frames + (bytes));							\
+		w3 = DEBIAS_LOAD_##fmt(frames + frame_bytes);							\
+		w4 = DEBIAS_LOAD_##fmt(frames + frame_bytes + (bytes));						\
+														\
+		/* Determine order of channels for each sample, subtract previous sample			\
+		 * to compensate for unbalanced audio devices */						\
+		int o1 = order(w1-ds->psl, w2-ds->psr);								\
+		int o2 = order(w3-ds->psl, w4-ds->psr);								\
+		if (ds->a > 0)											\
+		{												\
+			ds->psl = DEBIAS_PREV_##fmt(w3);							\
+			ds->psr = DEBIAS_PREV_##fmt(w4);							\
+		}												\
+		else												\
+		{												\
+			ds->psl = DEBIAS_PREV_##fmt(w1);							\
+			ds->psr = DEBIAS_PREV_##fmt(w2);							\
+		}												\
+														\
+		debias_step(ds, o1, o2, output, n_output_bytes);						\
+	}													\
+}
+
+#define DEFINE_DEBIAS_KERNELS(fmt, bytes, bits)	\
+	DEFINE_DEBIAS_KERNEL(fmt, bytes, 2)	\
+	DEFINE_DEBIAS_KERNEL(fmt, bytes, 4)	\
+	DEFINE_DEBIAS_KERNEL(fmt, bytes, 8)	\
+	DEFINE_DEBIAS_KERNEL(fmt, bytes, 0)
+SAMPLE_FORMATS(DEFINE_DEBIAS_KERNELS)
+
+/* the serial half of the vectorized kernels (see debias_simd.h): the state
+ * is the alternator (bit 0 set if 1, clear if -1) and which frame of the
+ * last pair the previous samples come from (bit 1 set for the second).
+ * where char is unsigned, -1 is 255 and the alternator never goes
+ * negative -- that's kept, too.
+ */
+#define DEBIAS_CODES_PER_BLOCK	1024
+static debias_codes_fn debias_codes[2];		/* S16_LE, S16_BE */
+static const char *debias_codes_name = "scalar";
+/* two pairs at a time: next state | bits out << 2 | the bits << 4 */
+static uint8_t debias_code_lut[4][256];
+
+static unsigned int debias_code_step(unsigned int state, unsigned int code, unsigned int *n_bits, unsigned int *bits)
+{
+	unsigned int a = state & 1, positive = a || CHAR_MIN >= 0, from_second = (state >> 1) & 1;
+	unsigned int valid = (code >> (from_second ? 2 : 0)) & 1, order = (code >> (from_second ? 3 : 1)) & 1;
+
+	/* the samples kept for the next pair are chosen before a flips */
+	if (!valid)
+		return (a ^ 1) | (positive << 1);
+	*bits = (*bits << 1) | (positive ? order : !order);
+	(*n_bits)++;
+	return a | (positive << 1);
+}
+
+static void init_debias_code_lut(void)
+{
+	for (unsigned int state = 0; state < 4; ++state)
+	{
+		for (unsigned int code = 0; code < 256; ++code)
 		{
-			/* We've got a random bit; the bit is either the order from the first or
-			 * the second sample, determined by the alternator 'a' */
-			char bit = (a > 0) ? o1 : o2;
+			unsigned int n_bits = 0, bits = 0;
+			unsigned int next = debias_code_step(debias_code_step(state, code & 0xf, &n_bits, &bits), code >> 4, &n_bits, &bits);
 
-			byte_out <<= 1;
-			byte_out += bit;
+			debias_code_lut[state][code] = (uint8_t)(next | (n_bits << 2) | (bits << 4));
+		}
+	}
+}
 
-			bits_out++;
+#define DEFINE_DEBIAS_SIMD_KERNEL(fmt, big_endian)								\
+static void debias_##fmt##_2_simd(struct debias_state *ds, const char *frames, snd_pcm_uframes_t n_frames, unsigned int channels, char *output, int *n_output_bytes) \
+{														\
+	const snd_pcm_uframes_t n_pairs = n_frames / 2;								\
+	uint8_t codes[DEBIAS_CODES_PER_BLOCK / 2];								\
+	unsigned int state, acc = ds->byte_out, bits_out = ds->bits_out;					\
+														\
+	if (n_pairs < 2)											\
+	{													\
+		debias_##fmt##_2(ds, frames, n_frames, channels, output, n_output_bytes);			\
+		return;												\
+	}													\
+														\
+	/* the first pair compares against the samples carried over */					\
+	state = (ds->a > 0) << 1;										\
+	debias_##fmt##_2(ds, frames, 2, channels, output, n_output_bytes);					\
+	state |= (ds->a == 1);											\
+	acc = ds->byte_out;											\
+	bits_out = ds->bits_out;										\
+														\
+	for (snd_pcm_uframes_t pair = 1; pair < n_pairs; )							\
+	{													\
+		size_t n = min(n_pairs - pair, (snd_pcm_uframes_t)DEBIAS_CODES_PER_BLOCK);			\
+														\
+		debias_codes[big_endian](frames + (pair - 1) * 8, n, codes);					\
+		for (size_t i = 0; i < n / 2; ++i)								\
+		{												\
+			unsigned int e = debias_code_lut[state][codes[i]], n_bits = (e >> 2) & 3;		\
+														\
+			state = e & 3;										\
+			acc = (acc << n_bits) | (e >> 4);							\
+			bits_out += n_bits;									\
+			if (bits_out >= 8)									\
+			{											\
+				bits_out -= 8;									\
+				debias_emit_byte(ds, (unsigned char)(acc >> bits_out), output, n_output_bytes);	\
+			}											\
+		}												\
+		if (n & 1)											\
+		{												\
+			unsigned int n_bits = 0, bits = 0;							\
+														\
+			state = debias_code_step(state, codes[n / 2] & 0xf, &n_bits, &bits);			\
+			acc = (acc << n_bits) | bits;								\
+			bits_out += n_bits;									\
+			if (bits_out >= 8)									\
+			{											\
+				bits_out -= 8;									\
+				debias_emit_byte(ds, (unsigned char)(acc >> bits_out), output, n_output_bytes);	\
+			}											\
+		}												\
+		pair += n;											\
+	}													\
+														\
+	const char *last = frames + (n_pairs - 1) * 8 + ((state & 2) ? 4 : 0);					\
+	ds->psl = DEBIAS_PREV_##fmt(DEBIAS_LOAD_##fmt(last));							\
+	ds->psr = DEBIAS_PREV_##fmt(DEBIAS_LOAD_##fmt(last + 2));						\
+	ds->a = (state & 1) ? 1 : -1;										\
+	ds->byte_out = (unsigned char)acc;									\
+	ds->bits_out = (int)bits_out;										\
+}
+DEFINE_DEBIAS_SIMD_KERNEL(S16_LE, 0)
+DEFINE_DEBIAS_SIMD_KERNEL(S16_BE, 1)
 
-			if (bits_out>=8)
-			{
-				if (error_state == 0 || skip_test == 0)
-				{
-					(*output_buffer)[*n_output_bytes]=byte_out;
-					(*n_output_bytes)++;
-				}
-				bits_out=0;
+/* the vectorized kernels against the scalar ones, on every kind of input
+ * and state, cut into runs of every kind of length.
+ */
+static int debias_check_kernel(debias_kernel_t fast, debias_kernel_t ref, const char *name)
+{
+	enum { N_FRAMES = 8192 };
+	static const snd_pcm_uframes_t runs[] = { 2, 4, 6, 8, 18, 34, 66, 2048, 2050, 4096 };
+	char *frames = (char *)malloc(N_FRAMES * 4), *out_fast = (char *)malloc(N_FRAMES), *out_ref = (char *)malloc(N_FRAMES);
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	int ok = 1;
 
-				RNGTEST_add(byte_out);
-				if (skip_test == 0 && RNGTEST() == -1)
-				{
-					if (error_state == 0)
-						dolog(LOG_CRIT, "test of random data failed, skipping %d bytes before re-using data-stream (%d bytes in flush)", RNGTEST_PENALTY, error_state);
-					error_state = RNGTEST_PENALTY;
-					*n_output_bytes = 0;
-				}
-				else
-				{
-					if (error_state > 0)
-					{
-						error_state--;
+	if (!frames || !out_fast || !out_ref)
+		error_exit("problem allocating memory for the debias self-test");
 
-						if (error_state == 0)
-							dolog(LOG_INFO, "Restarting fetching of entropy data");
-					}
-				}
+	for (int pass = 0; pass < 16 && ok; ++pass)
+	{
+		struct debias_state ds_fast, ds_ref;
+		int n_fast = 0, n_ref = 0;
+
+		/* xorshift: mostly small values, so the channels are often equal */
+		for (size_t i = 0; i < N_FRAMES * 2; ++i)
+		{
+			x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+			int16_t v = (pass & 1) ? (int16_t)x : (x & 0x100) ? (int16_t)((x >> 32) & 3) - 1 : (int16_t)(x >> 16);
+			memcpy(frames + i * 2, &v, sizeof v);
+		}
+
+		memset(&ds_ref, 0, sizeof ds_ref);
+		ds_ref.psl = (short)(x >> 8);
+		ds_ref.psr = (pass & 2) ? ds_ref.psl : (short)(x >> 24);
+		ds_ref.a = (pass & 4) ? 1 : -1;
+		ds_ref.byte_out = (unsigned char)(x >> 40);
+		ds_ref.bits_out = pass & 7;
+		ds_ref.raw = 1;
+		ds_fast = ds_ref;
+
+		for (snd_pcm_uframes_t pos = 0, r = pass; pos < N_FRAMES; ++r)
+		{
+			snd_pcm_uframes_t n = min(runs[r % (sizeof runs / sizeof runs[0])], N_FRAMES - pos);
+
+			fast(&ds_fast, frames + pos * 4, n, 2, out_fast, &n_fast);
+			ref(&ds_ref, frames + pos * 4, n, 2, out_ref, &n_ref);
+			if (n_fast != n_ref || memcmp(out_fast, out_ref, n_ref) != 0 ||
+			    ds_fast.psl != ds_ref.psl || ds_fast.psr != ds_ref.psr || ds_fast.a != ds_ref.a ||
+			    ds_fast.byte_out != ds_ref.byte_out || ds_fast.bits_out != ds_ref.bits_out)
+			{
+				dolog(LOG_ERR, "%s debias kernel disagrees with the scalar one (pass %d, frame %lu)", name, pass, pos);
+				ok = 0;
+				break;
 			}
+			pos += n;
 		}
 	}
 
-	if (verbose > 1)
-		dolog(LOG_DEBUG, "get_random_data() finished");
+	free(frames);
+	free(out_fast);
+	free(out_ref);
+	return ok;
+}
+
+static void init_debias_simd(void)
+{
+	static int done = 0;
+
+	if (done)
+		return;
+	done = 1;
 
-	free(input_buffer);
+	init_debias_code_lut();
+	debias_codes[0] = select_debias_codes(0, &debias_codes_name);
+	debias_codes[1] = select_debias_codes(1, &debias_codes_name);
+	if (!debias_check_kernel(debias_S16_LE_2_simd, debias_S16_LE_2, debias_codes_name) ||
+	    !debias_check_kernel(debias_S16_BE_2_simd, debias_S16_BE_2, debias_codes_name))
+	{
+		dolog(LOG_ERR, "not using the %s debias kernels", debias_codes_name);
+		debias_codes[0] = debias_codes_reference(0);
+		debias_codes[1] = debias_codes_reference(1);
+		debias_codes_name = "scalar";
+	}
+	else if (verbose)
+		dolog(LOG_INFO, "using %s debias kernels", debias_codes_name);
 }
 
-static void seed_continually_with_random_spike_data(int sample_rate, int skip_samples, int random_fd) {
-	size_t cur_sample_number = 0;
-	ssize_t last_spike_at[2] = {};
-	size_t last_sample_number_first_order_delta[2] = {};
-	int prev_sample[2] = {}, prev_spike_prev_sample[2] = {};
-	size_t last_idle_warning_at = 0;
-	size_t idle_warning_n_samples = SPIKE_IDLE_WARNING_SECONDS * (size_t)sample_rate;
+/* --self-test */
+static int debias_self_test(void)
+{
+	const char *name;
+	int ok;
+
+	init_debias_code_lut();
+	/* the state machine on its own first, then the vector code on top */
+	debias_codes[0] = debias_codes_reference(0);
+	debias_codes[1] = debias_codes_reference(1);
+	ok = debias_check_kernel(debias_S16_LE_2_simd, debias_S16_LE_2, "scalar") &&
+		debias_check_kernel(debias_S16_BE_2_simd, debias_S16_BE_2, "scalar");
+
+	debias_codes[0] = select_debias_codes(0, &name);
+	debias_codes[1] = select_debias_codes(1, &name);
+	ok = ok && debias_check_kernel(debias_S16_LE_2_simd, debias_S16_LE_2, name) &&
+		debias_check_kernel(debias_S16_BE_2_simd, debias_S16_BE_2, name);
+
+	printf("debias self-test (%s): %s\n", name, ok ? "ok" : "FAILED");
+	return ok;
+}
 
-	size_t spike_log_interval_samples = (size_t)round(spike_log_interval_seconds * (double)sample_rate);
-	size_t next_log_at = spike_log_interval_samples;
-	size_t log_cum_counts[2] = {};
-	long double log_cum_ISI_hz[2] = {};
+/* a full block of order bits: extract what it holds, msb first */
+static void __attribute__((noinline)) debias_extract_block(struct debias_state *ds, char *output, int *n_output_bytes)
+{
+	uint64_t bits;
+	unsigned int n_bits = ds->extract(ds->block, &bits);
 
-	unsigned __int128 collected_entropy = 0, last_collected_entropy = 0;
-	int n_bits_of_collected_entropy = 0;
+	while (n_bits-- > 0)
+	{
+		ds->byte_out = (unsigned char)((ds->byte_out << 1) | ((bits >> n_bits) & 1));
+		if (++ds->bits_out >= 8)
+		{
+			ds->bits_out = 0;
+			debias_emit_byte(ds, ds->byte_out, output, n_output_bytes);
+		}
+	}
+	ds->block_bits = 0;
+}
 
-	struct rand_pool_info *output = (struct rand_pool_info *)malloc(sizeof(struct rand_pool_info) + sizeof collected_entropy);
-	if (! output)
-		error_exit("malloc failure in %s",__FUNCTION__);
+/* feed the block extractors: one order bit per pair of frames, comparing
+ * the first two channels of the second frame less those of the first, and
+ * none if they're equal.  the extractors want independent bits, so no
+ * sample is used twice.
+ */
+#define DEFINE_EXTRACT_KERNEL(fmt, bytes, nch)									\
+static void extract_##fmt##_##nch(struct debias_state *ds, const char *frames, snd_pcm_uframes_t n_frames, unsigned int channels, char *output, int *n_output_bytes) \
+{														\
+	const size_t frame_bytes = (size_t)(bytes) * ((nch) ? (nch) : channels);				\
+														\
+	for (snd_pcm_uframes_t loop = 0; loop < n_frames; loop += 2, frames += 2 * frame_bytes)		\
+	{													\
+		long dl = DEBIAS_LOAD_##fmt(frames + frame_bytes) - DEBIAS_LOAD_##fmt(frames);			\
+		long dr = DEBIAS_LOAD_##fmt(frames + frame_bytes + (bytes)) - DEBIAS_LOAD_##fmt(frames + (bytes)); \
+														\
+		if (dl == dr)											\
+			continue;										\
+		ds->block = (ds->block << 1) | (dl > dr);							\
+		if (++ds->block_bits == EXTRACT_BLOCK_BITS)							\
+			debias_extract_block(ds, output, n_output_bytes);					\
+	}													\
+}
 
-	FILE *raw_out_file = 0;
-	if (file) {
-		raw_out_file = fopen(file, "a+");
-		if (! raw_out_file)
-			error_exit("error accessing file %s", file);
+#define DEFINE_EXTRACT_KERNELS(fmt, bytes, bits)	\
+	DEFINE_EXTRACT_KERNEL(fmt, bytes, 2)		\
+	DEFINE_EXTRACT_KERNEL(fmt, bytes, 4)		\
+	DEFINE_EXTRACT_KERNEL(fmt, bytes, 8)		\
+	DEFINE_EXTRACT_KERNEL(fmt, bytes, 0)
+SAMPLE_FORMATS(DEFINE_EXTRACT_KERNELS)
+
+/* bytes of lsbs to collect before conditioning: the block that keys the
+ * CBC-MAC, or a run of blocks up to the end of the MAC in progress
+ */
+static inline unsigned int lsb_run_bytes(const struct debias_state *ds)
+{
+	if (!ds->lsb_keyed)
+		return AES_BLOCK_SIZE;
+	return min(lsb_ratio - ds->lsb_n_blocks, LSB_MAC_RUN_BLOCKS) * AES_BLOCK_SIZE;
+}
+
+/* a run of lsbs: the first block keys the CBC-MAC, and is discarded */
+static void __attribute__((noinline)) lsb_condition_block(struct debias_state *ds, char *output, int *n_output_bytes)
+{
+	const unsigned int n_blocks = ds->lsb_block_len / AES_BLOCK_SIZE;
+	int i;
+
+	if (ds->lsb_harvest)
+	{
+		memcpy(output + *n_output_bytes, ds->lsb_block, ds->lsb_block_len);
+		*n_output_bytes += ds->lsb_block_len;
+		ds->lsb_block_len = 0;
+		return;
 	}
 
-	void maybe_reopen_raw_out_file(void) {
-		struct stat st;
-		if ((stat(file, &st) < 0) ||
-		    (ftell(raw_out_file) > st.st_size)) {
-			(void)fclose(raw_out_file);
-			if (! (raw_out_file = fopen(file,"a+"))) {
-				perror(file);
-				return;
-			}
+	ds->lsb_block_len = 0;
+	if (!ds->lsb_keyed)
+	{
+		aes_set_key(&ds->lsb_key, ds->lsb_block, AES_BLOCK_SIZE, 1);
+		ds->lsb_keyed = 1;
+		return;
+	}
+
+	aes_cbc_mac(&ds->lsb_key, ds->lsb_mac, ds->lsb_block, n_blocks);
+
+	if ((ds->lsb_n_blocks += n_blocks) == lsb_ratio)
+	{
+		for(i=0; i<AES_BLOCK_SIZE; i++)
+			debias_emit_byte(ds, ds->lsb_mac[i], output, n_output_bytes);
+		memset(ds->lsb_mac, 0, sizeof ds->lsb_mac);
+		ds->lsb_n_blocks = 0;
+	}
+}
+
+/* harvest the low lsb_bits of the first two channels of every frame */
+#define DEFINE_LSB_KERNEL(fmt, bytes, nch)									\
+static void lsb_##fmt##_##nch(struct debias_state *ds, const char *frames, snd_pcm_uframes_t n_frames, unsigned int channels, char *output, int *n_output_bytes) \
+{														\
+	const size_t frame_bytes = (size_t)(bytes) * ((nch) ? (nch) : channels);				\
+	const unsigned int n_bits = lsb_bits, mask = (1U << n_bits) - 1;					\
+														\
+	for (snd_pcm_uframes_t loop = 0; loop < n_frames; ++loop, frames += frame_bytes)			\
+	{													\
+		for (unsigned int channel = 0; channel < 2; ++channel)						\
+		{												\
+			ds->lsb_acc = (ds->lsb_acc << n_bits) | ((unsigned int)LOAD_##fmt(frames + channel * (bytes)) & mask); \
+			ds->lsb_acc_bits += n_bits;								\
+			if (ds->lsb_acc_bits < 8)								\
+				continue;									\
+			ds->lsb_acc_bits -= 8;									\
+			ds->lsb_block[ds->lsb_block_len++] = (unsigned char)(ds->lsb_acc >> ds->lsb_acc_bits);	\
+			if (ds->lsb_block_len == lsb_run_bytes(ds))						\
+				lsb_condition_block(ds, output, n_output_bytes);				\
+		}												\
+	}													\
+}
+
+#define DEFINE_LSB_KERNELS(fmt, bytes, bits)	\
+	DEFINE_LSB_KERNEL(fmt, bytes, 2)	\
+	DEFINE_LSB_KERNEL(fmt, bytes, 4)	\
+	DEFINE_LSB_KERNEL(fmt, bytes, 8)	\
+	DEFINE_LSB_KERNEL(fmt, bytes, 0)
+SAMPLE_FORMATS(DEFINE_LSB_KERNELS)
+
+/* kernels are specialized for 1, 2, 4 and 8 channels, with a generic fallback */
+static int kernel_channels_index(unsigned int channels)
+{
+	switch (channels)
+	{
+	case 1: return 0;
+	case 2: return 1;
+	case 4: return 2;
+	case 8: return 3;
+	default: return 4;
+	}
+}
+
+static debias_kernel_t select_debias_kernel(snd_pcm_format_t format, unsigned int channels)
+{
+	static const struct
+	{
+		snd_pcm_format_t format;
+		debias_kernel_t kernels[5];
+	} debias_kernels[] = {
+#define X(fmt, bytes, bits) { SND_PCM_FORMAT_##fmt, { NULL, debias_##fmt##_2, debias_##fmt##_4, debias_##fmt##_8, debias_##fmt##_0 } },
+		SAMPLE_FORMATS(X)
+#undef X
+	}, extract_kernels[] = {
+#define X(fmt, bytes, bits) { SND_PCM_FORMAT_##fmt, { NULL, extract_##fmt##_2, extract_##fmt##_4, extract_##fmt##_8, extract_##fmt##_0 } },
+		SAMPLE_FORMATS(X)
+#undef X
+	}, lsb_kernels[] = {
+#define X(fmt, bytes, bits) { SND_PCM_FORMAT_##fmt, { NULL, lsb_##fmt##_2, lsb_##fmt##_4, lsb_##fmt##_8, lsb_##fmt##_0 } },
+		SAMPLE_FORMATS(X)
+#undef X
+	};
+	size_t i;
+
+	if (extractor != EXTRACTOR_VON_NEUMANN)
+	{
+		typeof(extract_kernels[0]) *kernels = (extractor == EXTRACTOR_LSB) ? lsb_kernels : extract_kernels;
+
+		for(i=0; i<sizeof extract_kernels / sizeof extract_kernels[0]; i++)
+		{
+			if (kernels[i].format == format)
+				return kernels[i].kernels[kernel_channels_index(channels)];
 		}
+		error_exit("no %s kernel for %s", extractor_name(extractor), snd_pcm_format_name(format));
+	}
+
+	/* the common case has a vectorized kernel */
+	if ((format == SND_PCM_FORMAT_S16_LE || format == SND_PCM_FORMAT_S16_BE) && channels == 2)
+	{
+		init_debias_simd();
+		return format == SND_PCM_FORMAT_S16_LE ? debias_S16_LE_2_simd : debias_S16_BE_2_simd;
+	}
+
+	for(i=0; i<sizeof debias_kernels / sizeof debias_kernels[0]; i++)
+	{
+		if (debias_kernels[i].format == format)
+			return debias_kernels[i].kernels[kernel_channels_index(channels)];
 	}
+	error_exit("no debias kernel for %s", snd_pcm_format_name(format));
+	return NULL;
+}
 
-	int input_buffer_size;
-	char *input_buffer;
-	snd_pcm_t *chandle;
+/* sharded debiasing.  the first shard of a batch carries on from the last
+ * batch; every other one starts afresh -- alternator positive, no bits
+ * pending, no block in progress -- with the previous samples primed from
+ * the pair before it.  so the output depends on the batch alone, never on
+ * how many threads there are, or which finish first.  lsb shards only
+ * harvest: the CBC-MAC chain runs through them all in the merge, in order,
+ * so a MAC of any --lsb-ratio can span shards and batches.
+ */
+struct debias_shard
+{
+	struct debias_state ds;
+	const char *frames;
+	snd_pcm_uframes_t n_frames;
+	char *output;
+	int n_output_bytes;
+};
+
+static struct debias_pool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work, done;
+	unsigned long generation;		/* bumped for each batch */
+
+	debias_kernel_t kernel;
+	unsigned int channels;
+	struct debias_shard *shards;
+	size_t n_shards, max_shards;
+	atomic_size_t next;			/* shard to claim */
+	size_t n_done;
+
+	char *batch;				/* a batch that wrapped in the ring */
+	size_t batch_bytes;
+} debias_pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER };
+
+static size_t debias_pool_run(struct debias_pool *p)
+{
+	size_t i, n = 0;
 
-	if ((err = snd_pcm_open(&chandle, cdevice, SND_PCM_STREAM_CAPTURE, 0)) < 0)
-		error_exit("Record open error: %s", snd_strerror(err));
+	while ((i = atomic_fetch_add(&p->next, 1)) < p->n_shards)
+	{
+		struct debias_shard *sh = &p->shards[i];
 
-	/* Open and set up ALSA device for reading */
-	setparams(chandle, sample_rate);
+		p->kernel(&sh->ds, sh->frames, sh->n_frames, p->channels, sh->output, &sh->n_output_bytes);
+		n++;
+	}
+	return n;
+}
 
-	int spike_threshold_int = (int)((spike_threshold / 100.0) * 32767.0);
-	if (spike_threshold < 0)
-		spike_threshold_int = -spike_threshold_int;
-	int spike_edge_min_delta_int = (spike_edge_min_delta / 100.0) * 32767.0;
-	int spike_onset_sample_retained_bits = (sizeof(int) * 8UL) - __builtin_clz(spike_threshold_int) + 1UL - SPIKE_ONSET_SAMPLE_DISCARD_MSBS;
+static void *debias_worker(void *arg)
+{
+	struct debias_pool *p = (struct debias_pool *)arg;
+	unsigned long seen = 0;
 
-	int process_samples = sample_rate / 4;
+	pthread_mutex_lock(&p->lock);
+	for(;;)
+	{
+		while (p->generation == seen)
+			pthread_cond_wait(&p->work, &p->lock);
+		seen = p->generation;
+		pthread_mutex_unlock(&p->lock);
 
-	input_buffer_size = snd_pcm_frames_to_bytes(chandle, max(process_samples, skip_samples)) * 2; /* *2: stereo! */
-	input_buffer = (char *)malloc(input_buffer_size);
-	if (! input_buffer)
-		error_exit("problem allocating %d bytes of memory", input_buffer_size);
-	if (verbose > 1)
-		dolog(LOG_DEBUG, "Input buffer size: %d bytes", input_buffer_size);
+		size_t n = debias_pool_run(p);
 
-	/* Discard the first data read */
-	/* it often contains weird looking data - probably a click from */
-	/* driver loading / card initialisation */
-	snd_pcm_sframes_t garbage_frames_read = snd_pcm_readi(chandle, input_buffer, skip_samples);
-	/* Make sure we aren't hitting a disconnect/suspend case */
-	if (garbage_frames_read < 0)
-		snd_pcm_recover(chandle, garbage_frames_read, 0);
-	/* Nope, something else is wrong. Bail. */
-	if (garbage_frames_read < 0)
-		error_exit("Get random data: read error: %m");
-
-	void __attribute__((format(printf,1,2))) post_to_spike_log_file(const char *fmt,...) {
-		if (! spike_log_file)
-			return;
-		struct stat st;
-		if ((stat(spike_log_path, &st) < 0) ||
-		    (ftell(spike_log_file) > st.st_size)) {
-			(void)fclose(spike_log_file);
-			if (! (spike_log_file = fopen(spike_log_path,"a+"))) {
-				perror(spike_log_path);
-				return;
-			}
+		pthread_mutex_lock(&p->lock);
+		p->n_done += n;
+		if (p->n_done == p->n_shards)
+			pthread_cond_signal(&p->done);
+	}
+	return NULL;
+}
+
+static void start_debias_pool(void)
+{
+	for (int i = 1; i < debias_threads; i++)
+	{
+		pthread_t tid;
+		int err = pthread_create(&tid, NULL, debias_worker, &debias_pool);
+
+		if (err != 0)
+			error_exit("pthread_create for debias worker failed: %s", strerror(err));
+	}
+}
+
+static void debias_shard_reset(struct debias_state *ds)
+{
+	ds->a = 1;
+	ds->byte_out = 0;
+	ds->bits_out = 0;
+	ds->block_bits = 0;
+	ds->lsb_acc_bits = 0;
+	ds->lsb_block_len = 0;
+	ds->lsb_n_blocks = 0;
+	memset(ds->lsb_mac, 0, sizeof ds->lsb_mac);
+}
+
+/* a shard's starting state, from the pair of frames before it */
+static void debias_shard_prime(struct debias_state *ds, const struct debias_state *tmpl, debias_kernel_t kernel, const char *primer, unsigned int channels)
+{
+	char scratch[AES_BLOCK_SIZE];
+	int n = 0;
+
+	*ds = *tmpl;
+	ds->raw = 1;
+	ds->lsb_harvest = 1;
+	ds->psl = ds->psr = 0;
+	debias_shard_reset(ds);
+	kernel(ds, primer, 2, channels, scratch, &n);
+	debias_shard_reset(ds);
+}
+
+/* a batch through the pool.  its output is the same for any number of
+ * threads, but not the same as get_random_data() debiasing the batch in
+ * one piece: every shard but the first starts with the alternator reset
+ * and no bits pending.
+ */
+static void get_random_data_sharded(struct capture_source *src, int process_samples, int *n_output_bytes, char *output_buffer)
+{
+	struct debias_pool *p = &debias_pool;
+	const size_t frame_bytes = src->in.frame_bytes, n_frames = (size_t)process_samples * 2;
+	/* a bit per frame at most, or for lsb, the whole harvest */
+	const size_t shard_output_bytes = 2 * DEBIAS_SHARD_FRAMES + AES_BLOCK_SIZE + 1;
+	size_t n_shards = (n_frames + DEBIAS_SHARD_FRAMES - 1) / DEBIAS_SHARD_FRAMES, i, n;
+	const char *batch, *frames;
+	snd_pcm_uframes_t offset, n_read;
+	int in_place;
+
+	/* the whole batch, in one piece: in place when the source has it all
+	 * in a row (the mmap ring, unless it wraps), otherwise copied out */
+	n_read = capture_begin(src, n_frames, 2, &frames, &offset);
+	if ((in_place = (n_read == n_frames)))
+		batch = frames;
+	else
+	{
+		if (p->batch_bytes < n_frames * frame_bytes)
+		{
+			free(p->batch);
+			p->batch_bytes = n_frames * frame_bytes;
+			p->batch = (char *)malloc(p->batch_bytes);
+			if (!p->batch)
+				error_exit("problem allocating %zu bytes of memory", p->batch_bytes);
 		}
+		for (i = 0; ; )
 		{
-			struct timespec now;
-			clock_gettime(CLOCK_REALTIME, &now);
-			struct tm now_tm;
-			gmtime_r(&now.tv_sec, &now_tm);
-			char datebuf[40];
-			size_t datelen = strftime(datebuf, sizeof datebuf, "%Y-%m-%dT%H:%M:%S", &now_tm);
-			fprintf(spike_log_file, "%.*s.%06uZ ", (int)datelen, datebuf, (unsigned)round((double)now.tv_nsec / 1000.0));
+			memcpy(p->batch + i * frame_bytes, frames, n_read * frame_bytes);
+			capture_commit(src, offset, n_read);
+			if ((i += n_read) == n_frames)
+				break;
+			n_read = capture_begin(src, n_frames - i, 2, &frames, &offset);
 		}
-		va_list ap;
-		va_start(ap,fmt);
-		vfprintf(spike_log_file,fmt,ap);
-		fflush(spike_log_file);
+		batch = p->batch;
 	}
 
-	if (spike_log_file)
-		post_to_spike_log_file("STARTUP\n");
+	if (p->max_shards < n_shards)
+	{
+		p->shards = (struct debias_shard *)realloc(p->shards, n_shards * sizeof *p->shards);
+		if (!p->shards)
+			error_exit("problem allocating memory for %zu debias shards", n_shards);
+		for (i = p->max_shards; i < n_shards; i++)
+		{
+			p->shards[i].output = (char *)malloc(shard_output_bytes);
+			if (!p->shards[i].output)
+				error_exit("problem allocating %zu bytes of memory", shard_output_bytes);
+		}
+		p->max_shards = n_shards;
+	}
 
-	size_t total_popcount = 0, last_total_popcount = 0;
-	size_t total_retained_bits = 0, last_total_retained_bits = 0;
+	for (i = 0; i < n_shards; i++)
+	{
+		struct debias_shard *sh = &p->shards[i];
 
-	size_t total_byte_sum = 0, last_total_byte_sum = 0;
-	size_t total_byte_sum_denom = 0, last_total_byte_sum_denom = 0;
+		sh->frames = batch + i * DEBIAS_SHARD_FRAMES * frame_bytes;
+		sh->n_frames = min(n_frames - i * DEBIAS_SHARD_FRAMES, (size_t)DEBIAS_SHARD_FRAMES);
+		sh->n_output_bytes = 0;
+		if (i == 0)
+		{
+			sh->ds = src->debias;
+			sh->ds.raw = 1;
+			sh->ds.lsb_harvest = 1;
+			sh->ds.lsb_block_len = 0;
+			sh->ds.lsb_n_blocks = 0;
+		}
+		else
+			debias_shard_prime(&sh->ds, &src->debias, src->debias_kernel, sh->frames - 2 * frame_bytes, src->in.channels);
+	}
 
-	size_t n_all_ones = 0, n_all_zeros = 0;
+	pthread_mutex_lock(&p->lock);
+	p->kernel = src->debias_kernel;
+	p->channels = src->in.channels;
+	p->n_shards = n_shards;
+	atomic_store(&p->next, 0);
+	p->n_done = 0;
+	p->generation++;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+
+	n = debias_pool_run(p);
+
+	pthread_mutex_lock(&p->lock);
+	p->n_done += n;
+	while (p->n_done < p->n_shards)
+		pthread_cond_wait(&p->done, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+
+	if (in_place)
+		capture_commit(src, offset, n_frames);
+
+	/* in order, through the lsb conditioner, and the RNG test */
+	for (i = 0; i < n_shards; i++)
+	{
+		struct debias_shard *sh = &p->shards[i];
+		struct debias_state *ds = &src->debias;
 
-	size_t total_events = 0, last_total_events = 0;
-	size_t last_cur_sample_number = 0;
+		if (extractor != EXTRACTOR_LSB)
+		{
+			for (int b = 0; b < sh->n_output_bytes; b++)
+				debias_emit_byte(ds, (unsigned char)sh->output[b], output_buffer, n_output_bytes);
+			continue;
+		}
 
-	size_t *chisquare_bins = calloc((1UL << 8UL),sizeof(*chisquare_bins));
-	if (! chisquare_bins)
-		error_exit("chisquare_bins = calloc(%zu,%zu): %m",(1UL << 8UL),sizeof(*chisquare_bins));
+		/* the whole bytes the shard left over belong to the chain too */
+		lsb_condition_block(&sh->ds, sh->output, &sh->n_output_bytes);
+		for (int b = 0; b < sh->n_output_bytes; b++)
+		{
+			ds->lsb_block[ds->lsb_block_len++] = (unsigned char)sh->output[b];
+			if (ds->lsb_block_len == lsb_run_bytes(ds))
+				lsb_condition_block(ds, output_buffer, n_output_bytes);
+		}
+	}
 
-	aes_context aes_ctx = {};
+	/* the next batch carries on from the last shard */
+	{
+		const struct debias_state *last = &p->shards[n_shards - 1].ds;
+		struct debias_state *ds = &src->debias;
+
+		ds->psl = last->psl;
+		ds->psr = last->psr;
+		ds->a = last->a;
+		ds->lsb_acc = last->lsb_acc;
+		ds->lsb_acc_bits = last->lsb_acc_bits;
+	}
+}
 
-	for (;;) {
-		if ((cur_sample_number - last_spike_at[0] > idle_warning_n_samples) &&
-		    (cur_sample_number - last_spike_at[1] > idle_warning_n_samples)) {
-			if (! last_idle_warning_at) {
-				last_idle_warning_at = cur_sample_number;
-				dolog(LOG_ERR, "no spikes detected in %d seconds.", SPIKE_IDLE_WARNING_SECONDS);
-				if (spike_log_file)
-					post_to_spike_log_file("OUTAGE -- no spikes for %d s.\n", SPIKE_IDLE_WARNING_SECONDS);
-			}
-		} else {
-			if (last_idle_warning_at) {
-				double outage_duration = ((double)(cur_sample_number - last_idle_warning_at) / (double)sample_rate) + (double)SPIKE_IDLE_WARNING_SECONDS;
-				if (spike_log_file)
-					post_to_spike_log_file("RESUMED -- spike(s) detected after %.1f s outage.\n", outage_duration);
-				dolog(LOG_ERR, "spikes resumed after %.1f second outage.", outage_duration);
-				last_idle_warning_at = 0;
-			}
+void get_random_data(struct capture_source *src, int process_samples, int *n_output_bytes, char **output_buffer)
+{
+	int n_to_do;
+	uint64_t n_bytes_before = src->debias.n_bytes_out;
+	/* a bit from a pair of frames at most, or for lsb, a share of the
+	 * harvest and the block in progress */
+	int max_output_bytes = (extractor == EXTRACTOR_LSB) ?
+		(int)((uint64_t)process_samples * 4 * lsb_bits / (8 * lsb_ratio)) + AES_BLOCK_SIZE + 1 :
+		process_samples / 8 + 1;
+
+	if (verbose > 1)
+		dolog(LOG_DEBUG, "get_random_data(%s, %d, %p, %p)", src->in.name, process_samples, n_output_bytes, output_buffer);
+
+	*n_output_bytes=0;
+	src->debias.byte_out = 0;
+	src->debias.bits_out = 0;
+	src->debias.block_bits = 0;
+
+	*output_buffer = (char *)malloc(max_output_bytes);
+	if (!*output_buffer)
+		error_exit("problem allocating %d bytes of memory", max_output_bytes);
+
+	/* in shards, once the lsb conditioner has its key (from the first
+	 * block of the first batch) for all of them to share.
+	 */
+	if (debias_threads && (extractor != EXTRACTOR_LSB || src->debias.lsb_keyed))
+		get_random_data_sharded(src, process_samples, n_output_bytes, *output_buffer);
+	else
+	/* Read a buffer of audio, and de-bias it as it arrives.  the debias
+	 * loop consumes frames in pairs.  in mmap mode we debias straight out
+	 * of the ring buffer.
+	 */
+	for (n_to_do = process_samples * 2; n_to_do > 0; )
+	{
+		const char *frames;
+		snd_pcm_uframes_t offset, n_frames;
+
+		n_frames = capture_begin(src, n_to_do, 2, &frames, &offset);
+		src->debias_kernel(&src->debias, frames, n_frames, src->in.channels, *output_buffer, n_output_bytes);
+		capture_commit(src, offset, n_frames);
+		n_to_do -= n_frames;
+	}
+
+	src->n_frames_debiased += (uint64_t)process_samples * 2;
+	if (verbose)
+		dolog(LOG_INFO, "%s: %s extractor, %.4f bits/frame (%.4f since startup)", src->in.name, extractor_name(extractor),
+		      (double)(src->debias.n_bytes_out - n_bytes_before) * 8.0 / (double)(process_samples * 2),
+		      (double)src->debias.n_bytes_out * 8.0 / (double)src->n_frames_debiased);
+
+	if (verbose > 1)
+		dolog(LOG_DEBUG, "get_random_data() finished");
+}
+
+#define SPIKE_WHITEN_BLOCKS	16
+
+/* one channel's events: its own accumulator, whitening and credit, and
+ * statistics.  only the thread detecting on the channel writes it; the
+ * lock is for the log reading the statistics.
+ */
+struct spike_stream
+{
+	pthread_mutex_t lock;
+
+	unsigned __int128 collected_entropy;
+	int n_bits_of_collected_entropy;
+	int n_credit_bits_collected;	/* of those, the ones the kernel is credited for */
+	aes_context aes_ctx;
+	/* CBC: the last block out, and full blocks waiting for the batch's end */
+	unsigned char cbc_iv[AES_BLOCK_SIZE];
+	int have_cbc_iv;
+	unsigned char whiten_blocks[SPIKE_WHITEN_BLOCKS * AES_BLOCK_SIZE];
+	unsigned int n_whiten_blocks;
+	size_t whiten_credit_bits;
+
+	size_t total_popcount, total_retained_bits;
+	size_t total_byte_sum, total_byte_sum_denom;
+	size_t n_all_ones, n_all_zeros;
+	size_t chisquare_bins[1UL << 8UL];
+
+	/* extraction: the last event's frame, interval and pre-onset sample */
+	size_t last_event_frame, last_sample_number_first_order_delta;
+	long prev_spike_prev_sample;
+
+	/* events, in all and since the last log line */
+	size_t total_events;
+	size_t log_cum_counts;
+	long double log_cum_ISI_hz;
+};
+
+/* spike detection state for one capture source.  each source runs its
+ * own detection loop, on its own thread when there are several.
+ */
+struct spike_source
+{
+	struct capture_source *cs;
+	int index;
+	int sample_rate;
+
+	/* thresholds, scaled to the negotiated sample format */
+	long full_scale;
+	long threshold[MAX_CHANNELS], edge_min_delta[MAX_CHANNELS];
+	int onset_sample_retained_bits;
+	unsigned int scan_channels[MAX_CHANNELS], n_scan_channels;	/* those in the mask */
+	spike_scan_kernel_t scan, scan_scalar;	/* scan_scalar behind the pre-scan */
+	spike_load_t load;			/* one sample, for onset interpolation */
+	const char *chunk_begin;		/* of the frames being scanned */
+	/* onset interpolation: the last frames before the chunk, oldest
+	 * first, as detection saw them; n_history of them since the last gap */
+	long history[MAX_CHANNELS][SPIKE_EVENT_TAPS - 1];
+	unsigned int n_history;
+	struct spike_prescan prescan;
+
+	/* auto-calibration: bounds, and running estimates per channel */
+	long threshold_bounds[2], edge_min_delta_bounds[2];
+	spike_noise_kernel_t noise;
+	size_t next_calibration_at;
+	struct spike_calibration {
+		int have_noise;
+		double baseline, noise_var;	/* of sub-threshold samples */
+		double pulse_height;		/* of pulse peaks */
+		size_t n_pulses;
+	} cal[MAX_CHANNELS];
+	long pulse_peak[MAX_CHANNELS];		/* of the latest pulse, 0 before the first */
+
+	size_t cur_sample_number;		/* at the device's rate, counting frames lost */
+	int have_last_spike[MAX_CHANNELS];	/* since startup or the last gap */
+	ssize_t last_spike_at[MAX_CHANNELS];
+	long prev_sample[MAX_CHANNELS];
+	size_t last_idle_warning_at;
+
+	/* detected this period, for extraction */
+	struct spike_event events[SPIKE_EVENTS_PER_BATCH];
+	size_t n_events;
+
+	struct spike_stream streams[MAX_CHANNELS];
+};
+
+/* what the channels' streams share, besides krng_out: the raw output
+ * file (under the lock), and the totals at the last log line.
+ */
+struct spike_output
+{
+	pthread_mutex_t lock;
+	FILE *raw_out_file;
+
+	size_t last_total_popcount, last_total_retained_bits;
+	size_t last_total_byte_sum, last_total_byte_sum_denom;
+	size_t last_total_events, last_cur_sample_number;
+};
+
+static struct spike_source spike_sources[MAX_CAPTURE_DEVICES];
+static struct spike_output spike_out = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static pthread_mutex_t spike_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void __attribute__((format(printf,1,2))) post_to_spike_log_file(const char *fmt,...) {
+	if (! spike_log_file)
+		return;
+	pthread_mutex_lock(&spike_log_lock);
+	struct stat st;
+	if ((stat(spike_log_path, &st) < 0) ||
+	    (ftell(spike_log_file) > st.st_size)) {
+		(void)fclose(spike_log_file);
+		if (! (spike_log_file = fopen(spike_log_path,"a+"))) {
+			perror(spike_log_path);
+			pthread_mutex_unlock(&spike_log_lock);
+			return;
 		}
+	}
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		struct tm now_tm;
+		gmtime_r(&now.tv_sec, &now_tm);
+		char datebuf[40];
+		size_t datelen = strftime(datebuf, sizeof datebuf, "%Y-%m-%dT%H:%M:%S", &now_tm);
+		fprintf(spike_log_file, "%.*s.%06uZ ", (int)datelen, datebuf, (unsigned)round((double)now.tv_nsec / 1000.0));
+	}
+	va_list ap;
+	va_start(ap,fmt);
+	vfprintf(spike_log_file,fmt,ap);
+	va_end(ap);
+	fflush(spike_log_file);
+	pthread_mutex_unlock(&spike_log_lock);
+}
 
-		if (spike_log_file && (cur_sample_number >= next_log_at)) { /* because of lumpiness in the reading, there will be jitter here. */
-			next_log_at += spike_log_interval_samples;
+static void maybe_reopen_raw_out_file(void) {
+	struct stat st;
+	if ((stat(file, &st) < 0) ||
+	    (ftell(spike_out.raw_out_file) > st.st_size)) {
+		(void)fclose(spike_out.raw_out_file);
+		if (! (spike_out.raw_out_file = fopen(file,"a+"))) {
+			perror(file);
+			return;
+		}
+	}
+}
 
-			double chisquare_score = 0; /* (𝚺(x_i^2 / m_i)) - n */
-			for (size_t i = 0; i < (1UL << 8UL); ++i) {
-				double x = (double)chisquare_bins[i];
-				chisquare_score += (x*x);
-			}
-			{
-				double m = (double)total_byte_sum_denom / (double)(1UL << 8UL);
-				chisquare_score /= m;
-			}
-			chisquare_score -= (double)total_byte_sum_denom;
-			double chisquare_median = 1.0 - (2.0 / (9.0 * (double)(1UL << 8UL))); /* approximation per https://en.wikipedia.org/wiki/Chi-squared_distribution */
-			chisquare_median = (double)(1UL << 8UL) * chisquare_median * chisquare_median * chisquare_median;
-			const double chisquare_sd = sqrt(2.0 * (double)(1UL << 8UL));
-
-			post_to_spike_log_file("N%s%.*lu%s%.*lu C/sd=%+.1f E=%zu B=%.3f%% Bcum=%.6f%% Bcum/sd=%+.1f A=%.1f Acum=%.3f Acum/sd=%+.1f ChiSq=%.2f ChiSq/sd=%+.1f n=%zu z=%zu o=%zu m_hz=%.2Lf brst=%.2Lf\n",
-					       (spike_channel_mask & 0x1) ? " C0=" : "",
-					       (spike_channel_mask & 0x1) ? 1 : 0,
-					       log_cum_counts[0],
-					       (spike_channel_mask & 0x2) ? " C1=" : "",
-					       (spike_channel_mask & 0x2) ? 1 : 0,
-					       log_cum_counts[1],
-					       (((double)(cur_sample_number - last_cur_sample_number) / (double)sample_rate) *
-						(((double)(total_events - last_total_events) / ((double)(cur_sample_number - last_cur_sample_number) / (double)sample_rate))
-						 - ((double)total_events / ((double)cur_sample_number / (double)sample_rate))))
-					       / sqrt(((double)(cur_sample_number - last_cur_sample_number) / (double)sample_rate)
-						      * (double)total_events / ((double)cur_sample_number / (double)sample_rate)), /* Poisson dist */
-					       total_retained_bits - last_total_retained_bits,
-					       ((total_retained_bits > last_total_retained_bits) ?
-						100.0 * (double)(total_popcount - last_total_popcount) / (double)(total_retained_bits - last_total_retained_bits) :
-						-1),
-					       100.0 * (double)total_popcount / (double)total_retained_bits,
-					       ((double)total_popcount - ((double)total_retained_bits * 0.5)) / sqrt(0.25 * (double)total_retained_bits), /* binomial dist */
-					       ((total_byte_sum > last_total_byte_sum) ?
-						(double)(total_byte_sum - last_total_byte_sum) / (double)(total_byte_sum_denom - last_total_byte_sum_denom) :
-						-1),
-					       (double)total_byte_sum / (double)total_byte_sum_denom,
-					       (((double)total_byte_sum / 255.0) - ((double)total_byte_sum_denom * 0.5)) / sqrt((double)total_byte_sum_denom / 12.0),  /* Irwin-Hall dist */
-					       chisquare_score,
-					       (chisquare_score - chisquare_median) / chisquare_sd,
-					       total_byte_sum_denom, n_all_zeros, n_all_ones,
-					       /* avg(1/ISI) */
-					       (log_cum_ISI_hz[0] + log_cum_ISI_hz[1]) / (long double)(total_events - last_total_events),
-					       /* burstiness metric: avg(1/ISI), normalized by 1/avg(ISI), minus 1 */
-					       (((log_cum_ISI_hz[0] + log_cum_ISI_hz[1]) / (long double)(total_events - last_total_events))
-						/ ((long double)(total_events - last_total_events) /
-						   ((long double)(cur_sample_number - last_cur_sample_number) / (long double)sample_rate)))
-					       - 1.0l
+/* chi-square of byte counts against uniform, in standard deviations
+ * from the median -- and the score, for the log.
+ */
+static double spike_chisquare(const size_t *bins, size_t n_bytes, double *sds) {
+	double chisquare_score = 0; /* (𝚺(x_i^2 / m_i)) - n */
+	for (size_t i = 0; i < (1UL << 8UL); ++i) {
+		double x = (double)bins[i];
+		chisquare_score += (x*x);
+	}
+	{
+		double m = (double)n_bytes / (double)(1UL << 8UL);
+		chisquare_score /= m;
+	}
+	chisquare_score -= (double)n_bytes;
+	double chisquare_median = 1.0 - (2.0 / (9.0 * (double)(1UL << 8UL))); /* approximation per https://en.wikipedia.org/wiki/Chi-squared_distribution */
+	chisquare_median = (double)(1UL << 8UL) * chisquare_median * chisquare_median * chisquare_median;
+	const double chisquare_sd = sqrt(2.0 * (double)(1UL << 8UL));
+
+	*sds = (chisquare_score - chisquare_median) / chisquare_sd;
+	return chisquare_score;
+}
+
+/* emit the periodic statistics line, totalled over the channels, then a
+ * line for each channel.  driven by the first source's sample clock.
+ */
+static void spike_log_stats(struct spike_source *ss) {
+	struct spike_output *so = &spike_out;
+	size_t cur_sample_number = ss->cur_sample_number;
+	int sample_rate = ss->sample_rate;
+	size_t total_events = 0;
+	long double cum_ISI_hz = 0.0l;
+	char counts[24 * MAX_CHANNELS * MAX_CAPTURE_DEVICES] = "";
+	size_t counts_len = 0;
+	size_t total_popcount = 0, total_retained_bits = 0, total_byte_sum = 0, total_byte_sum_denom = 0, n_all_ones = 0, n_all_zeros = 0;
+	size_t chisquare_bins[1UL << 8UL] = { 0 };
+	char channel_stats[MAX_CHANNELS * MAX_CAPTURE_DEVICES][160];
+	int n_channel_stats = 0;
+
+	for (int s = 0; s < n_cdevices; ++s) {
+		for (unsigned int channel = 0; channel < spike_sources[s].cs->in.channels; ++channel) {
+			struct spike_stream *st = &spike_sources[s].streams[channel];
+			char label[16];
+
+			if (! (spike_channel_mask & (1U << channel)))
+				continue;
+			if (s == 0)
+				snprintf(label, sizeof label, "C%u", channel);
+			else
+				snprintf(label, sizeof label, "D%dC%u", s, channel);
+
+			pthread_mutex_lock(&st->lock);
+			total_events += st->total_events;
+			cum_ISI_hz += st->log_cum_ISI_hz;
+			counts_len += snprintf(counts + counts_len, sizeof counts - counts_len, " %s=%zu", label, st->log_cum_counts);
+			total_popcount += st->total_popcount;
+			total_retained_bits += st->total_retained_bits;
+			total_byte_sum += st->total_byte_sum;
+			total_byte_sum_denom += st->total_byte_sum_denom;
+			n_all_ones += st->n_all_ones;
+			n_all_zeros += st->n_all_zeros;
+			for (size_t i = 0; i < (1UL << 8UL); ++i)
+				chisquare_bins[i] += st->chisquare_bins[i];
+
+			double chisquare_sds;
+			spike_chisquare(st->chisquare_bins, st->total_byte_sum_denom, &chisquare_sds);
+			snprintf(channel_stats[n_channel_stats++], sizeof channel_stats[0],
+				 "S %s E=%zu Bcum=%.6f%% Bcum/sd=%+.1f Acum=%.3f Acum/sd=%+.1f ChiSq/sd=%+.1f n=%zu z=%zu o=%zu\n",
+				 label,
+				 st->total_retained_bits,
+				 100.0 * (double)st->total_popcount / (double)st->total_retained_bits,
+				 ((double)st->total_popcount - ((double)st->total_retained_bits * 0.5)) / sqrt(0.25 * (double)st->total_retained_bits), /* binomial dist */
+				 (double)st->total_byte_sum / (double)st->total_byte_sum_denom,
+				 (((double)st->total_byte_sum / 255.0) - ((double)st->total_byte_sum_denom * 0.5)) / sqrt((double)st->total_byte_sum_denom / 12.0),  /* Irwin-Hall dist */
+				 chisquare_sds,
+				 st->total_byte_sum_denom, st->n_all_zeros, st->n_all_ones);
+
+			st->log_cum_counts = 0;
+			st->log_cum_ISI_hz = 0.0l;
+			pthread_mutex_unlock(&st->lock);
+		}
+	}
+
+	double chisquare_sds;
+	double chisquare_score = spike_chisquare(chisquare_bins, total_byte_sum_denom, &chisquare_sds);
+
+	char capture_stats[192 * MAX_CAPTURE_DEVICES] = "";
+	size_t capture_stats_len = 0;
+	for (int s = 0; s < n_cdevices; ++s) {
+		struct capture_source *cs = spike_sources[s].cs;
+		char label[16] = "";
+		if (s)
+			snprintf(label, sizeof label, "D%d:", s);
+		capture_stats_len += snprintf(capture_stats + capture_stats_len, sizeof capture_stats - capture_stats_len,
+					      " %sxruns=%zu xrun_lost=%zu",
+					      label,
+					      atomic_load(&cs->in.n_xruns),
+					      atomic_load(&cs->in.xrun_frames_lost));
+		if (! cs->capture_thread_running)
+			continue;
+		capture_stats_len += snprintf(capture_stats + capture_stats_len, sizeof capture_stats - capture_stats_len,
+					      " %sring=%zu/%zu ring_max=%zu ovf=%zu lost=%zu",
+					      label,
+					      ring_occupancy(&cs->ring), cs->ring.n_slots,
+					      atomic_load(&cs->ring.max_occupancy),
+					      atomic_load(&cs->ring.n_overflows),
+					      atomic_load(&cs->frames_lost));
+	}
+
+	post_to_spike_log_file("N%s C/sd=%+.1f E=%zu B=%.3f%% Bcum=%.6f%% Bcum/sd=%+.1f A=%.1f Acum=%.3f Acum/sd=%+.1f ChiSq=%.2f ChiSq/sd=%+.1f n=%zu z=%zu o=%zu m_hz=%.2Lf brst=%.2Lf%s\n",
+			       counts,
+			       (((double)(cur_sample_number - so->last_cur_sample_number) / (double)sample_rate) *
+				(((double)(total_events - so->last_total_events) / ((double)(cur_sample_number - so->last_cur_sample_number) / (double)sample_rate))
+				 - ((double)total_events / ((double)cur_sample_number / (double)sample_rate))))
+			       / sqrt(((double)(cur_sample_number - so->last_cur_sample_number) / (double)sample_rate)
+				      * (double)total_events / ((double)cur_sample_number / (double)sample_rate)), /* Poisson dist */
+			       total_retained_bits - so->last_total_retained_bits,
+			       ((total_retained_bits > so->last_total_retained_bits) ?
+				100.0 * (double)(total_popcount - so->last_total_popcount) / (double)(total_retained_bits - so->last_total_retained_bits) :
+				-1),
+			       100.0 * (double)total_popcount / (double)total_retained_bits,
+			       ((double)total_popcount - ((double)total_retained_bits * 0.5)) / sqrt(0.25 * (double)total_retained_bits), /* binomial dist */
+			       ((total_byte_sum > so->last_total_byte_sum) ?
+				(double)(total_byte_sum - so->last_total_byte_sum) / (double)(total_byte_sum_denom - so->last_total_byte_sum_denom) :
+				-1),
+			       (double)total_byte_sum / (double)total_byte_sum_denom,
+			       (((double)total_byte_sum / 255.0) - ((double)total_byte_sum_denom * 0.5)) / sqrt((double)total_byte_sum_denom / 12.0),  /* Irwin-Hall dist */
+			       chisquare_score,
+			       chisquare_sds,
+			       total_byte_sum_denom, n_all_zeros, n_all_ones,
+			       /* avg(1/ISI) */
+			       cum_ISI_hz / (long double)(total_events - so->last_total_events),
+			       /* burstiness metric: avg(1/ISI), normalized by 1/avg(ISI), minus 1 */
+			       ((cum_ISI_hz / (long double)(total_events - so->last_total_events))
+				/ ((long double)(total_events - so->last_total_events) /
+				   ((long double)(cur_sample_number - so->last_cur_sample_number) / (long double)sample_rate)))
+			       - 1.0l,
+			       capture_stats
+		);
+	for (int i = 0; i < n_channel_stats; ++i)
+		post_to_spike_log_file("%s", channel_stats[i]);
+
+	so->last_total_events = total_events;
+	so->last_cur_sample_number = cur_sample_number;
+	so->last_total_popcount = total_popcount;
+	so->last_total_retained_bits = total_retained_bits;
+	so->last_total_byte_sum = total_byte_sum;
+	so->last_total_byte_sum_denom = total_byte_sum_denom;
+}
+
+/* whiten a channel's waiting blocks in one CBC run, and credit them.
+ * with the stream's lock held.
+ */
+static void spike_whiten(struct spike_stream *st) {
+	const size_t n_bytes = st->n_whiten_blocks * AES_BLOCK_SIZE;
+
+	if (! n_bytes)
+		return;
+	aes_cbc_encrypt(&st->aes_ctx, st->cbc_iv, st->whiten_blocks, st->whiten_blocks, st->n_whiten_blocks);
+	/* why RNDADDENTROPY doesn't credit it is a mystery, but a fact --
+	 * so krng_out follows up with RNDADDTOENTCNT.
+	 */
+	credit_output(st->whiten_blocks, n_bytes, (double)st->whiten_credit_bits);
+	memset(st->whiten_blocks, 0, n_bytes);
+	st->n_whiten_blocks = 0;
+	st->whiten_credit_bits = 0;
+}
+
+/* fold one event's bits into its channel's accumulator, and queue it for
+ * whitening and credit whenever 128 bits have collected.  the low
+ * n_bits - n_credit_bits of them go in uncredited.
+ */
+static void spike_emit_bits(struct spike_source *ss, int channel, size_t sample_number_first_order_delta, ssize_t bits, unsigned n_bits, unsigned n_credit_bits) {
+	struct spike_output *so = &spike_out;
+	struct spike_stream *st = &ss->streams[channel];
+
+	pthread_mutex_lock(&st->lock);
+
+	++st->total_events;
+	++st->log_cum_counts;
+	st->log_cum_ISI_hz += (long double)ss->sample_rate / (long double)sample_number_first_order_delta;
+
+	st->total_popcount += __builtin_popcountl(bits & ((1UL << n_bits) - 1UL));
+	st->total_retained_bits += n_bits;
+
+	int unused_bits = 0, unused_credit_bits = 0;
+	if (st->n_bits_of_collected_entropy + n_bits > (sizeof(st->collected_entropy) * 8UL)) {
+		unused_bits = (st->n_bits_of_collected_entropy + n_bits) - (sizeof(st->collected_entropy) * 8UL);
+		n_bits -= unused_bits;
+		/* the uncredited bits are the low ones, so they're left over first */
+		unused_credit_bits = unused_bits - (int)min((unsigned)unused_bits, n_bits + (unsigned)unused_bits - n_credit_bits);
+		n_credit_bits -= (unsigned)unused_credit_bits;
+	}
+
+	st->collected_entropy <<= n_bits;
+	st->collected_entropy |= ((bits >> unused_bits) & ((1UL << n_bits) - 1UL));
+	st->n_bits_of_collected_entropy += n_bits;
+	st->n_credit_bits_collected += (int)n_credit_bits;
+	if (st->n_bits_of_collected_entropy >= (sizeof(st->collected_entropy) * 8UL)) {
+		size_t this_byte_sum = 0;
+		for (size_t b=0; b<sizeof st->collected_entropy * 8UL; b += 8UL) {
+			size_t this_byte = (size_t)(st->collected_entropy >> b) & 0xffUL;
+			this_byte_sum += this_byte;
+			++st->chisquare_bins[this_byte];
+			if (this_byte == 0xffUL)
+				++st->n_all_ones;
+			else if (this_byte == 0x0UL)
+				++st->n_all_zeros;
+		}
+		st->total_byte_sum += this_byte_sum;
+		st->total_byte_sum_denom += sizeof st->collected_entropy;
+		int popcount = __builtin_popcountl((unsigned long)st->collected_entropy) + __builtin_popcountl((unsigned long)(st->collected_entropy >> 64UL));
+		if (spike_test_mode) {
+			double avg = (double)this_byte_sum / (double)sizeof st->collected_entropy;
+			printf("emitting %d bits, popcount %d, avg %.1f, %d bit%s left over; Bcum %f%% (%+.1fsd), Acum %.3f (%+.1fsd))\n",
+			       st->n_bits_of_collected_entropy,
+			       popcount,
+			       avg,
+			       unused_bits,
+			       unused_bits == 1 ? "" : "s",
+			       100.0 * (double)st->total_popcount / (double)st->total_retained_bits,
+			       ((double)st->total_popcount - ((double)st->total_retained_bits * 0.5)) / sqrt(0.25 * (double)st->total_retained_bits),
+			       (double)st->total_byte_sum / (double)st->total_byte_sum_denom,
+			       (((double)st->total_byte_sum / 255.0) - ((double)st->total_byte_sum_denom * 0.5)) / sqrt((double)st->total_byte_sum_denom / 12.0)  /* Irwin-Hall dist */
 				);
-			log_cum_counts[0] = log_cum_counts[1] = 0;
-			log_cum_ISI_hz[0] = log_cum_ISI_hz[1] = 0.0l;
-			last_total_events = total_events;
-			last_cur_sample_number = cur_sample_number;
-			last_total_popcount = total_popcount;
-			last_total_retained_bits = total_retained_bits;
-			last_total_byte_sum = total_byte_sum;
-			last_total_byte_sum_denom = total_byte_sum_denom;
 		}
 
-		snd_pcm_sframes_t frames_read = snd_pcm_readi(chandle, input_buffer, process_samples * 2);
-		/* Make	sure we	aren't hitting a disconnect/suspend case */
-		if (frames_read < 0)
-			frames_read = snd_pcm_recover(chandle, frames_read, 0);
-		/* Nope, something else is wrong. Bail.	*/
-		if (frames_read < 0)
-			error_exit("Read error: %m");
-		if (frames_read == -1) 
-		{
-			if (errno != EINTR)
-				error_exit("Read error: %m");
+		/* set an AES key with random data, then discard the data. */
+		if (! st->aes_ctx.aes_Nkey) {
+			aes_set_key(&st->aes_ctx, (const unsigned char *)&st->collected_entropy, (int)sizeof st->collected_entropy, 1);
+			goto skip_writing;
+		}
+		/* set an IV with random data, then discard the data. */
+		if (! st->have_cbc_iv) {
+			memcpy(st->cbc_iv, &st->collected_entropy, sizeof st->cbc_iv);
+			st->have_cbc_iv = 1;
+			goto skip_writing;
 		}
 
-#ifndef min
-#define min(x,y) ({ typeof(x) _x = (x); typeof(y) _y = (y); (_x < _y) ? _x : _y; })
-#endif
+		pthread_mutex_lock(&so->lock);
+		if (so->raw_out_file)
+			maybe_reopen_raw_out_file();
+		if (so->raw_out_file) {
+			/*
+			 * write out the raw entropy with no whitening at all, for cryptoanalytic evaluation.
+			 *
+			 * do cursory evaluation of output file using an entropy analyzer, e.g.
+			 * http://www.fourmilab.ch/random/
+			 * or
+			 * http://webhome.phy.duke.edu/~rgb/General/dieharder.php
+			 */
+			if (fwrite(&st->collected_entropy, 1UL, sizeof st->collected_entropy, so->raw_out_file) != sizeof st->collected_entropy) {
+				dolog(LOG_CRIT, "%s: %m", file);
+				(void)fclose(so->raw_out_file);
+				so->raw_out_file = 0;
+			} else
+				fflush(so->raw_out_file);
+		}
+		pthread_mutex_unlock(&so->lock);
+		if (! spike_test_mode) {
+			/* CBC mode with random key and IV set above, at the end
+			 * of the batch. */
+			memcpy(st->whiten_blocks + st->n_whiten_blocks * AES_BLOCK_SIZE, &st->collected_entropy, AES_BLOCK_SIZE);
+			st->whiten_credit_bits += (size_t)st->n_credit_bits_collected;
+			if (++st->n_whiten_blocks == SPIKE_WHITEN_BLOCKS)
+				spike_whiten(st);
+		}
 
-		for(int loop=0; loop<(frames_read * 2/*16bits*/ * 2/*stereo*/); loop+=4, ++cur_sample_number) {
-			for (int channel = 0; channel < 2; ++channel) {
-				if (! (spike_channel_mask & (1 << channel)))
-					continue;
+	skip_writing:
+		st->collected_entropy = bits;
+		st->n_bits_of_collected_entropy = unused_bits;
+		st->n_credit_bits_collected = unused_credit_bits;
+	}
 
-				int word;
-				if (format == SND_PCM_FORMAT_S16_LE)
-					word = (int)*(short int *)(input_buffer + loop + (channel * 2));
-				else
-					word = (int)__builtin_bswap16(*(short int *)(input_buffer + loop + (channel * 2)));
-
-				if (spike_threshold < 0)
-					word = -word;
-
-				if ((word > spike_threshold_int) &&
-				    (prev_sample[channel] < spike_threshold_int) &&
-				    (word - prev_sample[channel] > spike_edge_min_delta_int) &&
-				    (cur_sample_number - last_spike_at[channel] >= spike_minimum_interval_frames)) {
-					++total_events;
-					size_t sample_number_first_order_delta = cur_sample_number - last_spike_at[channel];
-					last_spike_at[channel] = cur_sample_number;
-					/* have to choose the number of bits from the first order delta,
-					 * because if it's taken directly from the second order delta,
-					 * that biases against runs of leading zeros in the latter,
-					 * which of course naturally occur.
-					 */
-					int n_sample_number_bits =
-						(int)(sizeof sample_number_first_order_delta * 8UL)
-						- (last_sample_number_first_order_delta[channel] ?
-						   (int)min(__builtin_clzl(sample_number_first_order_delta),
-						       __builtin_clzl(last_sample_number_first_order_delta[channel])) :
-						   (int)__builtin_clzl(sample_number_first_order_delta))
-						- 4;
-					if (n_sample_number_bits <= 0)
-						n_sample_number_bits = 1;
-					ssize_t sample_number_second_order_delta = (ssize_t)sample_number_first_order_delta - (ssize_t)last_sample_number_first_order_delta[channel];
-					last_sample_number_first_order_delta[channel] = sample_number_first_order_delta;
+	pthread_mutex_unlock(&st->lock);
+}
+
+/* --spike-onset-interpolation: weights of the cubic through samples -3..0
+ * at each step of the interval from sample -1 to sample 0.
+ */
+static void init_spike_onset_weights(void) {
+	const size_t n_steps = 1UL << spike_onset_fraction_bits;
+
+	spike_onset_weights = calloc(n_steps + 1, sizeof *spike_onset_weights);
+	if (! spike_onset_weights)
+		error_exit("problem allocating memory for the onset interpolation weights");
+
+	for (size_t step = 0; step <= n_steps; ++step) {
+		double t = -1.0 + (double)step / (double)n_steps;
+		for (int j = 0; j < SPIKE_EVENT_TAPS; ++j) {
+			double w = 1.0;
+			for (int k = 0; k < SPIKE_EVENT_TAPS; ++k) {
+				if (k != j)
+					w *= (t - (double)(k - 3)) / (double)(j - k);
+			}
+			spike_onset_weights[step][j] = w;
+		}
+	}
+}
+
+/* where between the last sub-threshold sample and the onset sample the
+ * threshold was crossed, in spike_onset_fraction_bits.  the cubic is
+ * bisected on its precomputed steps; without the earlier samples, there's
+ * only the straight line from the one to the other.
+ */
+static unsigned long spike_onset_fraction(const struct spike_event *ev) {
+	const double threshold = (double)ev->threshold;
+	const unsigned long n_steps = 1UL << spike_onset_fraction_bits;
+	double x[SPIKE_EVENT_TAPS];
+
+	for (int j = 0; j < SPIKE_EVENT_TAPS; ++j)
+		x[j] = (double)ev->samples[j];
+	if (! (ev->flags & SPIKE_EVENT_HISTORY)) {
+		double t = (threshold - x[2]) / (x[3] - x[2]);
+		unsigned long step = (unsigned long)(t * (double)n_steps);
+		return min(step, n_steps - 1);
+	}
+
+	unsigned long lo = 0, hi = n_steps;
+	while (hi - lo > 1) {
+		unsigned long mid = (lo + hi) / 2;
+		const double *w = spike_onset_weights[mid];
+		if (w[0] * x[0] + w[1] * x[1] + w[2] * x[2] + w[3] * x[3] > threshold)
+			hi = mid;
+		else
+			lo = mid;
+	}
+	return lo;
+}
+
+/* one event: derive its bits from the inter-spike interval and onset phase,
+ * and feed them to its channel's stream.
+ */
+static void spike_extract_event(struct spike_source *ss, const struct spike_event *ev) {
+	struct spike_stream *st = &ss->streams[ev->channel];
+
+	/* the first event after startup or a gap only starts an interval. */
+	if (ev->flags & SPIKE_EVENT_FIRST) {
+		st->last_event_frame = ev->frame;
+		st->last_sample_number_first_order_delta = 0;
+		st->prev_spike_prev_sample = ev->samples[2];
+		return;
+	}
+
+	size_t sample_number_first_order_delta = ev->frame - st->last_event_frame;
+	st->last_event_frame = ev->frame;
+	/* have to choose the number of bits from the first order delta,
+	 * because if it's taken directly from the second order delta,
+	 * that biases against runs of leading zeros in the latter,
+	 * which of course naturally occur.
+	 */
+	int n_sample_number_bits =
+		(int)(sizeof sample_number_first_order_delta * 8UL)
+		- (st->last_sample_number_first_order_delta ?
+		   (int)min(__builtin_clzl(sample_number_first_order_delta),
+		       __builtin_clzl(st->last_sample_number_first_order_delta)) :
+		   (int)__builtin_clzl(sample_number_first_order_delta))
+		- 4;
+	if (n_sample_number_bits <= 0)
+		n_sample_number_bits = 1;
+	ssize_t sample_number_second_order_delta = (ssize_t)sample_number_first_order_delta - (ssize_t)st->last_sample_number_first_order_delta;
+	st->last_sample_number_first_order_delta = sample_number_first_order_delta;
 
 #if 0
-					/* the sign bit is correlated, because the second order delta can't monotonically shrink or grow. */
-					/* always retain the sign bit, by moving it to the lsb. */
-					if (sample_number_second_order_delta < 0)
-						sample_number_second_order_delta = (sample_number_second_order_delta << 1UL) | 1UL;
-					else
-						sample_number_second_order_delta <<= 1UL;
+	/* the sign bit is correlated, because the second order delta can't monotonically shrink or grow. */
+	/* always retain the sign bit, by moving it to the lsb. */
+	if (sample_number_second_order_delta < 0)
+		sample_number_second_order_delta = (sample_number_second_order_delta << 1UL) | 1UL;
+	else
+		sample_number_second_order_delta <<= 1UL;
 #endif
 
-					/* get some phase information from the last below-threshold sample --
-					 * with the soundcard at 192k, and given a leading edge slew rate around
-					 * half of full scale for consecutive samples, suggests the lsb is sensitive
-					 * to perturbations under 1 ns (1 / (32767 * 192000) = 159 ps).
-					 * moving the sign bit to the lsb further aids sensitivity.
-					 *
-					 * technically this calls for sinc() interpolation, but that's overkill
-					 * for present purposes.
-					 */
-					int delta_of_prev_sample = prev_sample[channel] - prev_spike_prev_sample[channel];
-					prev_spike_prev_sample[channel] = prev_sample[channel];
+	/* get some phase information from the last below-threshold sample --
+	 * with the soundcard at 192k, and given a leading edge slew rate around
+	 * half of full scale for consecutive samples, suggests the lsb is sensitive
+	 * to perturbations under 1 ns (1 / (32767 * 192000) = 159 ps).
+	 * moving the sign bit to the lsb further aids sensitivity.
+	 *
+	 * for more, --spike-onset-interpolation adds the crossing time within
+	 * the sample to the lsbs -- uncredited, since it's a function of the
+	 * samples, and the lsbs of the last one are already in.
+	 */
+	long delta_of_prev_sample = ev->samples[2] - st->prev_spike_prev_sample;
+	st->prev_spike_prev_sample = ev->samples[2];
 
 #if 0
-					/* the sign bit is correlated, because the prev_sample can't monotonically shrink or grow. */
-					if (delta_of_prev_sample < 0)
-						delta_of_prev_sample = (delta_of_prev_sample << 1) | 1;
-					else
-						delta_of_prev_sample <<= 1;
+	/* the sign bit is correlated, because the prev_sample can't monotonically shrink or grow. */
+	if (delta_of_prev_sample < 0)
+		delta_of_prev_sample = (delta_of_prev_sample << 1) | 1;
+	else
+		delta_of_prev_sample <<= 1;
 #endif
 
-					ssize_t bits =
-						(sample_number_second_order_delta << spike_onset_sample_retained_bits) |
-						((size_t)delta_of_prev_sample & ((1UL << spike_onset_sample_retained_bits) - 1UL));
+	ssize_t bits =
+		(sample_number_second_order_delta << ss->onset_sample_retained_bits) |
+		((size_t)delta_of_prev_sample & ((1UL << ss->onset_sample_retained_bits) - 1UL));
 
 //					unsigned n_bits = (sizeof bits * 8UL) - __builtin_clzl((bits > 0) ? bits : -bits);
 //					++n_bits; /* keep the sign bit. */
 
-					unsigned n_bits = (unsigned)n_sample_number_bits + spike_onset_sample_retained_bits;
-
-					if (spike_test_mode)
-						printf("%zd 0x%zx bits=%u(=%u+%u) 1st=%zu 2nd=%zd prev=%d this=%d prev_delta=%d (0x%lx, %d bit%s)\n",bits,bits & ((1UL << n_bits) - 1UL), n_bits, n_sample_number_bits, spike_onset_sample_retained_bits, sample_number_first_order_delta, sample_number_second_order_delta, prev_sample[channel], word, delta_of_prev_sample, ((size_t)delta_of_prev_sample & ((1UL << (size_t)spike_onset_sample_retained_bits) - 1UL)), spike_onset_sample_retained_bits, spike_onset_sample_retained_bits == 1 ? "" : "s");
-
-					++log_cum_counts[channel];
-					log_cum_ISI_hz[channel] += (long double)sample_rate / (long double)sample_number_first_order_delta;
-
-					total_popcount += __builtin_popcountl(bits & ((1UL << n_bits) - 1UL));
-					total_retained_bits += n_bits;
-
-					int unused_bits = 0;
-					if (n_bits_of_collected_entropy + n_bits > (sizeof(collected_entropy) * 8UL)) {
-						unused_bits = (n_bits_of_collected_entropy + n_bits) - (sizeof(collected_entropy) * 8UL);
-						n_bits -= unused_bits;
-					}
-
-					collected_entropy <<= n_bits;
-					collected_entropy |= ((bits >> unused_bits) & ((1UL << n_bits) - 1UL));
-					n_bits_of_collected_entropy += n_bits;
-					if (n_bits_of_collected_entropy >= (sizeof(collected_entropy) * 8UL)) {
-						size_t this_byte_sum = 0;
-						for (size_t b=0; b<sizeof collected_entropy * 8UL; b += 8UL) {
-							size_t this_byte = (size_t)(collected_entropy >> b) & 0xffUL;
-							this_byte_sum += this_byte;
-							++chisquare_bins[this_byte];
-							if (this_byte == 0xffUL)
-								++n_all_ones;
-							else if (this_byte == 0x0UL)
-								++n_all_zeros;
-						}
-						total_byte_sum += this_byte_sum;
-						total_byte_sum_denom += sizeof collected_entropy;
-						int popcount = __builtin_popcountl((unsigned long)collected_entropy) + __builtin_popcountl((unsigned long)(collected_entropy >> 64UL));
-						if (spike_test_mode) {
-							double avg = (double)this_byte_sum / (double)sizeof collected_entropy;
-							printf("emitting %d bits, popcount %d, avg %.1f, %d bit%s left over; Bcum %f%% (%+.1fsd), Acum %.3f (%+.1fsd))\n",
-							       n_bits_of_collected_entropy,
-							       popcount,
-							       avg,
-							       unused_bits,
-							       unused_bits == 1 ? "" : "s",
-							       100.0 * (double)total_popcount / (double)total_retained_bits,
-							       ((double)total_popcount - ((double)total_retained_bits * 0.5)) / sqrt(0.25 * (double)total_retained_bits),
-							       (double)total_byte_sum / (double)total_byte_sum_denom,
-							       (((double)total_byte_sum / 255.0) - ((double)total_byte_sum_denom * 0.5)) / sqrt((double)total_byte_sum_denom / 12.0)  /* Irwin-Hall dist */
-								);
-						}
-
-						/* set an AES key with random data, then discard the data. */
-						if (! aes_ctx.aes_Nkey) {
-							aes_set_key(&aes_ctx, (const unsigned char *)&collected_entropy, (int)sizeof collected_entropy, 0);
-							goto skip_writing;
-						}
-						/* set an IV with random data, then discard the data. */
-						if (! last_collected_entropy) {
-							last_collected_entropy = collected_entropy;
-							goto skip_writing;
-						}
-
-						if (raw_out_file)
-							maybe_reopen_raw_out_file();
-						if (raw_out_file) {
-							/*
-							 * write out the raw entropy with no whitening at all, for cryptoanalytic evaluation.
-							 *
-							 * do cursory evaluation of output file using an entropy analyzer, e.g.
-							 * http://www.fourmilab.ch/random/
-							 * or
-							 * http://webhome.phy.duke.edu/~rgb/General/dieharder.php
-							 */
-							if (fwrite(&collected_entropy, 1UL, sizeof collected_entropy, raw_out_file) != sizeof collected_entropy) {
-								dolog(LOG_CRIT, "%s: %m", file);
-								(void)fclose(raw_out_file);
-								raw_out_file = 0;
-							} else
-								fflush(raw_out_file);
-						}
-						if (! spike_test_mode) {
-							/* CBC mode with random key and IV set above. */
-							collected_entropy ^= last_collected_entropy;
-							aes_encrypt(&aes_ctx, (const unsigned char *)&collected_entropy, (unsigned char *)output->buf);
-							output->entropy_count = (int)(sizeof collected_entropy * 8UL);
-							output->buf_size      = (int)sizeof collected_entropy;
-							if (ioctl(random_fd, RNDADDENTROPY, output) < 0)
-								error_exit("RNDADDENTROPY for fd %d failed in %s!",random_fd,__FUNCTION__);
-							/* why RNDADDENTROPY doesn't credit it is a mystery, but a fact... */
-							if (ioctl(random_fd, RNDADDTOENTCNT, &output->entropy_count) < 0)
-								error_exit("RNDADDTOENTCNT %d for fd %d failed in %s!",output->entropy_count,random_fd,__FUNCTION__);
-						}
-
-						last_collected_entropy = collected_entropy;
-
-					skip_writing:
-						collected_entropy = bits;
-						n_bits_of_collected_entropy = unused_bits;
-					}
+	unsigned n_bits = (unsigned)n_sample_number_bits + ss->onset_sample_retained_bits;
+	unsigned n_credit_bits = n_bits;
+
+	unsigned long onset_fraction = 0;
+	if (spike_onset_fraction_bits) {
+		onset_fraction = spike_onset_fraction(ev);
+		bits = (ssize_t)(((size_t)bits << spike_onset_fraction_bits) | onset_fraction);
+		n_bits = min(n_bits + (unsigned)spike_onset_fraction_bits, (unsigned)(sizeof bits * 8UL) - 1U);
+		n_credit_bits = n_bits - (unsigned)spike_onset_fraction_bits;
+	}
+
+	if (spike_test_mode)
+		printf("%zd 0x%zx bits=%u(=%u+%u%s) 1st=%zu 2nd=%zd prev=%ld this=%ld prev_delta=%ld (0x%lx, %d bit%s)\n",bits,bits & ((1UL << n_bits) - 1UL), n_bits, n_sample_number_bits, ss->onset_sample_retained_bits, spike_onset_fraction_bits ? "+fraction" : "", sample_number_first_order_delta, sample_number_second_order_delta, ev->samples[2], ev->samples[3], delta_of_prev_sample, ((size_t)delta_of_prev_sample & ((1UL << (size_t)ss->onset_sample_retained_bits) - 1UL)), ss->onset_sample_retained_bits, ss->onset_sample_retained_bits == 1 ? "" : "s");
+	if (spike_test_mode && spike_onset_fraction_bits)
+		printf("onset fraction 0x%lx (%d bit%s)\n", onset_fraction, spike_onset_fraction_bits, spike_onset_fraction_bits == 1 ? "" : "s");
+
+	spike_emit_bits(ss, (int)ev->channel, sample_number_first_order_delta, bits, n_bits, n_credit_bits);
+}
+
+/* the second stage: the period's events, in the order they were detected. */
+static void spike_extract_events(struct spike_source *ss) {
+	for (size_t i = 0; i < ss->n_events; ++i)
+		spike_extract_event(ss, &ss->events[i]);
+	ss->n_events = 0;
+
+	for (unsigned int i = 0; i < ss->n_scan_channels; ++i) {
+		struct spike_stream *st = &ss->streams[ss->scan_channels[i]];
+
+		pthread_mutex_lock(&st->lock);
+		spike_whiten(st);
+		pthread_mutex_unlock(&st->lock);
+	}
+}
+
+/* an onset: note it for extraction, with the samples leading up to it. */
+static void __attribute__((noinline)) spike_detected(struct spike_source *ss, unsigned int channel, long word, const char *sample) {
+	/* a pulse's peak is known once the next one starts. */
+	if (spike_auto_calibrate && ss->pulse_peak[channel]) {
+		struct spike_calibration *cal = &ss->cal[channel];
+		if (cal->n_pulses++)
+			cal->pulse_height += SPIKE_CALIBRATION_HEIGHT_WEIGHT * ((double)ss->pulse_peak[channel] - cal->pulse_height);
+		else
+			cal->pulse_height = (double)ss->pulse_peak[channel];
+	}
+	ss->pulse_peak[channel] = word;
+
+	if (ss->n_events == SPIKE_EVENTS_PER_BATCH)
+		spike_extract_events(ss);
+
+	struct spike_event *ev = &ss->events[ss->n_events++];
+	ev->channel = channel;
+	ev->flags = ss->have_last_spike[channel] ? 0 : SPIKE_EVENT_FIRST;
+	ev->frame = ss->cur_sample_number;
+	ev->threshold = ss->threshold[channel];
+	ev->samples[2] = ss->prev_sample[channel];
+	ev->samples[3] = word;
+	if (spike_onset_fraction_bits) {
+		const size_t frame_bytes = ss->cs->in.frame_bytes;
+		const long frame = (long)((size_t)(sample - ss->chunk_begin) / frame_bytes);
+
+		/* from the chunk, or before it, back as far as the last gap */
+		if (frame + (long)ss->n_history >= SPIKE_EVENT_TAPS - 1) {
+			for (int j = 0; j < 2; ++j) {
+				long at = frame - (SPIKE_EVENT_TAPS - 1 - j);
+				if (at < 0) {
+					ev->samples[j] = ss->history[channel][SPIKE_EVENT_TAPS - 1 + at];
+					continue;
 				}
-				prev_sample[channel] = word;
+				long earlier = ss->load(sample - (size_t)(SPIKE_EVENT_TAPS - 1 - j) * frame_bytes);
+				ev->samples[j] = spike_threshold < 0 ? -earlier : earlier;
 			}
+			ev->flags |= SPIKE_EVENT_HISTORY;
 		}
 	}
+
+	ss->have_last_spike[channel] = 1;
+	ss->last_spike_at[channel] = ss->cur_sample_number;
+}
+
+static inline __attribute__((always_inline)) void spike_sample(struct spike_source *ss, unsigned int channel, const char *sample, long word, int negative) {
+	if (negative)
+		word = -word;
+
+	if (word > ss->threshold[channel]) {
+		if ((ss->prev_sample[channel] < ss->threshold[channel]) &&
+		    (word - ss->prev_sample[channel] > ss->edge_min_delta[channel]) &&
+		    (ss->cur_sample_number - ss->last_spike_at[channel] >= spike_minimum_interval_frames))
+			spike_detected(ss, channel, word, sample);
+		else if (word > ss->pulse_peak[channel])
+			ss->pulse_peak[channel] = word;
+	}
+	ss->prev_sample[channel] = word;
+}
+
+/* frames went missing before the next ones: keep the sample clock true,
+ * and don't let any interval or onset span the gap.
+ */
+static void spike_timeline_gap(struct spike_source *ss, snd_pcm_uframes_t n_frames) {
+	ss->cur_sample_number += n_frames;
+	for (unsigned int channel = 0; channel < MAX_CHANNELS; ++channel) {
+		ss->have_last_spike[channel] = 0;
+		ss->prev_sample[channel] = LONG_MAX;
+		ss->pulse_peak[channel] = 0;
+	}
+	ss->n_history = 0;
+}
+
+/* after a chunk is scanned: keep its last frames, for an onset early in
+ * the next one, wherever the chunks happen to be cut.
+ */
+static void spike_keep_history(struct spike_source *ss, const char *frames, snd_pcm_uframes_t n_frames) {
+	const size_t frame_bytes = ss->cs->in.frame_bytes, sample_bytes = frame_bytes / ss->cs->in.channels;
+	const unsigned int n_keep = (unsigned int)min(n_frames, (snd_pcm_uframes_t)(SPIKE_EVENT_TAPS - 1));
+
+	if (! spike_onset_fraction_bits || ! n_keep)
+		return;
+	for (unsigned int i = 0; i < ss->n_scan_channels; ++i) {
+		const unsigned int channel = ss->scan_channels[i];
+		long *h = ss->history[channel];
+
+		memmove(h, h + n_keep, (SPIKE_EVENT_TAPS - 1 - n_keep) * sizeof *h);
+		for (unsigned int k = 0; k < n_keep; ++k) {
+			long word = ss->load(frames + (n_frames - n_keep + k) * frame_bytes + channel * sample_bytes);
+			h[SPIKE_EVENT_TAPS - 1 - n_keep + k] = spike_threshold < 0 ? -word : word;
+		}
+	}
+	ss->n_history = min(ss->n_history + n_keep, (unsigned int)(SPIKE_EVENT_TAPS - 1));
+}
+
+/* scan n_frames interleaved frames for spike onsets.  a kernel is
+ * specialized for a channel count nch (0 for any), a polarity, and whether
+ * every channel is in the mask; otherwise it walks the masked channels'
+ * list.  nothing that's fixed at startup is tested per sample.
+ */
+#define SPIKE_NEGATIVE_pos	0
+#define SPIKE_NEGATIVE_neg	1
+#define SPIKE_ALL_CHANNELS_all	1
+#define SPIKE_ALL_CHANNELS_some	0
+
+#define DEFINE_SPIKE_SCAN_KERNEL(fmt, bytes, nch, pol, chans)							\
+static void spike_scan_##fmt##_##nch##_##pol##_##chans(struct spike_source *ss, const char *frames, snd_pcm_uframes_t n_frames) { \
+	const unsigned int channels = (nch) ? (nch) : ss->cs->in.channels;						\
+	const unsigned int n_scan = SPIKE_ALL_CHANNELS_##chans ? channels : ss->n_scan_channels;		\
+	const size_t frame_bytes = (size_t)(bytes) * channels;							\
+														\
+	for (snd_pcm_uframes_t loop = 0; loop < n_frames; ++loop, frames += frame_bytes, ++ss->cur_sample_number) { \
+		for (unsigned int i = 0; i < n_scan; ++i) {							\
+			const unsigned int channel = SPIKE_ALL_CHANNELS_##chans ? i : ss->scan_channels[i];	\
+			const char *sample = frames + channel * (bytes);					\
+			spike_sample(ss, channel, sample, LOAD_##fmt(sample), SPIKE_NEGATIVE_##pol);		\
+		}												\
+	}													\
+}
+
+#define DEFINE_SPIKE_SCAN_KERNELS_NCH(fmt, bytes, nch)	\
+	DEFINE_SPIKE_SCAN_KERNEL(fmt, bytes, nch, pos, all)	\
+	DEFINE_SPIKE_SCAN_KERNEL(fmt, bytes, nch, pos, some)	\
+	DEFINE_SPIKE_SCAN_KERNEL(fmt, bytes, nch, neg, all)	\
+	DEFINE_SPIKE_SCAN_KERNEL(fmt, bytes, nch, neg, some)
+#define DEFINE_SPIKE_SCAN_KERNELS(fmt, bytes, bits)	\
+	DEFINE_SPIKE_SCAN_KERNELS_NCH(fmt, bytes, 1)	\
+	DEFINE_SPIKE_SCAN_KERNELS_NCH(fmt, bytes, 2)	\
+	DEFINE_SPIKE_SCAN_KERNELS_NCH(fmt, bytes, 4)	\
+	DEFINE_SPIKE_SCAN_KERNELS_NCH(fmt, bytes, 8)	\
+	DEFINE_SPIKE_SCAN_KERNELS_NCH(fmt, bytes, 0)
+SAMPLE_FORMATS(DEFINE_SPIKE_SCAN_KERNELS)
+
+/* --spike-benchmark: the loop before specialization, testing the channel
+ * mask and the polarity for every sample.
+ */
+#define DEFINE_SPIKE_SCAN_GENERIC(fmt, bytes, bits)								\
+static void spike_scan_##fmt##_generic(struct spike_source *ss, const char *frames, snd_pcm_uframes_t n_frames) { \
+	const unsigned int channels = ss->cs->in.channels;							\
+	const size_t frame_bytes = (size_t)(bytes) * channels;							\
+														\
+	for (snd_pcm_uframes_t loop = 0; loop < n_frames; ++loop, frames += frame_bytes, ++ss->cur_sample_number) { \
+		for (unsigned int channel = 0; channel < channels; ++channel) {					\
+			if (! (spike_channel_mask & (1U << channel)))						\
+				continue;									\
+			const char *sample = frames + channel * (bytes);					\
+			spike_sample(ss, channel, sample, LOAD_##fmt(sample), spike_threshold < 0);		\
+		}												\
+	}													\
+}
+SAMPLE_FORMATS(DEFINE_SPIKE_SCAN_GENERIC)
+
+/* only frames with a sample above threshold can start or extend a pulse;
+ * the rest just become the previous frame.  so skip to the next of those
+ * with the pre-scan, and run the scalar kernel on it and the frame before.
+ */
+static void spike_scan_prescan(struct spike_source *ss, const char *frames, snd_pcm_uframes_t n_frames) {
+	const size_t frame_bytes = ss->cs->in.frame_bytes;
+	snd_pcm_uframes_t pos = 0;
+
+	/* the thresholds only move between periods */
+	spike_prescan_set_thresholds(&ss->prescan, ss->threshold, spike_channel_mask);
+
+	while (pos < n_frames) {
+		snd_pcm_uframes_t next = pos + ss->prescan.find(&ss->prescan, frames + pos * frame_bytes, n_frames - pos);
+
+		if (next > pos) {
+			ss->cur_sample_number += next - pos - 1;
+			ss->scan_scalar(ss, frames + (next - 1) * frame_bytes, 1);
+		}
+		if (next == n_frames)
+			break;
+		ss->scan_scalar(ss, frames + next * frame_bytes, 1);
+		pos = next + 1;
+	}
+}
+
+#define SPIKE_SCAN_KERNELS_NCH(fmt, nch)	\
+	{ { spike_scan_##fmt##_##nch##_pos_some, spike_scan_##fmt##_##nch##_pos_all }, { spike_scan_##fmt##_##nch##_neg_some, spike_scan_##fmt##_##nch##_neg_all } }
+
+/* the kernel for the masked channels of ss's source, or with generic, the
+ * unspecialized one
+ */
+static spike_scan_kernel_t select_spike_scan_kernel(const struct spike_source *ss, int generic) {
+	static const struct {
+		snd_pcm_format_t format;
+		spike_scan_kernel_t kernels[5][2][2];	/* [channels][negative][all channels] */
+		spike_scan_kernel_t generic;
+	} spike_scan_kernels[] = {
+#define X(fmt, bytes, bits) { SND_PCM_FORMAT_##fmt, { SPIKE_SCAN_KERNELS_NCH(fmt, 1), SPIKE_SCAN_KERNELS_NCH(fmt, 2), SPIKE_SCAN_KERNELS_NCH(fmt, 4), SPIKE_SCAN_KERNELS_NCH(fmt, 8), SPIKE_SCAN_KERNELS_NCH(fmt, 0) }, spike_scan_##fmt##_generic },
+		SAMPLE_FORMATS(X)
+#undef X
+	};
+	const snd_pcm_format_t format = ss->cs->in.format;
+	const unsigned int channels = ss->cs->in.channels;
+
+	for (size_t i = 0; i < sizeof spike_scan_kernels / sizeof spike_scan_kernels[0]; ++i) {
+		if (spike_scan_kernels[i].format != format)
+			continue;
+		if (generic)
+			return spike_scan_kernels[i].generic;
+		return spike_scan_kernels[i].kernels[kernel_channels_index(channels)][spike_threshold < 0][ss->n_scan_channels == channels];
+	}
+	error_exit("no spike scan kernel for %s", snd_pcm_format_name(format));
+	return NULL;
+}
+
+/* put the pre-scan in front of the scan kernel, for the layouts it handles */
+static void select_spike_prescan(struct spike_source *ss) {
+	static const struct {
+		snd_pcm_format_t format;
+		enum spike_prescan_kind kind;
+	} prescan_kinds[] = {
+		{ SND_PCM_FORMAT_S16_LE, SPIKE_PRESCAN_S16_LE },
+		{ SND_PCM_FORMAT_S16_BE, SPIKE_PRESCAN_S16_BE },
+		{ SND_PCM_FORMAT_S24_LE, SPIKE_PRESCAN_S24_LE },
+		{ SND_PCM_FORMAT_S32_LE, SPIKE_PRESCAN_S32_LE },
+	};
+
+	for (size_t i = 0; i < sizeof prescan_kinds / sizeof prescan_kinds[0]; ++i) {
+		const char *name = NULL;
+
+		if (prescan_kinds[i].format != ss->cs->in.format ||
+		    !spike_prescan_init(&ss->prescan, prescan_kinds[i].kind, ss->cs->in.channels, spike_threshold < 0, &name))
+			continue;
+		ss->scan_scalar = ss->scan;
+		ss->scan = spike_scan_prescan;
+		if (verbose)
+			dolog(LOG_DEBUG, "%s: %s spike pre-scan", ss->cs->in.name, name);
+		return;
+	}
+}
+
+#define DEFINE_SPIKE_LOAD(fmt, bytes, bits)	\
+static long spike_load_##fmt(const char *p) { return LOAD_##fmt(p); }
+SAMPLE_FORMATS(DEFINE_SPIKE_LOAD)
+
+static spike_load_t select_spike_load(snd_pcm_format_t format) {
+	static const struct {
+		snd_pcm_format_t format;
+		spike_load_t load;
+	} spike_loads[] = {
+#define X(fmt, bytes, bits) { SND_PCM_FORMAT_##fmt, spike_load_##fmt },
+		SAMPLE_FORMATS(X)
+#undef X
+	};
+
+	for (size_t i = 0; i < sizeof spike_loads / sizeof spike_loads[0]; ++i) {
+		if (spike_loads[i].format == format)
+			return spike_loads[i].load;
+	}
+	error_exit("no spike sample loader for %s", snd_pcm_format_name(format));
+	return NULL;
+}
+
+static void select_spike_kernels(struct spike_source *ss) {
+	ss->n_scan_channels = 0;
+	for (unsigned int channel = 0; channel < ss->cs->in.channels; ++channel) {
+		if (spike_channel_mask & (1U << channel))
+			ss->scan_channels[ss->n_scan_channels++] = channel;
+	}
+	ss->scan = select_spike_scan_kernel(ss, 0);
+	select_spike_prescan(ss);
+	ss->load = select_spike_load(ss->cs->in.format);
+}
+
+/* --spike-benchmark: ns per sample through each stage of specialization,
+ * for every format at 1, 2, 4 and 8 channels.  the samples are silence,
+ * which is what the scan sees nearly all the time.
+ */
+static double time_spike_scan(struct spike_source *ss, const char *frames, snd_pcm_uframes_t n_frames) {
+	struct timespec start, now;
+	double elapsed;
+	size_t n_runs = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		ss->scan(ss, frames, n_frames);
+		++n_runs;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (double)(now.tv_sec - start.tv_sec) + (double)(now.tv_nsec - start.tv_nsec) / 1e9;
+	} while (elapsed < 0.1);
+
+	return elapsed * 1e9 / ((double)n_runs * (double)n_frames * ss->cs->in.channels);
+}
+
+static void run_spike_benchmark(void) {
+	static const struct {
+		snd_pcm_format_t format;
+		size_t bytes;
+		int bits;
+	} formats[] = {
+#define X(fmt, bytes, bits) { SND_PCM_FORMAT_##fmt, bytes, bits },
+		SAMPLE_FORMATS(X)
+#undef X
+	};
+	static const unsigned int channel_counts[] = { 1, 2, 4, 8 };
+	const snd_pcm_uframes_t n_frames = 65536;
+	char *frames = calloc(n_frames * 8, 4);
+
+	if (! frames)
+		error_exit("problem allocating memory for the spike benchmark");
+
+	printf("spike scan, ns per sample (mask 0x%x, %s-going spikes)\n", spike_channel_mask, spike_threshold < 0 ? "negative" : "positive");
+	printf("%-20s  %7s  %11s  %8s\n", "", "generic", "specialized", "pre-scan");
+	for (size_t f = 0; f < sizeof formats / sizeof formats[0]; ++f) {
+		for (size_t c = 0; c < sizeof channel_counts / sizeof channel_counts[0]; ++c) {
+			static struct capture_source cs;
+			static struct spike_source ss;
+			long full_scale = (1L << (formats[f].bits - 1)) - 1L;
+			double generic, specialized, prescan = 0;
+
+			memset(&ss, 0, sizeof ss);
+			cs.in.name = "benchmark";
+			cs.in.format = formats[f].format;
+			cs.in.channels = channel_counts[c];
+			cs.in.frame_bytes = formats[f].bytes * channel_counts[c];
+			ss.cs = &cs;
+			for (unsigned int channel = 0; channel < MAX_CHANNELS; ++channel) {
+				ss.threshold[channel] = (long)((fabs(spike_threshold) / 100.0) * (double)full_scale);
+				ss.edge_min_delta[channel] = (long)((spike_edge_min_delta / 100.0) * (double)full_scale);
+			}
+
+			select_spike_kernels(&ss);
+			ss.chunk_begin = frames;
+			if (ss.scan_scalar) {
+				prescan = time_spike_scan(&ss, frames, n_frames);
+				ss.scan = ss.scan_scalar;
+			}
+			specialized = time_spike_scan(&ss, frames, n_frames);
+			ss.scan = select_spike_scan_kernel(&ss, 1);
+			generic = time_spike_scan(&ss, frames, n_frames);
+
+			printf("%-9s %u channel%s  %7.3f  %11.3f", snd_pcm_format_name(formats[f].format), channel_counts[c], channel_counts[c] == 1 ? " " : "s", generic, specialized);
+			if (prescan > 0)
+				printf("  %8.3f", prescan);
+			printf("\n");
+		}
+	}
+	free(frames);
+}
+
+/* fold a sparse sample of each channel's sub-threshold samples into its
+ * noise floor estimate.
+ */
+#define DEFINE_SPIKE_NOISE_KERNEL(fmt, bytes, bits)								\
+static void spike_noise_##fmt(struct spike_source *ss, const char *frames, snd_pcm_uframes_t n_frames) {	\
+	const unsigned int channels = ss->cs->in.channels;							\
+	const size_t frame_bytes = (size_t)(bytes) * channels;							\
+	const snd_pcm_uframes_t stride = n_frames / SPIKE_CALIBRATION_NOISE_SAMPLES + 1;			\
+														\
+	for (unsigned int channel = 0; channel < channels; ++channel) {						\
+		struct spike_calibration *cal = &ss->cal[channel];						\
+		double sum = 0, sum_sq = 0;									\
+		size_t n = 0;											\
+														\
+		if (! (spike_channel_mask & (1U << channel)))							\
+			continue;										\
+		for (snd_pcm_uframes_t f = 0; f < n_frames; f += stride) {					\
+			long word = LOAD_##fmt(frames + f * frame_bytes + channel * (bytes));			\
+			if (spike_threshold < 0)								\
+				word = -word;									\
+			if (word > ss->threshold[channel])							\
+				continue;									\
+			sum += (double)word;									\
+			sum_sq += (double)word * (double)word;							\
+			++n;											\
+		}												\
+		if (! n)											\
+			continue;										\
+		double mean = sum / (double)n, var = sum_sq / (double)n - mean * mean;				\
+		if (cal->have_noise) {										\
+			cal->baseline += SPIKE_CALIBRATION_NOISE_WEIGHT * (mean - cal->baseline);		\
+			cal->noise_var += SPIKE_CALIBRATION_NOISE_WEIGHT * (var - cal->noise_var);		\
+		} else {											\
+			cal->baseline = mean;									\
+			cal->noise_var = var;									\
+			cal->have_noise = 1;									\
+		}												\
+	}													\
+}
+SAMPLE_FORMATS(DEFINE_SPIKE_NOISE_KERNEL)
+
+static spike_noise_kernel_t select_spike_noise_kernel(snd_pcm_format_t format) {
+	switch (format) {
+#define X(fmt, bytes, bits) case SND_PCM_FORMAT_##fmt: return spike_noise_##fmt;
+	SAMPLE_FORMATS(X)
+#undef X
+	default:
+		error_exit("no spike noise kernel for %s", snd_pcm_format_name(format));
+		return NULL;
+	}
+}
+
+static long clamp_long(long x, const long bounds[2]) {
+	return x < bounds[0] ? bounds[0] : x > bounds[1] ? bounds[1] : x;
+}
+
+/* move each channel's threshold to clear its noise floor and sit partway
+ * up its pulses, and its edge delta with it.
+ */
+static void spike_calibrate(struct spike_source *ss, const char *on_device) {
+	const double percent = 100.0 / (double)ss->full_scale;
+	const long hysteresis = (long)(SPIKE_CALIBRATION_HYSTERESIS / percent);
+
+	for (unsigned int channel = 0; channel < ss->cs->in.channels; ++channel) {
+		struct spike_calibration *cal = &ss->cal[channel];
+
+		if (! (spike_channel_mask & (1U << channel)) || ! cal->have_noise)
+			continue;
+
+		double noise_sd = sqrt(max(cal->noise_var, 0.0));
+		double target = cal->baseline + SPIKE_CALIBRATION_NOISE_SIGMAS * noise_sd;
+		if (cal->n_pulses >= SPIKE_CALIBRATION_MIN_PULSES)
+			target = max(target, cal->baseline + SPIKE_CALIBRATION_HEIGHT_FRACTION * (cal->pulse_height - cal->baseline));
+
+		long threshold = clamp_long(lround(target), ss->threshold_bounds);
+		long edge_min_delta = clamp_long(lround(SPIKE_CALIBRATION_EDGE_FRACTION * ((double)threshold - cal->baseline)), ss->edge_min_delta_bounds);
+
+		if ((labs(threshold - ss->threshold[channel]) <= hysteresis) &&
+		    (labs(edge_min_delta - ss->edge_min_delta[channel]) <= hysteresis))
+			continue;
+
+		post_to_spike_log_file("CALIBRATE%s ch=%u threshold=%.2f%%->%.2f%% edge=%.2f%%->%.2f%% baseline=%+.3f%% noise=%.3f%% height=%.2f%% pulses=%zu\n",
+				       on_device, channel,
+				       (double)ss->threshold[channel] * percent, (double)threshold * percent,
+				       (double)ss->edge_min_delta[channel] * percent, (double)edge_min_delta * percent,
+				       cal->baseline * percent, noise_sd * percent,
+				       cal->n_pulses ? cal->pulse_height * percent : 0.0, cal->n_pulses);
+		if (verbose)
+			dolog(LOG_INFO, "channel %u%s: threshold %.2f%%, edge delta %.2f%%", channel, on_device,
+			      (double)threshold * percent, (double)edge_min_delta * percent);
+		ss->threshold[channel] = threshold;
+		ss->edge_min_delta[channel] = edge_min_delta;
+	}
+}
+
+static void *spike_source_loop(void *arg) {
+	struct spike_source *ss = (struct spike_source *)arg;
+	struct capture_source *cs = ss->cs;
+	int sample_rate = ss->sample_rate;
+	size_t idle_warning_n_samples = SPIKE_IDLE_WARNING_SECONDS * (size_t)sample_rate;
+	size_t spike_log_interval_samples = (size_t)round(spike_log_interval_seconds * (double)sample_rate);
+	size_t next_log_at = spike_log_interval_samples;
+	int process_samples = sample_rate / 4;
+	char on_device[64] = "";
+
+	if (n_cdevices > 1)
+		snprintf(on_device, sizeof on_device, " on %s", cs->in.name);
+
+	for (;;) {
+		int idle = 1;
+		for (unsigned int channel = 0; channel < cs->in.channels; ++channel) {
+			if ((spike_channel_mask & (1U << channel)) &&
+			    (ss->cur_sample_number - ss->last_spike_at[channel] <= idle_warning_n_samples)) {
+				idle = 0;
+				break;
+			}
+		}
+		if (idle) {
+			if (! ss->last_idle_warning_at) {
+				ss->last_idle_warning_at = ss->cur_sample_number;
+				dolog(LOG_ERR, "no spikes detected in %d seconds%s.", SPIKE_IDLE_WARNING_SECONDS, on_device);
+				if (spike_log_file)
+					post_to_spike_log_file("OUTAGE -- no spikes for %d s%s.\n", SPIKE_IDLE_WARNING_SECONDS, on_device);
+			}
+		} else {
+			if (ss->last_idle_warning_at) {
+				double outage_duration = ((double)(ss->cur_sample_number - ss->last_idle_warning_at) / (double)sample_rate) + (double)SPIKE_IDLE_WARNING_SECONDS;
+				if (spike_log_file)
+					post_to_spike_log_file("RESUMED -- spike(s) detected%s after %.1f s outage.\n", on_device, outage_duration);
+				dolog(LOG_ERR, "spikes resumed%s after %.1f second outage.", on_device, outage_duration);
+				ss->last_idle_warning_at = 0;
+			}
+		}
+
+		if (spike_log_file && (ss->index == 0) && (ss->cur_sample_number >= next_log_at)) { /* because of lumpiness in the reading, there will be jitter here. */
+			next_log_at += spike_log_interval_samples;
+			spike_log_stats(ss);
+		}
+
+		/* in mmap mode, input_frames points straight into the ring buffer. */
+		const char *input_frames;
+		snd_pcm_uframes_t input_offset;
+		snd_pcm_uframes_t frames_read = capture_begin(cs, process_samples * 2, 1, &input_frames, &input_offset);
+		snd_pcm_uframes_t gap = capture_take_gap(cs);
+
+		if (gap)
+			spike_timeline_gap(ss, gap);
+
+		ss->chunk_begin = input_frames;
+		ss->scan(ss, input_frames, frames_read);
+		spike_keep_history(ss, input_frames, frames_read);
+		spike_extract_events(ss);
+
+		if (spike_auto_calibrate) {
+			ss->noise(ss, input_frames, frames_read);
+			if (ss->cur_sample_number >= ss->next_calibration_at) {
+				ss->next_calibration_at = ss->cur_sample_number + SPIKE_CALIBRATION_INTERVAL_SECONDS * (size_t)sample_rate;
+				spike_calibrate(ss, on_device);
+			}
+		}
+
+		if (! spike_test_mode)
+			krng_batch_poll(&krng_out);
+
+		capture_commit(cs, input_offset, frames_read);
+	}
+	__builtin_unreachable();
+	return NULL;
+}
+
+static void seed_continually_with_random_spike_data(int sample_rate, int skip_samples) {
+	struct spike_output *so = &spike_out;
+
+	if (file) {
+		so->raw_out_file = fopen(file, "a+");
+		if (! so->raw_out_file)
+			error_exit("error accessing file %s", file);
+	}
+
+	for (int s = 0; s < n_cdevices; ++s) {
+		struct spike_source *ss = &spike_sources[s];
+		open_capture(&sources[s], cdevices[s], sample_rate, skip_samples);
+		ss->cs = &sources[s];
+		ss->index = s;
+		ss->sample_rate = (int)sources[s].in.rate;	/* as negotiated */
+
+		/* the thresholds are percentages of full scale, whatever the format.
+		 * the discarded onset msbs grow with the sample width, so every
+		 * format retains the same resolution relative to full scale.
+		 * auto-calibration retains what its lowest threshold allows.
+		 */
+		long full_scale = (1L << (sources[s].in.sample_bits - 1)) - 1L;
+		long threshold = (long)((fabs(spike_threshold) / 100.0) * (double)full_scale);
+		long edge_min_delta = (long)((spike_edge_min_delta / 100.0) * (double)full_scale);
+		ss->full_scale = full_scale;
+		if (spike_auto_calibrate) {
+			for (int i = 0; i < 2; ++i) {
+				ss->threshold_bounds[i] = max((long)((spike_threshold_bounds[i] / 100.0) * (double)full_scale), 1L);
+				ss->edge_min_delta_bounds[i] = (spike_edge_min_delta_bounds[0] < 0) ? edge_min_delta :
+					(long)((spike_edge_min_delta_bounds[i] / 100.0) * (double)full_scale);
+			}
+			threshold = clamp_long(threshold, ss->threshold_bounds);
+			edge_min_delta = clamp_long(edge_min_delta, ss->edge_min_delta_bounds);
+			ss->noise = select_spike_noise_kernel(sources[s].in.format);
+		}
+		for (unsigned int channel = 0; channel < MAX_CHANNELS; ++channel) {
+			ss->threshold[channel] = threshold;
+			ss->edge_min_delta[channel] = edge_min_delta;
+		}
+		ss->onset_sample_retained_bits = (int)(sizeof(long) * 8UL) - __builtin_clzl(spike_auto_calibrate ? ss->threshold_bounds[0] : threshold) + 1
+			- SPIKE_ONSET_SAMPLE_DISCARD_MSBS - (sources[s].in.sample_bits - 16);
+		if (ss->onset_sample_retained_bits < 0)
+			ss->onset_sample_retained_bits = 0;
+		select_spike_kernels(ss);
+		for (unsigned int channel = 0; channel < MAX_CHANNELS; ++channel) {
+			struct spike_stream *st = &ss->streams[channel];
+			pthread_mutex_init(&st->lock, NULL);
+		}
+		if (use_capture_thread)
+			start_capture_thread(&sources[s]);
+	}
+
+	if (spike_onset_fraction_bits)
+		init_spike_onset_weights();
+
+	if (spike_log_file)
+		post_to_spike_log_file("STARTUP\n");
+
+	/* one detection thread per device; the first runs on this thread. */
+	for (int s = 1; s < n_cdevices; ++s) {
+		pthread_t tid;
+		int err = pthread_create(&tid, NULL, spike_source_loop, &spike_sources[s]);
+		if (err != 0)
+			error_exit("pthread_create for %s failed: %s", cdevices[s], strerror(err));
+	}
+
+	spike_source_loop(&spike_sources[0]);
 	__builtin_unreachable();
 }
 
@@ -1012,18 +3049,40 @@ void usage(void)
 	fprintf(stderr, "Collect entropy from a soundcard and feed it into the kernel random pool.\n");
 	fprintf(stderr, "\n");
 	fprintf(stderr, "Options:\n");
-	fprintf(stderr, "--device,       -d []  Specify sound device to use. (Default %s)\n", cdevice);
+	fprintf(stderr, "--device,       -d []  Specify sound device to use, file:<path> to replay a WAV or raw capture, or synth:<params> for generated pulses, repeat for several devices. (Default %s)\n", DEFAULT_CAPTURE_DEVICE);
 	fprintf(stderr, "--sample-rate,  -N []  Audio sampling rate. (default %i)\n", DEFAULT_SAMPLE_RATE);
 
 	fprintf(stderr, "--spike-mode,   -k     Continually search for spikes (typically from a Geiger counter) and seed from inter-spike interval\n");
 	fprintf(stderr, "--spike-threshold-percent, -t []  Threshold for spike detection, negative for negative-going spikes\n");
 	fprintf(stderr, "--spike-edge-min-delta-percent, -T []  Minimum change in consecutive sample value for an above-threshold sample to qualify as a spike onset\n");
-	fprintf(stderr, "--spike-channel-mask, -c []  Mask of channels to search for spikes in, bitwise-or of 1 for channel zero, 2 for channel one\n");
+	fprintf(stderr, "--spike-channel-mask, -c []  Mask of channels to search for spikes in, bitwise-or of 1 for channel zero, 2 for channel one, etc.\n");
 	fprintf(stderr, "--spike-minimum-interval-frames, -i []  Reject spikes closer than this many raw frames apart (relative to requested sample rate)\n");
 	fprintf(stderr, "--spike-test-mode      Run spike mode for testing -- print events, and don't add entropy to the entropy pool\n");
 	fprintf(stderr, "--spike-log <path>     Record spike histogram data to <path>\n");
 	fprintf(stderr, "--spike-log-interval-seconds []   Duration of histogram bins in seconds\n");
-
+	fprintf(stderr, "--spike-auto-threshold <min:max>  Track each channel's noise floor and pulse height, and keep its threshold within min:max percent (logged to the spike log)\n");
+	fprintf(stderr, "--spike-auto-edge-min-delta <min:max>  With --spike-auto-threshold, let the edge minimum delta follow the threshold within min:max percent (default: held fixed)\n");
+	fprintf(stderr, "--spike-onset-interpolation []  Add the threshold crossing time within the onset sample to each event, to this many bits (1-%d), from a cubic through the last four samples (mixed in, not credited)\n", SPIKE_ONSET_MAX_FRACTION_BITS);
+	fprintf(stderr, "--sample-format []     Capture sample format: S16_LE, S16_BE, S24_3LE, S24_LE, S32_LE or FLOAT_LE (default S16_LE, else S16_BE)\n");
+	fprintf(stderr, "--channels []          Number of capture channels (default 2; classic mode uses the first two)\n");
+	fprintf(stderr, "--period-size []       ALSA period size, in frames, or in microseconds with a \"us\" suffix (default: driver's choice)\n");
+	fprintf(stderr, "--buffer-size []       ALSA buffer size, in frames, or in microseconds with a \"us\" suffix (default: driver's choice, at most 1M frames)\n");
+	fprintf(stderr, "--mmap                 Read samples in place from the ALSA ring buffer (falls back to read() access if unsupported)\n");
+	fprintf(stderr, "--capture-thread       In spike mode, capture on a separate SCHED_FIFO thread, decoupled from processing by a ring buffer\n");
+	fprintf(stderr, "--capture-ring-periods []  Capture thread ring size, in periods of 1/%d s (power of two, default %d)\n", CAPTURE_PERIODS_PER_SECOND, DEFAULT_CAPTURE_RING_PERIODS);
+
+	fprintf(stderr, "--extractor []         Classic mode randomness extractor: vn (von Neumann pairs, default), peres, elias, or lsb (conditioned sample lsbs); -v reports bits per frame\n");
+	fprintf(stderr, "--lsb-bits []          With --extractor lsb, low bits harvested from each sample (1-8, default 2)\n");
+	fprintf(stderr, "--lsb-ratio []         With --extractor lsb, harvested bits into the AES CBC-MAC conditioner for each bit out (default 16)\n");
+	fprintf(stderr, "--lsb-entropy-per-bit []  With --extractor lsb, assessed min-entropy of each harvested bit, for the credit (default 0.05)\n");
+	fprintf(stderr, "--debias-threads []    Classic mode: debias each batch in shards of %d frames on this many threads (the output is the same for any number)\n", DEBIAS_SHARD_FRAMES);
+	fprintf(stderr, "--krng-batch-bytes []  Submit output to the kernel in batches of this many bytes (%d-%d, default %d)\n", KRNG_BATCH_MIN_BYTES, KRNG_BATCH_MAX_BYTES, DEFAULT_KRNG_BATCH_BYTES);
+	fprintf(stderr, "--krng-batch-ms []     ...or once output has waited this many milliseconds (0: only when full; default %d), with --reservoir-bytes 0\n", DEFAULT_KRNG_BATCH_MS);
+	fprintf(stderr, "--reservoir-bytes []   Hold this much output in locked memory until the kernel's entropy count falls below its write_wakeup_threshold (0: submit it as it comes; default %d)\n", DEFAULT_RESERVOIR_BYTES);
+	fprintf(stderr, "--reservoir-low-percent []  Classic mode stops capturing when the reservoir is full, and starts again once it has drained to this percent (default %d)\n", DEFAULT_RESERVOIR_LOW_PERCENT);
+	fprintf(stderr, "--self-test            Check the vectorized kernels against the scalar ones, and AES against the FIPS-197 known answers, and exit\n");
+	fprintf(stderr, "--spike-benchmark      Time the spike scan kernels per sample, for the channel mask and threshold given, and exit\n");
+	fprintf(stderr, "--aes-benchmark        Time each AES implementation the cpu runs, per chained block, and exit\n");
 	fprintf(stderr, "--skip-test,    -s     Do not check if data is random enough.\n");
 	fprintf(stderr, "--do-not-fork   -n     Do not fork.\n");
 	fprintf(stderr, "--file <path>   -f     Store raw randomness data to path (while still adding randomness to kernel pool).\n");
@@ -0,0 +1,335 @@
+#include <limits.h>
+#include <string.h>
+#include "debias_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+/* the debias loop builds S16 words from plain chars, so the low byte is
+ * signed wherever char is -- x is the sample, sign extended.
+ */
+#if CHAR_MIN < 0
+#define DEBIAS_WORD(x)		((x) - (((x) & 0x80) << 1))
+#else
+#define DEBIAS_WORD(x)		((x) & 0xffff)
+#endif
+/* ...and keeps the previous ones as shorts */
+#define DEBIAS_PREV(w)		((int32_t)(int16_t)(w))
+
+static inline int32_t load_s16(const char *p, int big_endian)
+{
+	uint16_t x;
+
+	memcpy(&x, p, sizeof x);
+	if (big_endian)
+		x = __builtin_bswap16(x);
+	return DEBIAS_WORD((int32_t)(int16_t)x);
+}
+
+static inline unsigned int order_code(int32_t w1, int32_t w2, int32_t w3, int32_t w4, int32_t psl, int32_t psr)
+{
+	int32_t x1 = w1 - psl, y1 = w2 - psr, x2 = w3 - psl, y2 = w4 - psr;
+
+	return (x1 != y1 && x2 != y2 && (x1 > y1) != (x2 > y2)) | ((x1 > y1) << 1);
+}
+
+static inline void put_code(uint8_t *codes, size_t i, unsigned int code)
+{
+	if (i & 1)
+		codes[i / 2] |= (uint8_t)(code << 4);
+	else
+		codes[i / 2] = (uint8_t)code;
+}
+
+/* pairs [from, n_pairs) */
+static inline void codes_scalar(const char *frames, size_t from, size_t n_pairs, uint8_t *codes, int big_endian)
+{
+	for (size_t i = from; i < n_pairs; ++i)
+	{
+		const char *prev = frames + i * 8, *cur = prev + 8;
+		int32_t w1 = load_s16(cur, big_endian), w2 = load_s16(cur + 2, big_endian);
+		int32_t w3 = load_s16(cur + 4, big_endian), w4 = load_s16(cur + 6, big_endian);
+		int32_t al = DEBIAS_PREV(load_s16(prev, big_endian)), ar = DEBIAS_PREV(load_s16(prev + 2, big_endian));
+		int32_t bl = DEBIAS_PREV(load_s16(prev + 4, big_endian)), br = DEBIAS_PREV(load_s16(prev + 6, big_endian));
+
+		put_code(codes, i, order_code(w1, w2, w3, w4, al, ar) | (order_code(w1, w2, w3, w4, bl, br) << 2));
+	}
+}
+
+static void debias_codes_scalar_le(const char *frames, size_t n_pairs, uint8_t *codes)
+{
+	codes_scalar(frames, 0, n_pairs, codes, 0);
+}
+
+static void debias_codes_scalar_be(const char *frames, size_t n_pairs, uint8_t *codes)
+{
+	codes_scalar(frames, 0, n_pairs, codes, 1);
+}
+
+/* spread4[m] has bit i of m at bit 4i */
+static uint32_t spread4[256];
+
+static void init_spread4(void)
+{
+	for (unsigned int m = 0; m < 256; ++m)
+	{
+		uint32_t s = 0;
+
+		for (unsigned int i = 0; i < 8; ++i)
+			s |= ((m >> i) & 1U) << (4 * i);
+		spread4[m] = s;
+	}
+}
+
+static inline uint32_t pack_codes(unsigned int valid_a, unsigned int order_a, unsigned int valid_b, unsigned int order_b)
+{
+	return spread4[valid_a] | (spread4[order_a] << 1) | (spread4[valid_b] << 2) | (spread4[order_b] << 3);
+}
+
+#ifdef HAVE_X86_SIMD
+/* words of the left and right channels of 4 frames */
+#define SSE2_SPLIT(v, big_endian, l, r) do {						\
+	__m128i _v = (v);								\
+	if (big_endian)									\
+		_v = _mm_or_si128(_mm_slli_epi16(_v, 8), _mm_srli_epi16(_v, 8));	\
+	__m128i _l = _mm_srai_epi32(_mm_slli_epi32(_v, 16), 16);			\
+	__m128i _r = _mm_srai_epi32(_v, 16);						\
+	SSE2_WORD(l, _l);								\
+	SSE2_WORD(r, _r);								\
+} while(0)
+#if CHAR_MIN < 0
+#define SSE2_WORD(w, x)	(w) = _mm_sub_epi32((x), _mm_slli_epi32(_mm_and_si128((x), _mm_set1_epi32(0x80)), 1))
+#else
+#define SSE2_WORD(w, x)	(w) = _mm_and_si128((x), _mm_set1_epi32(0xffff))
+#endif
+#define SSE2_PREV(w)	_mm_srai_epi32(_mm_slli_epi32((w), 16), 16)
+#define SSE2_EVEN(a, b)	_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2, 0, 2, 0)))
+#define SSE2_ODD(a, b)	_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3, 1, 3, 1)))
+
+/* valid and first-frame order masks, against one choice of previous samples */
+#define SSE2_ORDER(w1, w2, w3, w4, psl, psr, valid, order) do {				\
+	__m128i _x1 = _mm_sub_epi32((w1), (psl)), _y1 = _mm_sub_epi32((w2), (psr));	\
+	__m128i _x2 = _mm_sub_epi32((w3), (psl)), _y2 = _mm_sub_epi32((w4), (psr));	\
+	__m128i _gt1 = _mm_cmpgt_epi32(_x1, _y1), _gt2 = _mm_cmpgt_epi32(_x2, _y2);	\
+	__m128i _eq = _mm_or_si128(_mm_cmpeq_epi32(_x1, _y1), _mm_cmpeq_epi32(_x2, _y2)); \
+	(valid) = _mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(_eq, _mm_xor_si128(_gt1, _gt2)))); \
+	(order) = _mm_movemask_ps(_mm_castsi128_ps(_gt1));				\
+} while(0)
+
+static inline __attribute__((target("sse2"))) void codes_sse2(const char *frames, size_t n_pairs, uint8_t *codes, int big_endian)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= n_pairs; i += 4)
+	{
+		const char *prev = frames + i * 8, *cur = prev + 8;
+		__m128i c0l, c0r, c1l, c1r, p0l, p0r, p1l, p1r;
+		int va, oa, vb, ob;
+		uint16_t packed;
+
+		SSE2_SPLIT(_mm_loadu_si128((const __m128i *)cur), big_endian, c0l, c0r);
+		SSE2_SPLIT(_mm_loadu_si128((const __m128i *)(cur + 16)), big_endian, c1l, c1r);
+		SSE2_SPLIT(_mm_loadu_si128((const __m128i *)prev), big_endian, p0l, p0r);
+		SSE2_SPLIT(_mm_loadu_si128((const __m128i *)(prev + 16)), big_endian, p1l, p1r);
+
+		__m128i w1 = SSE2_EVEN(c0l, c1l), w2 = SSE2_EVEN(c0r, c1r);
+		__m128i w3 = SSE2_ODD(c0l, c1l), w4 = SSE2_ODD(c0r, c1r);
+		__m128i al = SSE2_PREV(SSE2_EVEN(p0l, p1l)), ar = SSE2_PREV(SSE2_EVEN(p0r, p1r));
+		__m128i bl = SSE2_PREV(SSE2_ODD(p0l, p1l)), br = SSE2_PREV(SSE2_ODD(p0r, p1r));
+
+		SSE2_ORDER(w1, w2, w3, w4, al, ar, va, oa);
+		SSE2_ORDER(w1, w2, w3, w4, bl, br, vb, ob);
+
+		packed = (uint16_t)pack_codes(va, oa, vb, ob);
+		memcpy(codes + i / 2, &packed, sizeof packed);
+	}
+	codes_scalar(frames, i, n_pairs, codes, big_endian);
+}
+
+static __attribute__((target("sse2"))) void debias_codes_sse2_le(const char *frames, size_t n_pairs, uint8_t *codes)
+{
+	codes_sse2(frames, n_pairs, codes, 0);
+}
+
+static __attribute__((target("sse2"))) void debias_codes_sse2_be(const char *frames, size_t n_pairs, uint8_t *codes)
+{
+	codes_sse2(frames, n_pairs, codes, 1);
+}
+
+/* the same on 8 frames a register.  the even/odd shuffles work within
+ * 128 bit lanes, which leaves the pairs in the order 0 1 4 5 2 3 6 7 --
+ * harmless, as long as the masks are put back in order.
+ */
+#define AVX2_SPLIT(v, big_endian, l, r) do {							\
+	__m256i _v = (v);									\
+	if (big_endian)										\
+		_v = _mm256_or_si256(_mm256_slli_epi16(_v, 8), _mm256_srli_epi16(_v, 8));	\
+	__m256i _l = _mm256_srai_epi32(_mm256_slli_epi32(_v, 16), 16);				\
+	__m256i _r = _mm256_srai_epi32(_v, 16);							\
+	AVX2_WORD(l, _l);									\
+	AVX2_WORD(r, _r);									\
+} while(0)
+#if CHAR_MIN < 0
+#define AVX2_WORD(w, x)	(w) = _mm256_sub_epi32((x), _mm256_slli_epi32(_mm256_and_si256((x), _mm256_set1_epi32(0x80)), 1))
+#else
+#define AVX2_WORD(w, x)	(w) = _mm256_and_si256((x), _mm256_set1_epi32(0xffff))
+#endif
+#define AVX2_PREV(w)	_mm256_srai_epi32(_mm256_slli_epi32((w), 16), 16)
+#define AVX2_EVEN(a, b)	_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(2, 0, 2, 0)))
+#define AVX2_ODD(a, b)	_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(3, 1, 3, 1)))
+#define AVX2_UNSCRAMBLE(m)	(((m) & 0xc3) | (((m) & 0x0c) << 2) | (((m) & 0x30) >> 2))
+
+#define AVX2_ORDER(w1, w2, w3, w4, psl, psr, valid, order) do {					\
+	__m256i _x1 = _mm256_sub_epi32((w1), (psl)), _y1 = _mm256_sub_epi32((w2), (psr));	\
+	__m256i _x2 = _mm256_sub_epi32((w3), (psl)), _y2 = _mm256_sub_epi32((w4), (psr));	\
+	__m256i _gt1 = _mm256_cmpgt_epi32(_x1, _y1), _gt2 = _mm256_cmpgt_epi32(_x2, _y2);	\
+	__m256i _eq = _mm256_or_si256(_mm256_cmpeq_epi32(_x1, _y1), _mm256_cmpeq_epi32(_x2, _y2)); \
+	(valid) = AVX2_UNSCRAMBLE(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(_eq, _mm256_xor_si256(_gt1, _gt2))))); \
+	(order) = AVX2_UNSCRAMBLE(_mm256_movemask_ps(_mm256_castsi256_ps(_gt1)));		\
+} while(0)
+
+static inline __attribute__((target("avx2"))) void codes_avx2(const char *frames, size_t n_pairs, uint8_t *codes, int big_endian)
+{
+	size_t i;
+
+	for (i = 0; i + 8 <= n_pairs; i += 8)
+	{
+		const char *prev = frames + i * 8, *cur = prev + 8;
+		__m256i c0l, c0r, c1l, c1r, p0l, p0r, p1l, p1r;
+		int va, oa, vb, ob;
+		uint32_t packed;
+
+		AVX2_SPLIT(_mm256_loadu_si256((const __m256i *)cur), big_endian, c0l, c0r);
+		AVX2_SPLIT(_mm256_loadu_si256((const __m256i *)(cur + 32)), big_endian, c1l, c1r);
+		AVX2_SPLIT(_mm256_loadu_si256((const __m256i *)prev), big_endian, p0l, p0r);
+		AVX2_SPLIT(_mm256_loadu_si256((const __m256i *)(prev + 32)), big_endian, p1l, p1r);
+
+		__m256i w1 = AVX2_EVEN(c0l, c1l), w2 = AVX2_EVEN(c0r, c1r);
+		__m256i w3 = AVX2_ODD(c0l, c1l), w4 = AVX2_ODD(c0r, c1r);
+		__m256i al = AVX2_PREV(AVX2_EVEN(p0l, p1l)), ar = AVX2_PREV(AVX2_EVEN(p0r, p1r));
+		__m256i bl = AVX2_PREV(AVX2_ODD(p0l, p1l)), br = AVX2_PREV(AVX2_ODD(p0r, p1r));
+
+		AVX2_ORDER(w1, w2, w3, w4, al, ar, va, oa);
+		AVX2_ORDER(w1, w2, w3, w4, bl, br, vb, ob);
+
+		packed = pack_codes(va, oa, vb, ob);
+		memcpy(codes + i / 2, &packed, sizeof packed);
+	}
+	codes_scalar(frames, i, n_pairs, codes, big_endian);
+}
+
+static __attribute__((target("avx2"))) void debias_codes_avx2_le(const char *frames, size_t n_pairs, uint8_t *codes)
+{
+	codes_avx2(frames, n_pairs, codes, 0);
+}
+
+static __attribute__((target("avx2"))) void debias_codes_avx2_be(const char *frames, size_t n_pairs, uint8_t *codes)
+{
+	codes_avx2(frames, n_pairs, codes, 1);
+}
+#endif
+
+#ifdef HAVE_NEON
+#if CHAR_MIN < 0
+#define NEON_WORD(x)	vsubq_s32((x), vshlq_n_s32(vandq_s32((x), vdupq_n_s32(0x80)), 1))
+#else
+#define NEON_WORD(x)	vandq_s32((x), vdupq_n_s32(0xffff))
+#endif
+#define NEON_PREV(w)	vshrq_n_s32(vshlq_n_s32((w), 16), 16)
+
+/* 4 pairs' worth of one sample: vld4 has already put them in one register */
+static inline int32x4_t neon_words(int16x4_t v, int big_endian)
+{
+	if (big_endian)
+		v = vreinterpret_s16_u8(vrev16_u8(vreinterpret_u8_s16(v)));
+	return NEON_WORD(vmovl_s16(v));
+}
+
+static inline unsigned int neon_movemask(uint32x4_t m)
+{
+	static const uint16_t bit[4] = { 1, 2, 4, 8 };
+
+	return vaddv_u16(vand_u16(vmovn_u32(m), vld1_u16(bit)));
+}
+
+static inline void neon_order(int32x4_t w1, int32x4_t w2, int32x4_t w3, int32x4_t w4, int32x4_t psl, int32x4_t psr, unsigned int *valid, unsigned int *order)
+{
+	int32x4_t x1 = vsubq_s32(w1, psl), y1 = vsubq_s32(w2, psr);
+	int32x4_t x2 = vsubq_s32(w3, psl), y2 = vsubq_s32(w4, psr);
+	uint32x4_t gt1 = vcgtq_s32(x1, y1), gt2 = vcgtq_s32(x2, y2);
+	uint32x4_t eq = vorrq_u32(vceqq_s32(x1, y1), vceqq_s32(x2, y2));
+
+	*valid = neon_movemask(vbicq_u32(veorq_u32(gt1, gt2), eq));
+	*order = neon_movemask(gt1);
+}
+
+static inline void codes_neon(const char *frames, size_t n_pairs, uint8_t *codes, int big_endian)
+{
+	size_t i;
+
+	for (i = 0; i + 4 <= n_pairs; i += 4)
+	{
+		const char *prev = frames + i * 8, *cur = prev + 8;
+		int16x4x4_t c = vld4_s16((const int16_t *)cur), p = vld4_s16((const int16_t *)prev);
+		int32x4_t w1 = neon_words(c.val[0], big_endian), w2 = neon_words(c.val[1], big_endian);
+		int32x4_t w3 = neon_words(c.val[2], big_endian), w4 = neon_words(c.val[3], big_endian);
+		int32x4_t al = NEON_PREV(neon_words(p.val[0], big_endian)), ar = NEON_PREV(neon_words(p.val[1], big_endian));
+		int32x4_t bl = NEON_PREV(neon_words(p.val[2], big_endian)), br = NEON_PREV(neon_words(p.val[3], big_endian));
+		unsigned int va, oa, vb, ob;
+		uint16_t packed;
+
+		neon_order(w1, w2, w3, w4, al, ar, &va, &oa);
+		neon_order(w1, w2, w3, w4, bl, br, &vb, &ob);
+
+		packed = (uint16_t)pack_codes(va, oa, vb, ob);
+		memcpy(codes + i / 2, &packed, sizeof packed);
+	}
+	codes_scalar(frames, i, n_pairs, codes, big_endian);
+}
+
+static void debias_codes_neon_le(const char *frames, size_t n_pairs, uint8_t *codes)
+{
+	codes_neon(frames, n_pairs, codes, 0);
+}
+
+static void debias_codes_neon_be(const char *frames, size_t n_pairs, uint8_t *codes)
+{
+	codes_neon(frames, n_pairs, codes, 1);
+}
+#endif
+
+debias_codes_fn debias_codes_reference(int big_endian)
+{
+	return big_endian ? debias_codes_scalar_be : debias_codes_scalar_le;
+}
+
+debias_codes_fn select_debias_codes(int big_endian, const char **name)
+{
+	init_spread4();
+
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		*name = "avx2";
+		return big_endian ? debias_codes_avx2_be : debias_codes_avx2_le;
+	}
+	if (__builtin_cpu_supports("sse2"))
+	{
+		*name = "sse2";
+		return big_endian ? debias_codes_sse2_be : debias_codes_sse2_le;
+	}
+#endif
+#ifdef HAVE_NEON
+	*name = "neon";
+	return big_endian ? debias_codes_neon_be : debias_codes_neon_le;
+#endif
+	*name = "scalar";
+	return debias_codes_reference(big_endian);
+}
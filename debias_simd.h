@@ -0,0 +1,39 @@
+/*
+ * Vectorized order comparisons for the classic-mode debias loop, on
+ * 2-channel S16 frames.
+ *
+ * The debias loop takes frames in pairs, and compares the two channels of
+ * each frame after subtracting the previous samples -- which are those of
+ * the first or the second frame of the previous pair, depending on the
+ * alternator.  That dependency is only on which of two candidates, so the
+ * comparisons against both can be done for many pairs at once; what's left
+ * for the serial loop is a small state machine over the resulting codes.
+ *
+ * A code is a nibble per pair: for the previous samples taken from the
+ * previous pair's first frame (A) and second frame (B), whether the pair
+ * yields a bit, and the order of its first frame.
+ */
+
+#ifndef _DEBIAS_SIMD_H
+#define _DEBIAS_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEBIAS_CODE_VALID_A	0x1
+#define DEBIAS_CODE_ORDER_A	0x2
+#define DEBIAS_CODE_VALID_B	0x4
+#define DEBIAS_CODE_ORDER_B	0x8
+
+/* codes for n_pairs pairs, each compared against the pair before it:
+ * frames points to the pair before the first.  two codes per byte, the
+ * first in the low nibble.
+ */
+typedef void (*debias_codes_fn)(const char *frames, size_t n_pairs, uint8_t *codes);
+
+/* the fastest implementation this cpu runs, and its name */
+debias_codes_fn select_debias_codes(int big_endian, const char **name);
+/* the portable one, that the others must agree with */
+debias_codes_fn debias_codes_reference(int big_endian);
+
+#endif
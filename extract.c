@@ -0,0 +1,121 @@
+#include <string.h>
+#include "extract.h"
+
+static void init_binomial(void);
+
+static const char *const extractor_names[] = { "vn", "peres", "elias", "lsb" };
+
+int extractor_value(const char *name)
+{
+	for (unsigned int i = 0; i < sizeof extractor_names / sizeof extractor_names[0]; ++i)
+	{
+		if (strcmp(name, extractor_names[i]) == 0)
+			return (int)i;
+	}
+	return -1;
+}
+
+const char *extractor_name(enum extractor e)
+{
+	return extractor_names[e];
+}
+
+extract_fn extractor_fn(enum extractor e)
+{
+	switch (e)
+	{
+	case EXTRACTOR_PERES: return peres_extract;
+	case EXTRACTOR_ELIAS: init_binomial(); return elias_extract;
+	default: return NULL;
+	}
+}
+
+/* x holds n bits, one per byte; appends to *out */
+static void peres(const uint8_t *x, unsigned int n, uint64_t *out, unsigned int *n_out)
+{
+	uint8_t u[EXTRACT_BLOCK_BITS / 2], v[EXTRACT_BLOCK_BITS / 2];
+	unsigned int n_v = 0;
+
+	if (n < 2)
+		return;
+
+	for (unsigned int i = 0; i < n / 2; ++i)
+	{
+		uint8_t a = x[2 * i], b = x[2 * i + 1];
+
+		u[i] = a ^ b;
+		if (a != b)
+		{
+			*out = (*out << 1) | a;
+			(*n_out)++;
+		}
+		else
+			v[n_v++] = a;
+	}
+
+	peres(u, n / 2, out, n_out);
+	peres(v, n_v, out, n_out);
+}
+
+unsigned int peres_extract(uint64_t block, uint64_t *out)
+{
+	uint8_t x[EXTRACT_BLOCK_BITS];
+	unsigned int n_out = 0;
+
+	for (unsigned int i = 0; i < EXTRACT_BLOCK_BITS; ++i)
+		x[i] = (block >> (EXTRACT_BLOCK_BITS - 1 - i)) & 1;
+
+	*out = 0;
+	peres(x, EXTRACT_BLOCK_BITS, out, &n_out);
+	return n_out;
+}
+
+/* binomial[n][k], up to C(64, 32) < 2^63 */
+static uint64_t binomial[EXTRACT_BLOCK_BITS + 1][EXTRACT_BLOCK_BITS + 1];
+
+static void init_binomial(void)
+{
+	for (unsigned int n = 0; n <= EXTRACT_BLOCK_BITS; ++n)
+	{
+		binomial[n][0] = 1;
+		for (unsigned int k = 1; k <= n; ++k)
+			binomial[n][k] = binomial[n - 1][k - 1] + (k < n ? binomial[n - 1][k] : 0);
+	}
+}
+
+unsigned int elias_extract(uint64_t block, uint64_t *out)
+{
+	unsigned int k = (unsigned int)__builtin_popcountll(block), ones = k;
+	uint64_t rank = 0, count;
+
+	/* colexicographic rank among the blocks with k ones */
+	for (int i = EXTRACT_BLOCK_BITS - 1; i >= 0 && ones; --i)
+	{
+		if ((block >> i) & 1)
+		{
+			rank += binomial[i][ones];
+			ones--;
+		}
+	}
+
+	/* split [0, C(n, k)) into power-of-two runs, largest first; within
+	 * the run it falls in, the rank is that many uniform bits.
+	 */
+	count = binomial[EXTRACT_BLOCK_BITS][k];
+	for (int j = 63 - __builtin_clzll(count); j >= 0; --j)
+	{
+		uint64_t run = 1ULL << j;
+
+		if (!(count & run))
+			continue;
+		if (rank < run)
+		{
+			*out = rank;
+			return (unsigned int)j;
+		}
+		rank -= run;
+	}
+
+	*out = 0;
+	return 0;
+}
@@ -0,0 +1,41 @@
+/*
+ * Randomness extractors for classic mode, beyond the von Neumann pairs the
+ * debias loop has always used.
+ *
+ * Each takes a block of EXTRACT_BLOCK_BITS order bits -- which channel
+ * moved up more from one frame to the next, over disjoint pairs of frames --
+ * and returns unbiased bits from it, for a stream of independent bits of
+ * any fixed bias:
+ *
+ *   peres: von Neumann's pairs, then the same again on the xors of the
+ *          pairs and on the values of the equal pairs, recursively.
+ *   elias: the block's rank among all blocks of the same weight, which is
+ *          uniform, cut into bits.
+ */
+
+#ifndef _EXTRACT_H
+#define _EXTRACT_H
+
+#include <stdint.h>
+
+#define EXTRACT_BLOCK_BITS	64
+
+enum extractor
+{
+	EXTRACTOR_VON_NEUMANN,
+	EXTRACTOR_PERES,
+	EXTRACTOR_ELIAS,
+	EXTRACTOR_LSB,		/* not an extractor: sample lsbs, conditioned */
+};
+
+/* bits out, first in the most significant of the returned count */
+typedef unsigned int (*extract_fn)(uint64_t block, uint64_t *out);
+
+unsigned int peres_extract(uint64_t block, uint64_t *out);
+unsigned int elias_extract(uint64_t block, uint64_t *out);
+
+int extractor_value(const char *name);		/* -1 if unknown */
+const char *extractor_name(enum extractor e);
+extract_fn extractor_fn(enum extractor e);	/* NULL for von Neumann and lsb */
+
+#endif
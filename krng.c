@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include "krng.h"
+#include "error.h"
+
+int krng_batch_init(struct krng_batch *b, int random_fd, size_t capacity, long deadline_ms, int add_to_entcnt)
+{
+	size_t size = sizeof(struct rand_pool_info) + capacity;
+
+	if (capacity < KRNG_BATCH_MIN_BYTES || capacity > KRNG_BATCH_MAX_BYTES)
+		error_exit("krng_batch_init: batch size %zu is not %d to %d bytes", capacity, KRNG_BATCH_MIN_BYTES, KRNG_BATCH_MAX_BYTES);
+
+	memset(b, 0, sizeof *b);
+	pthread_mutex_init(&b->lock, NULL);
+	b->random_fd = random_fd;
+	b->add_to_entcnt = add_to_entcnt;
+	b->capacity = capacity;
+	b->deadline_ms = deadline_ms;
+
+	b->pool = (struct rand_pool_info *)calloc(1, size);
+	if (!b->pool)
+		error_exit("krng_batch_init: problem allocating %zu bytes of memory", size);
+
+	/* the entropy shouldn't reach swap, with or without mlockall() */
+	return mlock(b->pool, size) == 0;
+}
+
+/* with the lock held */
+static void submit(struct krng_batch *b)
+{
+	if (!b->fill)
+		return;
+
+	b->pool->buf_size = (int)b->fill;
+	b->pool->entropy_count = (int)b->credit_bits;
+	if (ioctl(b->random_fd, RNDADDENTROPY, b->pool) < 0)
+		error_exit("RNDADDENTROPY of %zu bytes for fd %d failed!", b->fill, b->random_fd);
+	if (b->add_to_entcnt && b->pool->entropy_count > 0 &&
+	    ioctl(b->random_fd, RNDADDTOENTCNT, &b->pool->entropy_count) < 0)
+		error_exit("RNDADDTOENTCNT %d for fd %d failed!", b->pool->entropy_count, b->random_fd);
+
+	++b->n_submits;
+	b->n_bytes_submitted += b->fill;
+	memset(b->pool->buf, 0, b->fill);
+	b->fill = 0;
+	b->credit_bits = 0;
+}
+
+static int expired(const struct krng_batch *b)
+{
+	struct timespec now;
+
+	if (!b->fill || !b->deadline_ms)
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - b->oldest.tv_sec) * 1000L + (now.tv_nsec - b->oldest.tv_nsec) / 1000000L >= b->deadline_ms;
+}
+
+void krng_batch_add(struct krng_batch *b, const void *data, size_t n_bytes, double credit_bits)
+{
+	const char *p = (const char *)data;
+	const double credit_per_byte = n_bytes ? credit_bits / (double)n_bytes : 0;
+
+	pthread_mutex_lock(&b->lock);
+	while (n_bytes)
+	{
+		size_t n = b->capacity - b->fill;
+		if (n > n_bytes)
+			n = n_bytes;
+
+		if (!b->fill)
+			clock_gettime(CLOCK_MONOTONIC, &b->oldest);
+		memcpy((char *)b->pool->buf + b->fill, p, n);
+		b->fill += n;
+		b->credit_bits += credit_per_byte * (double)n;
+		p += n;
+		n_bytes -= n;
+
+		if (b->fill == b->capacity)
+			submit(b);
+	}
+	if (expired(b))
+		submit(b);
+	pthread_mutex_unlock(&b->lock);
+}
+
+void krng_batch_poll(struct krng_batch *b)
+{
+	pthread_mutex_lock(&b->lock);
+	if (expired(b))
+		submit(b);
+	pthread_mutex_unlock(&b->lock);
+}
+
+void krng_batch_flush(struct krng_batch *b)
+{
+	pthread_mutex_lock(&b->lock);
+	submit(b);
+	pthread_mutex_unlock(&b->lock);
+}
@@ -0,0 +1,45 @@
+/*
+ * Batched submission to the kernel entropy pool.
+ *
+ * Whitened blocks collect in a preallocated, locked buffer, and go to the
+ * kernel in one RNDADDENTROPY -- with the credit of the blocks in it -- once
+ * the buffer is full, or once its oldest block has waited out the deadline.
+ * Anything that calls krng_batch_add() may end up submitting, so it's safe
+ * to share between threads.
+ */
+
+#ifndef _KRNG_H
+#define _KRNG_H
+
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/random.h>
+
+#define KRNG_BATCH_MIN_BYTES	16
+#define KRNG_BATCH_MAX_BYTES	4096
+
+struct krng_batch
+{
+	pthread_mutex_t lock;
+	int random_fd;
+	int add_to_entcnt;		/* follow up with RNDADDTOENTCNT */
+
+	struct rand_pool_info *pool;	/* capacity bytes of buf */
+	size_t capacity, fill;
+	double credit_bits;		/* of the fill bytes */
+	long deadline_ms;		/* 0: only when full, or flushed */
+	struct timespec oldest;		/* when the first of the fill bytes came */
+
+	size_t n_submits, n_bytes_submitted;
+};
+
+/* 0 if the buffer couldn't be locked in memory -- it works all the same */
+int krng_batch_init(struct krng_batch *b, int random_fd, size_t capacity, long deadline_ms, int add_to_entcnt);
+/* n_bytes, worth credit_bits, spread over as many batches as they take */
+void krng_batch_add(struct krng_batch *b, const void *data, size_t n_bytes, double credit_bits);
+/* submit what's there if it's waited long enough */
+void krng_batch_poll(struct krng_batch *b);
+void krng_batch_flush(struct krng_batch *b);
+
+#endif
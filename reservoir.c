@@ -0,0 +1,192 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <time.h>
+#include "reservoir.h"
+#include "error.h"
+
+void dolog(int level, char *format, ...);
+extern int verbose;
+
+/* how long to wait before asking again when /dev/random says it's writable
+ * with the pool full -- as it always does from Linux 5.18 on, where
+ * write_wakeup_threshold does nothing */
+static const struct timespec full_pool_backoff = { 1, 0 };
+
+int reservoir_init(struct reservoir *r, size_t capacity, size_t low_water)
+{
+	if (capacity < RESERVOIR_MIN_BYTES || capacity > RESERVOIR_MAX_BYTES)
+		error_exit("reservoir_init: size %zu is not %d to %d bytes", capacity, RESERVOIR_MIN_BYTES, RESERVOIR_MAX_BYTES);
+
+	memset(r, 0, sizeof *r);
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->filled, NULL);
+	pthread_cond_init(&r->drained, NULL);
+	r->capacity = capacity;
+	r->low_water = low_water < capacity ? low_water : capacity - 1;
+
+	r->buf = (unsigned char *)calloc(1, capacity);
+	if (!r->buf)
+		error_exit("reservoir_init: problem allocating %zu bytes of memory", capacity);
+
+	/* the entropy shouldn't reach swap, with or without mlockall() */
+	return mlock(r->buf, capacity) == 0;
+}
+
+size_t reservoir_add(struct reservoir *r, const void *data, size_t n_bytes, double credit_bits)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	size_t n, tail, first;
+
+	pthread_mutex_lock(&r->lock);
+	n = r->capacity - r->fill;
+	if (n > n_bytes)
+		n = n_bytes;
+	tail = (r->head + r->fill) % r->capacity;
+	first = r->capacity - tail;
+	if (first > n)
+		first = n;
+
+	memcpy(r->buf + tail, p, first);
+	memcpy(r->buf, p + first, n - first);
+	r->fill += n;
+	r->n_bytes_dropped += n_bytes - n;
+	if (n)
+	{
+		r->credit_bits += credit_bits * (double)n / (double)n_bytes;
+		pthread_cond_signal(&r->filled);
+	}
+	pthread_mutex_unlock(&r->lock);
+
+	return n;
+}
+
+int reservoir_has_room(struct reservoir *r, size_t n_bytes)
+{
+	int room;
+
+	pthread_mutex_lock(&r->lock);
+	room = r->capacity - r->fill >= n_bytes;
+	pthread_mutex_unlock(&r->lock);
+
+	return room;
+}
+
+void reservoir_wait_low(struct reservoir *r)
+{
+	pthread_mutex_lock(&r->lock);
+	while (r->fill > r->low_water)
+		pthread_cond_wait(&r->drained, &r->lock);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* n_bytes from the head into the batch, with their share of the credit.
+ * with the lock held.
+ */
+static double drain(struct reservoir *r, size_t n_bytes)
+{
+	const double credit = r->credit_bits * (double)n_bytes / (double)r->fill;
+	size_t first = r->capacity - r->head;
+
+	if (first > n_bytes)
+		first = n_bytes;
+	krng_batch_add(r->out, r->buf + r->head, first, credit * (double)first / (double)n_bytes);
+	memset(r->buf + r->head, 0, first);
+	if (n_bytes > first)
+	{
+		krng_batch_add(r->out, r->buf, n_bytes - first, credit * (double)(n_bytes - first) / (double)n_bytes);
+		memset(r->buf, 0, n_bytes - first);
+	}
+
+	r->head = (r->head + n_bytes) % r->capacity;
+	r->fill -= n_bytes;
+	r->credit_bits = r->fill ? r->credit_bits - credit : 0;
+	r->n_bytes_drained += n_bytes;
+
+	return credit;
+}
+
+static void *drain_thread(void *arg)
+{
+	struct reservoir *r = (struct reservoir *)arg;
+	const int random_fd = r->out->random_fd;
+
+	for (;;)
+	{
+		fd_set write_fd;
+		int before, after;
+		double added = 0;
+		size_t left, dropped;
+
+		/* with nothing to give, don't spin in select() while the pool is low */
+		pthread_mutex_lock(&r->lock);
+		while (!r->fill)
+			pthread_cond_wait(&r->filled, &r->lock);
+		pthread_mutex_unlock(&r->lock);
+
+		FD_ZERO(&write_fd);
+		FD_SET(random_fd, &write_fd);
+		if (select(random_fd + 1, NULL, &write_fd, NULL, NULL) < 0)
+		{
+			if (errno != EINTR)
+				error_exit("Select error: %m");
+			continue;
+		}
+
+		/* find out how many bits to add */
+		if (ioctl(random_fd, RNDGETENTCNT, &before) == -1)
+			error_exit("Couldn't query entropy-level from kernel: %m");
+		if (before >= r->max_bits)
+		{
+			nanosleep(&full_pool_backoff, NULL);
+			continue;
+		}
+
+		/* as many bytes as carry that much credit, a batch at a time */
+		pthread_mutex_lock(&r->lock);
+		while (added < (double)(r->max_bits - before) && r->fill)
+		{
+			const double short_bits = (double)(r->max_bits - before) - added;
+			const double per_byte = r->credit_bits / (double)r->fill;
+			size_t n = r->fill;
+
+			if (per_byte > 0 && short_bits / per_byte < (double)n)
+				n = (size_t)ceil(short_bits / per_byte);
+			if (n > r->out->capacity)
+				n = r->out->capacity;
+			added += drain(r, n);
+		}
+		krng_batch_flush(r->out);
+		++r->n_drains;
+		if (r->fill <= r->low_water)
+			pthread_cond_broadcast(&r->drained);
+		left = r->fill;
+		dropped = r->n_bytes_dropped;
+		pthread_mutex_unlock(&r->lock);
+
+		if (ioctl(random_fd, RNDGETENTCNT, &after) == -1)
+			error_exit("Couldn't query entropy-level from kernel: %m");
+
+		if (added > 0 || verbose)
+			dolog(LOG_DEBUG, "Entropy credit of %.0f bits made from the reservoir (%d bits before, %d bits after, %zu bytes left, %zu turned away so far)", added, before, after, left, dropped);
+	}
+
+	return NULL;
+}
+
+void reservoir_start_drain(struct reservoir *r, struct krng_batch *out, int max_bits)
+{
+	pthread_t tid;
+	int err;
+
+	r->out = out;
+	r->max_bits = max_bits;
+	if ((err = pthread_create(&tid, NULL, drain_thread, r)) != 0)
+		error_exit("pthread_create failed: %s", strerror(err));
+	pthread_detach(tid);
+}
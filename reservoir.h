@@ -0,0 +1,55 @@
+/*
+ * A reservoir of conditioned output, kept in locked memory until the
+ * kernel asks for it.
+ *
+ * Either mode fills it as its output comes.  A drain thread sleeps in
+ * select() until the kernel's entropy count falls below its
+ * write_wakeup_threshold, then makes the count up to the pool size out of
+ * the reservoir, through a krng_batch, and sleeps again.  (Linux 5.18 on
+ * says /dev/random is always writable; there the thread looks at the
+ * count once a second instead.)  So what's made while the pool is full
+ * isn't credited into it for nothing, and a refill needn't wait for
+ * capture to start.  Past its capacity -- the high
+ * watermark -- the reservoir takes no more, and counts what it turned
+ * away.  Classic mode, which can stop capturing, stops there, and starts
+ * again once the reservoir has drained to the low watermark.
+ */
+
+#ifndef _RESERVOIR_H
+#define _RESERVOIR_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include "krng.h"
+
+#define RESERVOIR_MIN_BYTES	KRNG_BATCH_MAX_BYTES
+#define RESERVOIR_MAX_BYTES	(16 << 20)
+
+struct reservoir
+{
+	pthread_mutex_t lock;
+	pthread_cond_t filled;		/* there's something to drain */
+	pthread_cond_t drained;		/* down to the low watermark */
+
+	unsigned char *buf;		/* capacity bytes, fill of them from head, wrapping */
+	size_t capacity, low_water, head, fill;
+	double credit_bits;		/* of the fill bytes, spread evenly over them */
+
+	struct krng_batch *out;
+	int max_bits;			/* the kernel's pool size */
+
+	size_t n_bytes_dropped, n_drains, n_bytes_drained;
+};
+
+/* 0 if the buffer couldn't be locked in memory -- it works all the same */
+int reservoir_init(struct reservoir *r, size_t capacity, size_t low_water);
+/* as much of n_bytes as fits, with its share of credit_bits; returns how much */
+size_t reservoir_add(struct reservoir *r, const void *data, size_t n_bytes, double credit_bits);
+/* whether n_bytes more would fit */
+int reservoir_has_room(struct reservoir *r, size_t n_bytes);
+/* block until the drain has brought the reservoir down to the low watermark */
+void reservoir_wait_low(struct reservoir *r);
+/* start the thread that drains into out when the kernel wants entropy */
+void reservoir_start_drain(struct reservoir *r, struct krng_batch *out, int max_bits);
+
+#endif
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <errno.h>
+#include "ring.h"
+#include "error.h"
+
+void ring_init(struct ring *r, size_t n_slots, size_t slot_size)
+{
+	if (n_slots < 2 || (n_slots & (n_slots - 1)))
+		error_exit("ring_init: slot count %zu is not a power of two", n_slots);
+
+	r->n_slots = n_slots;
+	r->slot_size = slot_size;
+	r->slots = (char *)malloc(n_slots * slot_size);
+	if (!r->slots)
+		error_exit("ring_init: problem allocating %zu bytes of memory", n_slots * slot_size);
+
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->n_overflows, 0);
+	atomic_init(&r->max_occupancy, 0);
+
+	if (sem_init(&r->filled, 0, 0) == -1)
+		error_exit("ring_init: sem_init failed");
+}
+
+/* producer side: returns the slot to fill, or NULL if the ring is full. */
+void *ring_write_begin(struct ring *r)
+{
+	size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+	if (head - tail >= r->n_slots)
+	{
+		atomic_fetch_add_explicit(&r->n_overflows, 1, memory_order_relaxed);
+		return NULL;
+	}
+
+	return r->slots + (head & (r->n_slots - 1)) * r->slot_size;
+}
+
+void ring_write_commit(struct ring *r)
+{
+	size_t head = atomic_load_explicit(&r->head, memory_order_relaxed) + 1;
+	size_t occupancy = head - atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&r->head, head, memory_order_release);
+
+	if (occupancy > atomic_load_explicit(&r->max_occupancy, memory_order_relaxed))
+		atomic_store_explicit(&r->max_occupancy, occupancy, memory_order_relaxed);
+
+	sem_post(&r->filled);
+}
+
+/* consumer side: waits for and returns the oldest committed slot. */
+void *ring_read_begin(struct ring *r)
+{
+	size_t tail;
+
+	while (sem_wait(&r->filled) == -1)
+	{
+		if (errno != EINTR)
+			error_exit("ring_read_begin: sem_wait failed");
+	}
+
+	tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	/* pairs with the release in ring_write_commit() */
+	(void)atomic_load_explicit(&r->head, memory_order_acquire);
+
+	return r->slots + (tail & (r->n_slots - 1)) * r->slot_size;
+}
+
+void ring_read_commit(struct ring *r)
+{
+	atomic_fetch_add_explicit(&r->tail, 1, memory_order_release);
+}
+
+size_t ring_occupancy(struct ring *r)
+{
+	return atomic_load_explicit(&r->head, memory_order_acquire) - atomic_load_explicit(&r->tail, memory_order_acquire);
+}
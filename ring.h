@@ -0,0 +1,40 @@
+/*
+ * Single-producer/single-consumer lock-free ring of fixed-size slots.
+ *
+ * The producer fills the slot returned by ring_write_begin() and publishes
+ * it with ring_write_commit(); the consumer gets the oldest published slot
+ * from ring_read_begin() and releases it with ring_read_commit().  Neither
+ * side ever blocks the other -- when the ring is full, ring_write_begin()
+ * returns NULL and the producer has to decide what to drop.
+ */
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+
+struct ring
+{
+	size_t n_slots;			/* power of two */
+	size_t slot_size;		/* bytes */
+	char *slots;
+
+	_Alignas(64) atomic_size_t head;	/* next slot to write, owned by the producer */
+	_Alignas(64) atomic_size_t tail;	/* next slot to read, owned by the consumer */
+
+	sem_t filled;			/* posted once per committed slot */
+
+	atomic_size_t n_overflows;	/* writes refused because the ring was full */
+	atomic_size_t max_occupancy;	/* high-water mark of committed slots */
+};
+
+void ring_init(struct ring *r, size_t n_slots, size_t slot_size);
+void *ring_write_begin(struct ring *r);
+void ring_write_commit(struct ring *r);
+void *ring_read_begin(struct ring *r);
+void ring_read_commit(struct ring *r);
+size_t ring_occupancy(struct ring *r);
+
+#endif
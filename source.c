@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "source.h"
+#include "error.h"
+
+void dolog(int level, char *format, ...);
+
+/* pick the backend by name, and open it */
+void source_open(struct sample_source *src, const char *name, const struct source_params *p)
+{
+	src->name = name;
+	if (strncmp(name, FILE_SOURCE_PREFIX, strlen(FILE_SOURCE_PREFIX)) == 0)
+		src->ops = &file_source_ops;
+	else if (strncmp(name, SYNTH_SOURCE_PREFIX, strlen(SYNTH_SOURCE_PREFIX)) == 0)
+		src->ops = &synth_source_ops;
+	else
+		src->ops = &alsa_source_ops;
+
+	atomic_init(&src->n_xruns, 0);
+	atomic_init(&src->xrun_frames_lost, 0);
+	src->gap_frames = 0;
+
+	src->ops->open(src, p);
+}
+
+/* synth: pulses are a fixed function of their parameters, seed included,
+ * and a file: replay gives the same capture every time it's run, so
+ * anyone can have the same bytes.  only a live sound card is fresh.
+ */
+int source_may_credit(const char *name)
+{
+	return strncmp(name, SYNTH_SOURCE_PREFIX, strlen(SYNTH_SOURCE_PREFIX)) != 0 &&
+	       strncmp(name, FILE_SOURCE_PREFIX, strlen(FILE_SOURCE_PREFIX)) != 0;
+}
+
+/* for backends, once the format is known */
+void source_set_format(struct sample_source *src, snd_pcm_format_t format, unsigned int channels, unsigned int rate)
+{
+	switch (format)
+	{
+#define X(fmt, bytes, bits) case SND_PCM_FORMAT_##fmt: src->sample_bits = bits; src->frame_bytes = (size_t)(bytes) * channels; break;
+	SAMPLE_FORMATS(X)
+#undef X
+	default:
+		error_exit("%s: unsupported sample format %s", src->name, snd_pcm_format_name(format));
+	}
+	src->format = format;
+	src->channels = channels;
+	src->rate = rate;
+}
+
+/* a finite source has run dry -- that's the end of the run */
+void source_end_of_input(struct sample_source *src, const char *stats)
+{
+	dolog(LOG_INFO, "end of input from %s%s%s", src->name, stats ? ": " : "", stats ? stats : "");
+	exit(0);
+}
+
+/* frames lost since the last call, just before the frames delivered since */
+snd_pcm_uframes_t source_take_gap(struct sample_source *src)
+{
+	snd_pcm_uframes_t gap = src->gap_frames;
+
+	src->gap_frames = 0;
+	return gap;
+}
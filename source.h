@@ -0,0 +1,98 @@
+/*
+ * Sample sources: where captured frames come from.
+ *
+ * A source is opened from a name -- an ALSA device, "file:<path>" to
+ * replay a WAV or raw PCM capture at full speed, or "synth:<params>" for
+ * generated Geiger counter pulses -- and then delivers
+ * interleaved frames either in place (begin()/commit()) or copied out
+ * (read()).  Whatever the backend, frames are in one of SAMPLE_FORMATS.
+ */
+
+#ifndef _SOURCE_H
+#define _SOURCE_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <alsa/asoundlib.h>
+
+/* supported sample formats: name, bytes per sample, significant bits.
+ * FLOAT_LE is scaled to 24 bits.
+ */
+#define SAMPLE_FORMATS(X)	\
+	X(S16_LE, 2, 16)	\
+	X(S16_BE, 2, 16)	\
+	X(S24_3LE, 3, 24)	\
+	X(S24_LE, 4, 24)	\
+	X(S32_LE, 4, 32)	\
+	X(FLOAT_LE, 4, 24)
+
+#define FILE_SOURCE_PREFIX	"file:"
+#define SYNTH_SOURCE_PREFIX	"synth:"
+
+/* a size in frames, or in microseconds */
+struct pcm_size
+{
+	unsigned long value;			/* 0: leave it to the backend */
+	int is_us;
+};
+
+/* what was asked for on the command line.  a backend may only approximate
+ * it, or (a WAV file) dictate its own format.
+ */
+struct source_params
+{
+	int sample_rate;
+	snd_pcm_format_t format;		/* SND_PCM_FORMAT_UNKNOWN: S16_LE, else S16_BE */
+	unsigned int channels;
+	int use_mmap;				/* ALSA: try SND_PCM_ACCESS_MMAP_INTERLEAVED */
+	struct pcm_size period_size, buffer_size;
+};
+
+struct sample_source;
+
+struct sample_source_ops
+{
+	void (*open)(struct sample_source *src, const struct source_params *p);
+	/* the next run of frames, at most max_frames and a multiple of granule,
+	 * valid until the matching commit() */
+	snd_pcm_uframes_t (*begin)(struct sample_source *src, snd_pcm_uframes_t max_frames, snd_pcm_uframes_t granule, const char **frames, snd_pcm_uframes_t *offset);
+	void (*commit)(struct sample_source *src, snd_pcm_uframes_t offset, snd_pcm_uframes_t n_frames);
+	/* n_frames copied to buffer, or fewer when frames were lost after
+	 * them, so that the gap goes before the next read's */
+	snd_pcm_uframes_t (*read)(struct sample_source *src, char *buffer, snd_pcm_uframes_t n_frames);
+	/* classic mode stops capturing while the kernel pool is full */
+	void (*stop)(struct sample_source *src);
+	void (*restart)(struct sample_source *src);
+	void (*close)(struct sample_source *src);
+};
+
+struct sample_source
+{
+	const struct sample_source_ops *ops;
+	const char *name;
+	void *priv;				/* backend state */
+
+	/* set by open() */
+	snd_pcm_format_t format;
+	int sample_bits;			/* significant bits per sample */
+	unsigned int channels;
+	unsigned int rate;
+	size_t frame_bytes;
+
+	atomic_size_t n_xruns, xrun_frames_lost;
+
+	/* frames lost just before the next ones delivered -- only touched
+	 * by the thread reading the source */
+	snd_pcm_uframes_t gap_frames;
+};
+
+extern const struct sample_source_ops alsa_source_ops, file_source_ops, synth_source_ops;
+
+void source_open(struct sample_source *src, const char *name, const struct source_params *p);
+/* whether what the named device gives may be credited to the kernel */
+int source_may_credit(const char *name);
+void source_set_format(struct sample_source *src, snd_pcm_format_t format, unsigned int channels, unsigned int rate);
+void source_end_of_input(struct sample_source *src, const char *stats);
+snd_pcm_uframes_t source_take_gap(struct sample_source *src);
+
+#endif
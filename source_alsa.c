@@ -0,0 +1,502 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <poll.h>
+#include "source.h"
+#include "error.h"
+
+void dolog(int level, char *format, ...);
+extern int verbose;
+
+struct alsa_source
+{
+	snd_pcm_t *chandle;
+	snd_pcm_access_t access_mode;
+	snd_pcm_uframes_t hw_period_frames, hw_buffer_frames;
+	struct pollfd *pfds;
+	unsigned int n_pfds;
+	char *rw_buffer;			/* RW access only */
+	snd_pcm_uframes_t rw_buffer_frames;
+
+	/* timeline: frames taken from the device, and where the hardware
+	 * pointer was, by the clock, when we last looked.  only with
+	 * CLOCK_MONOTONIC timestamps, which don't jump when the time is set */
+	int tstamp_monotonic;
+	uint64_t frames_consumed;
+	int have_timestamp;
+	snd_htimestamp_t last_timestamp;
+	uint64_t last_hw_frame;
+};
+
+static void setparams(struct sample_source *src, const struct source_params *p)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+	snd_pcm_t *chandle = as->chandle;
+	snd_pcm_hw_params_t *ct_params;		/* templates with rate, format and channels */
+	snd_pcm_sw_params_t *sw_params;
+	snd_pcm_format_t format;
+	unsigned int rate = (unsigned int)p->sample_rate;
+	int err;
+	snd_pcm_hw_params_alloca(&ct_params);
+	snd_pcm_sw_params_alloca(&sw_params);
+
+	err = snd_pcm_hw_params_any(chandle, ct_params);
+	if (err < 0)
+		error_exit("Broken configuration for %s PCM: no configurations available: %s", src->name, snd_strerror(err));
+
+	/* Disable rate resampling */
+	err = snd_pcm_hw_params_set_rate_resample(chandle, ct_params, 0);
+	if (err < 0)
+		error_exit("Could not disable rate resampling: %s", snd_strerror(err));
+
+	/* Set access to SND_PCM_ACCESS_MMAP_INTERLEAVED if asked for and
+	 * available, otherwise SND_PCM_ACCESS_RW_INTERLEAVED */
+	as->access_mode = SND_PCM_ACCESS_RW_INTERLEAVED;
+	if (p->use_mmap)
+	{
+		err = snd_pcm_hw_params_set_access(chandle, ct_params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+		if (err < 0)
+			dolog(LOG_WARNING, "SND_PCM_ACCESS_MMAP_INTERLEAVED not available for %s (%s), falling back to SND_PCM_ACCESS_RW_INTERLEAVED", src->name, snd_strerror(err));
+		else
+			as->access_mode = SND_PCM_ACCESS_MMAP_INTERLEAVED;
+	}
+	if (as->access_mode == SND_PCM_ACCESS_RW_INTERLEAVED)
+	{
+		err = snd_pcm_hw_params_set_access(chandle, ct_params, SND_PCM_ACCESS_RW_INTERLEAVED);
+		if (err < 0)
+			error_exit("Could not set access to SND_PCM_ACCESS_RW_INTERLEAVED: %s", snd_strerror(err));
+	}
+
+	/* Restrict a configuration space to have rate nearest to our target rate */
+	err = snd_pcm_hw_params_set_rate_near(chandle, ct_params, &rate, 0);
+	if (err < 0)
+		error_exit("Rate %iHz not available for %s: %s", p->sample_rate, src->name, snd_strerror(err));
+
+	/* Set sample format */
+	if (p->format != SND_PCM_FORMAT_UNKNOWN)
+	{
+		format = p->format;
+		err = snd_pcm_hw_params_set_format(chandle, ct_params, format);
+		if (err < 0)
+			error_exit("Sample format %s not available for %s: %s", snd_pcm_format_name(format), src->name, snd_strerror(err));
+	}
+	else
+	{
+		format = SND_PCM_FORMAT_S16_LE;
+		err = snd_pcm_hw_params_set_format(chandle, ct_params, format);
+		if (err < 0)
+		{
+			format = SND_PCM_FORMAT_S16_BE;
+			err = snd_pcm_hw_params_set_format(chandle, ct_params, format);
+		}
+		if (err < 0)
+			error_exit("Sample format (SND_PCM_FORMAT_S16_BE and _LE) not available for %s: %s", src->name, snd_strerror(err));
+	}
+
+	/* Set channel count */
+	err = snd_pcm_hw_params_set_channels(chandle, ct_params, p->channels);
+	if (err < 0)
+		error_exit("Channels count (%u) not available for %s: %s", p->channels, src->name, snd_strerror(err));
+
+	/* Set period and buffer size */
+	if (p->period_size.value)
+	{
+		if (p->period_size.is_us)
+		{
+			unsigned int us = (unsigned int)p->period_size.value;
+			err = snd_pcm_hw_params_set_period_time_near(chandle, ct_params, &us, 0);
+		}
+		else
+		{
+			snd_pcm_uframes_t frames = p->period_size.value;
+			err = snd_pcm_hw_params_set_period_size_near(chandle, ct_params, &frames, 0);
+		}
+		if (err < 0)
+			error_exit("Period size %lu%s not available for %s: %s", p->period_size.value, p->period_size.is_us ? "us" : " frames", src->name, snd_strerror(err));
+	}
+	if (p->buffer_size.value)
+	{
+		if (p->buffer_size.is_us)
+		{
+			unsigned int us = (unsigned int)p->buffer_size.value;
+			err = snd_pcm_hw_params_set_buffer_time_near(chandle, ct_params, &us, 0);
+		}
+		else
+		{
+			snd_pcm_uframes_t frames = p->buffer_size.value;
+			err = snd_pcm_hw_params_set_buffer_size_near(chandle, ct_params, &frames);
+		}
+		if (err < 0)
+			error_exit("Buffer size %lu%s not available for %s: %s", p->buffer_size.value, p->buffer_size.is_us ? "us" : " frames", src->name, snd_strerror(err));
+	}
+	else
+	{
+	  snd_pcm_uframes_t buf_sz = 1L<<20L;
+	  if ((err = snd_pcm_hw_params_set_buffer_size_max(chandle, ct_params, &buf_sz)) < 0)
+	    error_exit("buf sz not settable for %s: %s", src->name, snd_strerror(err));
+	}
+
+	/* Apply settings to sound device */
+	err = snd_pcm_hw_params(chandle, ct_params);
+	if (err < 0)
+		error_exit("Could not apply settings to sound device %s: %s", src->name, snd_strerror(err));
+
+	snd_pcm_hw_params_get_rate(ct_params, &rate, 0);
+	snd_pcm_hw_params_get_period_size(ct_params, &as->hw_period_frames, 0);
+	snd_pcm_hw_params_get_buffer_size(ct_params, &as->hw_buffer_frames);
+	source_set_format(src, format, p->channels, rate);
+	if (rate != (unsigned int)p->sample_rate)
+		dolog(LOG_WARNING, "%s runs at %u Hz rather than %d Hz, timing follows the device", src->name, rate, p->sample_rate);
+	if (verbose)
+		dolog(LOG_INFO, "%s: %u Hz, period %lu frames, buffer %lu frames", src->name, src->rate, (unsigned long)as->hw_period_frames, (unsigned long)as->hw_buffer_frames);
+
+	/* wake up once a period is ready; RW reads start the stream by themselves */
+	err = snd_pcm_sw_params_current(chandle, sw_params);
+	if (err < 0)
+		error_exit("Could not get software parameters for %s: %s", src->name, snd_strerror(err));
+	err = snd_pcm_sw_params_set_avail_min(chandle, sw_params, as->hw_period_frames);
+	if (err < 0)
+		error_exit("Could not set avail_min for %s: %s", src->name, snd_strerror(err));
+	err = snd_pcm_sw_params_set_start_threshold(chandle, sw_params, 1);
+	if (err < 0)
+		error_exit("Could not set start threshold for %s: %s", src->name, snd_strerror(err));
+	err = snd_pcm_sw_params_set_tstamp_mode(chandle, sw_params, SND_PCM_TSTAMP_ENABLE);
+	if (err >= 0)
+		err = snd_pcm_sw_params_set_tstamp_type(chandle, sw_params, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+	if (err < 0)
+		dolog(LOG_WARNING, "Could not enable monotonic timestamps for %s (%s), only overruns will show as gaps", src->name, snd_strerror(err));
+	as->tstamp_monotonic = err >= 0;
+	err = snd_pcm_sw_params(chandle, sw_params);
+	if (err < 0)
+		error_exit("Could not apply software parameters to sound device %s: %s", src->name, snd_strerror(err));
+}
+
+static void alsa_open(struct sample_source *src, const struct source_params *p)
+{
+	struct alsa_source *as;
+	int err;
+
+	as = (struct alsa_source *)calloc(1, sizeof *as);
+	if (!as)
+		error_exit("problem allocating %zu bytes of memory", sizeof *as);
+	src->priv = as;
+
+	/* non-blocking, so that we wait for data in poll() (wait_for_capture()) */
+	if ((err = snd_pcm_open(&as->chandle, src->name, SND_PCM_STREAM_CAPTURE, SND_PCM_NONBLOCK)) < 0)
+		error_exit("Record open error for %s: %s", src->name, snd_strerror(err));
+
+	/* Open and set up ALSA device for reading */
+	setparams(src, p);
+
+	if ((err = snd_pcm_poll_descriptors_count(as->chandle)) <= 0)
+		error_exit("No poll descriptors for %s: %s", src->name, snd_strerror(err));
+	as->n_pfds = (unsigned int)err;
+	as->pfds = (struct pollfd *)malloc(as->n_pfds * sizeof(struct pollfd));
+	if (!as->pfds)
+		error_exit("problem allocating %zu bytes of memory", as->n_pfds * sizeof(struct pollfd));
+	if ((err = snd_pcm_poll_descriptors(as->chandle, as->pfds, as->n_pfds)) < 0)
+		error_exit("Could not get poll descriptors for %s: %s", src->name, snd_strerror(err));
+}
+
+/* Sleep until at least avail_min frames are ready, or the stream needs
+ * attention (xrun, suspend), which the caller finds out on its next call.
+ */
+static void wait_for_capture(struct sample_source *src)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+	unsigned short revents;
+	int err;
+
+	for(;;)
+	{
+		if (poll(as->pfds, as->n_pfds, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			error_exit("poll error on %s: %m", src->name);
+		}
+		if ((err = snd_pcm_poll_descriptors_revents(as->chandle, as->pfds, as->n_pfds, &revents)) < 0)
+			error_exit("poll error on %s: %s", src->name, snd_strerror(err));
+		if (revents & (POLLIN | POLLERR))
+			return;
+	}
+}
+
+/* Recover from a failed capture call, counting overruns and the frames they
+ * lost: the full ring buffer, which recovering throws away, and, by the
+ * monotonic clock, everything since it filled up.
+ */
+static void capture_recover(struct sample_source *src, int err, const char *what)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+
+	if (err == -EPIPE)
+	{
+		snd_pcm_status_t *status;
+		snd_pcm_uframes_t n_lost = 0;
+		size_t n_xruns, total_lost;
+
+		snd_pcm_status_alloca(&status);
+		if (snd_pcm_status(as->chandle, status) >= 0 && snd_pcm_status_get_state(status) == SND_PCM_STATE_XRUN)
+		{
+			snd_htimestamp_t now, trigger;
+			snd_pcm_uframes_t avail = snd_pcm_status_get_avail(status);
+
+			if (as->tstamp_monotonic)
+			{
+				snd_pcm_status_get_htstamp(status, &now);
+				snd_pcm_status_get_trigger_htstamp(status, &trigger);
+				n_lost = (snd_pcm_uframes_t)((((double)(now.tv_sec - trigger.tv_sec)) + ((double)(now.tv_nsec - trigger.tv_nsec) / 1e9)) * (double)src->rate);
+			}
+			n_lost += avail < as->hw_buffer_frames ? avail : as->hw_buffer_frames;
+		}
+
+		n_xruns = atomic_fetch_add_explicit(&src->n_xruns, 1, memory_order_relaxed) + 1;
+		total_lost = atomic_fetch_add_explicit(&src->xrun_frames_lost, n_lost, memory_order_relaxed) + n_lost;
+		dolog(LOG_WARNING, "overrun on %s, at least %lu frames lost (%zu overruns, %zu frames lost so far)", src->name, (unsigned long)n_lost, n_xruns, total_lost);
+
+		/* counted here, so the timeline starts over rather than counting it again */
+		src->gap_frames += n_lost;
+		as->have_timestamp = 0;
+	}
+
+	/* Make sure we aren't hitting a disconnect/suspend case */
+	if ((err = snd_pcm_recover(as->chandle, err, 1)) < 0)
+		error_exit("%s error on %s: %s", what, src->name, snd_strerror(err));
+}
+
+/* Compare the frames we've seen against the time they took to arrive: a
+ * shortfall of more than a period means frames went missing (suspend,
+ * a stall the driver didn't report) and becomes a gap in the timeline.
+ * Looking every batch keeps the sound card's clock drift out of it.
+ */
+static void check_timeline(struct sample_source *src)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+	snd_pcm_uframes_t avail;
+	snd_htimestamp_t now;
+	uint64_t hw_frame;
+
+	if (!as->tstamp_monotonic)
+		return;
+	if (snd_pcm_htimestamp(as->chandle, &avail, &now) < 0 || (now.tv_sec == 0 && now.tv_nsec == 0))
+		return;
+	hw_frame = as->frames_consumed + avail;
+
+	if (as->have_timestamp)
+	{
+		double elapsed = (double)(now.tv_sec - as->last_timestamp.tv_sec) + (double)(now.tv_nsec - as->last_timestamp.tv_nsec) / 1e9;
+		double missing = elapsed * (double)src->rate - (double)(hw_frame - as->last_hw_frame);
+
+		if (missing > (double)(as->hw_period_frames + src->rate / 1000))
+		{
+			dolog(LOG_WARNING, "%s: %.0f frames missing from the timeline", src->name, missing);
+			src->gap_frames += (snd_pcm_uframes_t)missing;
+		}
+	}
+
+	as->last_timestamp = now;
+	as->last_hw_frame = hw_frame;
+	as->have_timestamp = 1;
+}
+
+/* n_frames, or fewer when an overrun cuts the read short: the frames
+ * after it are the next read's, with the gap before them.
+ */
+static snd_pcm_uframes_t read_frames(struct sample_source *src, char *buffer, snd_pcm_uframes_t n_frames)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+	snd_pcm_uframes_t n_done = 0;
+
+	while (n_done < n_frames)
+	{
+		snd_pcm_sframes_t frames_read = snd_pcm_readi(as->chandle, buffer + n_done * src->frame_bytes, n_frames - n_done);
+		if (frames_read == -EAGAIN)
+		{
+			wait_for_capture(src);
+			continue;
+		}
+		if (frames_read < 0)
+		{
+			capture_recover(src, (int)frames_read, "Read");
+			if (n_done)
+				break;
+			continue;
+		}
+
+		n_done += frames_read;
+		as->frames_consumed += frames_read;
+	}
+
+	check_timeline(src);
+	return n_done;
+}
+
+/* In RW mode frames are read into the source's buffer; in mmap mode *frames
+ * points straight into the ALSA ring buffer.
+ */
+static snd_pcm_uframes_t alsa_begin(struct sample_source *src, snd_pcm_uframes_t max_frames, snd_pcm_uframes_t granule, const char **frames, snd_pcm_uframes_t *offset)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+	snd_pcm_t *chandle = as->chandle;
+	snd_pcm_uframes_t n_frames;
+	int err;
+
+	if (as->access_mode == SND_PCM_ACCESS_RW_INTERLEAVED)
+	{
+		max_frames -= max_frames % granule;
+		if (as->rw_buffer_frames < max_frames)
+		{
+			free(as->rw_buffer);
+			as->rw_buffer = (char *)malloc(max_frames * src->frame_bytes);
+			if (!as->rw_buffer)
+				error_exit("problem allocating %zu bytes of memory", max_frames * src->frame_bytes);
+			as->rw_buffer_frames = max_frames;
+			if (verbose > 1)
+				dolog(LOG_DEBUG, "Input buffer size for %s: %zu bytes", src->name, max_frames * src->frame_bytes);
+		}
+		n_frames = read_frames(src, as->rw_buffer, max_frames);
+		/* cut short: what's left over from the last granule is lost too */
+		src->gap_frames += n_frames % granule;
+		*frames = as->rw_buffer;
+		*offset = 0;
+		return n_frames - n_frames % granule;
+	}
+
+	for(;;)
+	{
+		const snd_pcm_channel_area_t *areas;
+		snd_pcm_sframes_t avail;
+
+		if (snd_pcm_state(chandle) == SND_PCM_STATE_PREPARED)
+		{
+			if ((err = snd_pcm_start(chandle)) < 0)
+				error_exit("Could not start capture on %s: %s", src->name, snd_strerror(err));
+		}
+
+		avail = snd_pcm_avail_update(chandle);
+		if (avail < 0)
+		{
+			capture_recover(src, (int)avail, "Read");
+			continue;
+		}
+		if ((snd_pcm_uframes_t)avail < granule)
+		{
+			wait_for_capture(src);
+			continue;
+		}
+
+		n_frames = max_frames;
+		if ((err = snd_pcm_mmap_begin(chandle, &areas, offset, &n_frames)) < 0)
+		{
+			capture_recover(src, err, "mmap begin");
+			continue;
+		}
+		n_frames -= n_frames % granule;
+		if (n_frames == 0)
+		{
+			/* odd frame at the end of the ring -- wait for more to arrive */
+			snd_pcm_mmap_commit(chandle, *offset, 0);
+			wait_for_capture(src);
+			continue;
+		}
+
+		check_timeline(src);
+
+		/* interleaved, so every channel shares the first area */
+		*frames = (const char *)areas[0].addr + (areas[0].first / 8) + (*offset * (areas[0].step / 8));
+		return n_frames;
+	}
+}
+
+static void alsa_commit(struct sample_source *src, snd_pcm_uframes_t offset, snd_pcm_uframes_t n_frames)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+	snd_pcm_sframes_t committed;
+
+	if (as->access_mode == SND_PCM_ACCESS_RW_INTERLEAVED)
+		return;
+
+	committed = snd_pcm_mmap_commit(as->chandle, offset, n_frames);
+	if (committed > 0)
+		as->frames_consumed += committed;
+	if (committed < 0 || (snd_pcm_uframes_t)committed != n_frames)
+	{
+		/* the ring was overrun while we were reading it */
+		capture_recover(src, committed >= 0 ? -EPIPE : (int)committed, "mmap commit");
+	}
+}
+
+static snd_pcm_uframes_t alsa_read(struct sample_source *src, char *buffer, snd_pcm_uframes_t n_frames)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+	snd_pcm_uframes_t n_done, gap = src->gap_frames;
+
+	if (as->access_mode == SND_PCM_ACCESS_RW_INTERLEAVED)
+		return read_frames(src, buffer, n_frames);
+
+	for (n_done = 0; n_done < n_frames; )
+	{
+		const char *frames;
+		snd_pcm_uframes_t offset, n;
+
+		n = alsa_begin(src, n_frames - n_done, 1, &frames, &offset);
+		/* frames lost since the last run: stop short, leaving this
+		 * one, and the gap before it, to the next read */
+		if (n_done && src->gap_frames != gap)
+		{
+			alsa_commit(src, offset, 0);
+			break;
+		}
+		gap = src->gap_frames;
+
+		memcpy(buffer + n_done * src->frame_bytes, frames, n * src->frame_bytes);
+		alsa_commit(src, offset, n);
+		n_done += n;
+	}
+	return n_done;
+}
+
+/* stop capturing rather than letting the ring buffer overrun */
+static void alsa_stop(struct sample_source *src)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+	int err;
+
+	if ((err = snd_pcm_drop(as->chandle)) < 0)
+		error_exit("Could not stop capture on %s: %s", src->name, snd_strerror(err));
+	as->have_timestamp = 0;
+}
+
+static void alsa_restart(struct sample_source *src)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+	int err;
+
+	if ((err = snd_pcm_prepare(as->chandle)) < 0)
+		error_exit("Could not restart capture on %s: %s", src->name, snd_strerror(err));
+}
+
+static void alsa_close(struct sample_source *src)
+{
+	struct alsa_source *as = (struct alsa_source *)src->priv;
+
+	snd_pcm_close(as->chandle);
+	free(as->pfds);
+	free(as->rw_buffer);
+	free(as);
+	src->priv = NULL;
+}
+
+const struct sample_source_ops alsa_source_ops =
+{
+	.open = alsa_open,
+	.begin = alsa_begin,
+	.commit = alsa_commit,
+	.read = alsa_read,
+	.stop = alsa_stop,
+	.restart = alsa_restart,
+	.close = alsa_close,
+};
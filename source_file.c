@@ -0,0 +1,223 @@
+/*
+ * Replay of a capture from a file, as fast as it can be read: a WAV file
+ * (PCM or IEEE float), or headerless PCM in the format, channel count and
+ * rate given on the command line.  The daemon exits at the end of the input.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <syslog.h>
+#include "source.h"
+#include "error.h"
+
+void dolog(int level, char *format, ...);
+extern int verbose;
+
+#define WAVE_FORMAT_PCM		0x0001
+#define WAVE_FORMAT_IEEE_FLOAT	0x0003
+#define WAVE_FORMAT_EXTENSIBLE	0xfffe
+
+struct file_source
+{
+	FILE *fh;
+	uint64_t data_bytes_left;		/* UINT64_MAX: to the end of the file */
+	char *buffer;
+	snd_pcm_uframes_t buffer_frames;
+};
+
+static uint16_t get_le16(const unsigned char *p)
+{
+	return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const unsigned char *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* leaves the file positioned at the start of the data chunk */
+static void parse_wav_header(struct sample_source *src, struct file_source *fs, const char *path)
+{
+	unsigned char chunk[8], fmt[40];
+	int have_fmt = 0;
+	unsigned int tag = 0, channels = 0, rate = 0, block_align = 0, bits = 0;
+	snd_pcm_format_t format = SND_PCM_FORMAT_UNKNOWN;
+
+	for(;;)
+	{
+		uint32_t len;
+
+		if (fread(chunk, 1, sizeof chunk, fs->fh) != sizeof chunk)
+			error_exit("%s: no data chunk", path);
+		len = get_le32(chunk + 4);
+
+		if (memcmp(chunk, "fmt ", 4) == 0)
+		{
+			/* as much as we understand of it; skip the rest */
+			const uint32_t n = len < sizeof fmt ? len : sizeof fmt;
+
+			if (len < 16 || fread(fmt, 1, n, fs->fh) != n)
+				error_exit("%s: bad fmt chunk", path);
+			if (fseek(fs->fh, (long)(len - n) + (len & 1), SEEK_CUR) == -1)
+				error_exit("%s: truncated fmt chunk", path);
+			tag = get_le16(fmt);
+			channels = get_le16(fmt + 2);
+			rate = get_le32(fmt + 4);
+			block_align = get_le16(fmt + 12);
+			bits = get_le16(fmt + 14);
+			/* the sub-format GUID starts with the format tag */
+			if (tag == WAVE_FORMAT_EXTENSIBLE && len >= 26)
+				tag = get_le16(fmt + 24);
+			have_fmt = 1;
+		}
+		else if (memcmp(chunk, "data", 4) == 0)
+		{
+			if (!have_fmt)
+				error_exit("%s: data chunk before fmt chunk", path);
+			/* streamed WAV files leave the length at 0 or ~0 */
+			fs->data_bytes_left = (len == 0 || len == UINT32_MAX) ? UINT64_MAX : len;
+			break;
+		}
+		else if (fseek(fs->fh, (long)len + (len & 1), SEEK_CUR) == -1)
+			error_exit("%s: truncated %.4s chunk", path, chunk);
+	}
+
+	if (channels == 0)
+		error_exit("%s: no channels", path);
+	if (tag == WAVE_FORMAT_PCM && bits == 16 && block_align == 2 * channels)
+		format = SND_PCM_FORMAT_S16_LE;
+	else if (tag == WAVE_FORMAT_PCM && bits == 24 && block_align == 3 * channels)
+		format = SND_PCM_FORMAT_S24_3LE;
+	else if (tag == WAVE_FORMAT_PCM && bits == 24 && block_align == 4 * channels)
+		format = SND_PCM_FORMAT_S24_LE;
+	else if (tag == WAVE_FORMAT_PCM && bits == 32 && block_align == 4 * channels)
+		format = SND_PCM_FORMAT_S32_LE;
+	else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32 && block_align == 4 * channels)
+		format = SND_PCM_FORMAT_FLOAT_LE;
+	else
+		error_exit("%s: unsupported WAV format (tag 0x%x, %u bits, %u bytes per frame)", path, tag, bits, block_align);
+
+	source_set_format(src, format, channels, rate);
+}
+
+static void file_open(struct sample_source *src, const struct source_params *p)
+{
+	const char *path = src->name + strlen(FILE_SOURCE_PREFIX);
+	struct file_source *fs;
+	unsigned char riff[12];
+
+	fs = (struct file_source *)calloc(1, sizeof *fs);
+	if (!fs)
+		error_exit("problem allocating %zu bytes of memory", sizeof *fs);
+	src->priv = fs;
+
+	fs->fh = fopen(path, "rb");
+	if (!fs->fh)
+		error_exit("error opening %s", path);
+
+	if (fread(riff, 1, sizeof riff, fs->fh) == sizeof riff &&
+	    memcmp(riff, "RIFF", 4) == 0 && memcmp(riff + 8, "WAVE", 4) == 0)
+	{
+		parse_wav_header(src, fs, path);
+		if (p->format != SND_PCM_FORMAT_UNKNOWN && p->format != src->format)
+			dolog(LOG_WARNING, "%s is %s, not %s", path, snd_pcm_format_name(src->format), snd_pcm_format_name(p->format));
+		if (src->rate != (unsigned int)p->sample_rate)
+			dolog(LOG_WARNING, "%s was captured at %u Hz, not %d Hz", path, src->rate, p->sample_rate);
+	}
+	else
+	{
+		rewind(fs->fh);
+		fs->data_bytes_left = UINT64_MAX;
+		source_set_format(src, p->format != SND_PCM_FORMAT_UNKNOWN ? p->format : SND_PCM_FORMAT_S16_LE, p->channels, (unsigned int)p->sample_rate);
+	}
+
+	if (verbose)
+		dolog(LOG_INFO, "%s: %s, %u channels, %u Hz", src->name, snd_pcm_format_name(src->format), src->channels, src->rate);
+}
+
+/* reads up to max_frames, a multiple of granule; exits if there are none */
+static snd_pcm_uframes_t read_some(struct sample_source *src, char *buffer, snd_pcm_uframes_t max_frames, snd_pcm_uframes_t granule)
+{
+	struct file_source *fs = (struct file_source *)src->priv;
+	size_t n_bytes = max_frames * src->frame_bytes;
+	snd_pcm_uframes_t n_frames;
+
+	if (n_bytes > fs->data_bytes_left)
+		n_bytes = (size_t)fs->data_bytes_left;
+	n_frames = fread(buffer, src->frame_bytes, n_bytes / src->frame_bytes, fs->fh);
+	n_frames -= n_frames % granule;
+	if (n_frames == 0)
+	{
+		if (ferror(fs->fh))
+			error_exit("error reading %s", src->name);
+		source_end_of_input(src, NULL);
+	}
+	if (fs->data_bytes_left != UINT64_MAX)
+		fs->data_bytes_left -= n_frames * src->frame_bytes;
+
+	return n_frames;
+}
+
+static snd_pcm_uframes_t file_begin(struct sample_source *src, snd_pcm_uframes_t max_frames, snd_pcm_uframes_t granule, const char **frames, snd_pcm_uframes_t *offset)
+{
+	struct file_source *fs = (struct file_source *)src->priv;
+
+	max_frames -= max_frames % granule;
+	if (fs->buffer_frames < max_frames)
+	{
+		free(fs->buffer);
+		fs->buffer = (char *)malloc(max_frames * src->frame_bytes);
+		if (!fs->buffer)
+			error_exit("problem allocating %zu bytes of memory", max_frames * src->frame_bytes);
+		fs->buffer_frames = max_frames;
+	}
+
+	*frames = fs->buffer;
+	*offset = 0;
+	return read_some(src, fs->buffer, max_frames, granule);
+}
+
+static void file_commit(struct sample_source *src, snd_pcm_uframes_t offset, snd_pcm_uframes_t n_frames)
+{
+}
+
+static snd_pcm_uframes_t file_read(struct sample_source *src, char *buffer, snd_pcm_uframes_t n_frames)
+{
+	snd_pcm_uframes_t n_done;
+
+	for (n_done = 0; n_done < n_frames; )
+		n_done += read_some(src, buffer + n_done * src->frame_bytes, n_frames - n_done, 1);
+	return n_done;
+}
+
+/* a file doesn't run on while the pool is full */
+static void file_stop(struct sample_source *src)
+{
+}
+
+static void file_restart(struct sample_source *src)
+{
+}
+
+static void file_close(struct sample_source *src)
+{
+	struct file_source *fs = (struct file_source *)src->priv;
+
+	fclose(fs->fh);
+	free(fs->buffer);
+	free(fs);
+	src->priv = NULL;
+}
+
+const struct sample_source_ops file_source_ops =
+{
+	.open = file_open,
+	.begin = file_begin,
+	.commit = file_commit,
+	.read = file_read,
+	.stop = file_stop,
+	.restart = file_restart,
+	.close = file_close,
+};
@@ -0,0 +1,405 @@
+/*
+ * Synthetic Geiger counter: Poisson-distributed pulses on every channel,
+ * generated as fast as they're consumed, for load and benchmark runs
+ * without hardware.  The device name carries the parameters, e.g.
+ *
+ *	synth:rate=1000,amplitude=80,rise-us=2,dead-us=100,noise=0.5,seed=1,seconds=60
+ *
+ * rate is mean events per second per channel; amplitude and noise (RMS)
+ * are percentages of full scale; a pulse rises linearly over rise-us and
+ * then decays, having all but vanished after dead-us, during which further
+ * events are lost as in a real tube.  The same seed gives the same
+ * samples.  With seconds, the run ends after that much sample time.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <syslog.h>
+#include "source.h"
+#include "error.h"
+
+void dolog(int level, char *format, ...);
+extern int verbose;
+
+#define SYNTH_MAX_RATE		768000
+#define SYNTH_MAX_CHANNELS	32
+/* the decay time constant, as a fraction of the dead time */
+#define SYNTH_DECAY_PER_DEAD	0.2
+
+struct synth_channel
+{
+	double next_event;			/* in frames */
+	double dead_until;
+	double pulse_start;
+	int pulse_active, decaying;
+	double level;
+	uint64_t n_pulses, n_lost;
+};
+
+struct synth_source
+{
+	/* parameters */
+	double event_rate, amplitude, rise_us, dead_us, noise, seconds;
+	uint64_t seed;
+
+	/* in frames, and fractions of full scale */
+	double mean_interval, rise, dead, decay_factor, noise_scale;
+	uint64_t end_frame;			/* 0: never */
+
+	uint64_t rng[4];
+	uint64_t frame;
+	struct synth_channel chan[SYNTH_MAX_CHANNELS];
+	char *buffer;
+	snd_pcm_uframes_t buffer_frames;
+	struct timespec started;
+};
+
+/* xoshiro256** */
+static inline uint64_t rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t synth_random(struct synth_source *ss)
+{
+	uint64_t *s = ss->rng;
+	uint64_t result = rotl(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+
+	return result;
+}
+
+static void synth_seed(struct synth_source *ss, uint64_t seed)
+{
+	/* splitmix64 to fill the state */
+	for (int i = 0; i < 4; i++)
+	{
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		ss->rng[i] = z ^ (z >> 31);
+	}
+}
+
+/* in (0, 1] */
+static inline double synth_uniform(struct synth_source *ss)
+{
+	return (double)((synth_random(ss) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/* near-gaussian, unit variance: the sum of four 16 bit uniforms */
+static inline double synth_noise(struct synth_source *ss)
+{
+	uint64_t r = synth_random(ss);
+	long sum = (long)(r & 0xffff) + (long)((r >> 16) & 0xffff) + (long)((r >> 32) & 0xffff) + (long)(r >> 48);
+
+	/* mean 4 * 32767.5, sd 2 * 65536 / sqrt(12) */
+	return (double)(sum - 131070) * (1.0 / 37837.23);
+}
+
+static void parse_params(struct synth_source *ss, const char *name)
+{
+	const char *params = name + strlen(SYNTH_SOURCE_PREFIX);
+	char *copy = strdup(params), *saveptr = NULL, *kv;
+
+	if (!copy)
+		error_exit("problem allocating memory");
+
+	ss->event_rate = 100.0;
+	ss->amplitude = 80.0;
+	ss->rise_us = 2.0;
+	ss->dead_us = 100.0;
+	ss->noise = 0.5;
+	ss->seed = 1;
+	ss->seconds = 0.0;
+
+	for (kv = strtok_r(copy, ",", &saveptr); kv; kv = strtok_r(NULL, ",", &saveptr))
+	{
+		char *eq = strchr(kv, '='), *cp;
+		double value;
+
+		if (!eq)
+			error_exit("%s: expected key=value, got \"%s\"", name, kv);
+		*eq = 0;
+		value = strtod(eq + 1, &cp);
+		if (*cp || eq[1] == 0 || value < 0)
+			error_exit("%s: invalid value for %s", name, kv);
+
+		if (strcmp(kv, "rate") == 0)
+			ss->event_rate = value;
+		else if (strcmp(kv, "amplitude") == 0 && value <= 100)
+			ss->amplitude = value;
+		else if (strcmp(kv, "rise-us") == 0)
+			ss->rise_us = value;
+		else if (strcmp(kv, "dead-us") == 0)
+			ss->dead_us = value;
+		else if (strcmp(kv, "noise") == 0 && value <= 100)
+			ss->noise = value;
+		else if (strcmp(kv, "seed") == 0)
+			ss->seed = (uint64_t)value;
+		else if (strcmp(kv, "seconds") == 0)
+			ss->seconds = value;
+		else
+			error_exit("%s: unknown or out of range parameter %s", name, kv);
+	}
+
+	free(copy);
+
+	if (ss->event_rate <= 0)
+		error_exit("%s: rate must be positive", name);
+}
+
+static void synth_open(struct sample_source *src, const struct source_params *p)
+{
+	struct synth_source *ss;
+	double rate = (double)p->sample_rate;
+
+	ss = (struct synth_source *)calloc(1, sizeof *ss);
+	if (!ss)
+		error_exit("problem allocating %zu bytes of memory", sizeof *ss);
+	src->priv = ss;
+
+	if (p->sample_rate <= 0 || p->sample_rate > SYNTH_MAX_RATE)
+		error_exit("%s: sample rate %d out of range (at most %d)", src->name, p->sample_rate, SYNTH_MAX_RATE);
+	if (p->channels > SYNTH_MAX_CHANNELS)
+		error_exit("%s: at most %d channels", src->name, SYNTH_MAX_CHANNELS);
+
+	parse_params(ss, src->name);
+	source_set_format(src, p->format != SND_PCM_FORMAT_UNKNOWN ? p->format : SND_PCM_FORMAT_S16_LE, p->channels, (unsigned int)p->sample_rate);
+
+	ss->mean_interval = rate / ss->event_rate;
+	ss->rise = ss->rise_us * 1e-6 * rate;
+	ss->dead = ss->dead_us * 1e-6 * rate;
+	ss->decay_factor = (ss->dead > 0) ? exp(-1.0 / (SYNTH_DECAY_PER_DEAD * ss->dead)) : 0.0;
+	ss->noise_scale = ss->noise / 100.0;
+	ss->end_frame = (uint64_t)(ss->seconds * rate);
+
+	synth_seed(ss, ss->seed);
+	for (unsigned int c = 0; c < src->channels; c++)
+		ss->chan[c].next_event = -log(synth_uniform(ss)) * ss->mean_interval;
+
+	if (verbose)
+		dolog(LOG_INFO, "%s: %s, %u channels, %u Hz, %.1f events/s per channel", src->name, snd_pcm_format_name(src->format), src->channels, src->rate, ss->event_rate);
+}
+
+/* v is a fraction of full scale */
+static inline void store_sample(snd_pcm_format_t format, char *p, double v)
+{
+	if (v > 1.0)
+		v = 1.0;
+	else if (v < -1.0)
+		v = -1.0;
+
+	switch (format)
+	{
+	case SND_PCM_FORMAT_S16_LE: {
+		int16_t s = (int16_t)lrint(v * 32767.0);
+		memcpy(p, &s, sizeof s);
+		break;
+	}
+	case SND_PCM_FORMAT_S16_BE: {
+		uint16_t s = __builtin_bswap16((uint16_t)(int16_t)lrint(v * 32767.0));
+		memcpy(p, &s, sizeof s);
+		break;
+	}
+	case SND_PCM_FORMAT_S24_3LE: {
+		int32_t s = (int32_t)lrint(v * 8388607.0);
+		p[0] = (char)s;
+		p[1] = (char)(s >> 8);
+		p[2] = (char)(s >> 16);
+		break;
+	}
+	case SND_PCM_FORMAT_S24_LE: {
+		int32_t s = (int32_t)lrint(v * 8388607.0);
+		memcpy(p, &s, sizeof s);
+		break;
+	}
+	case SND_PCM_FORMAT_S32_LE: {
+		int32_t s = (int32_t)lrint(v * 2147483647.0);
+		memcpy(p, &s, sizeof s);
+		break;
+	}
+	case SND_PCM_FORMAT_FLOAT_LE: {
+		float s = (float)v;
+		memcpy(p, &s, sizeof s);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+static void generate(struct sample_source *src, char *buffer, snd_pcm_uframes_t n_frames)
+{
+	struct synth_source *ss = (struct synth_source *)src->priv;
+	const size_t sample_bytes = src->frame_bytes / src->channels;
+	const double amplitude = ss->amplitude / 100.0;
+
+	if (ss->frame == 0)
+		clock_gettime(CLOCK_MONOTONIC, &ss->started);
+
+	for (snd_pcm_uframes_t f = 0; f < n_frames; f++, ss->frame++)
+	{
+		const double now = (double)ss->frame;
+
+		for (unsigned int c = 0; c < src->channels; c++)
+		{
+			struct synth_channel *ch = &ss->chan[c];
+			double v = 0.0;
+
+			/* arrivals up to this frame; any inside the dead time are lost */
+			while (ch->next_event <= now)
+			{
+				if (ch->next_event >= ch->dead_until)
+				{
+					ch->pulse_start = ch->next_event;
+					ch->dead_until = ch->next_event + ss->dead;
+					ch->pulse_active = 1;
+					ch->decaying = 0;
+					ch->n_pulses++;
+				}
+				else
+					ch->n_lost++;
+				ch->next_event += -log(synth_uniform(ss)) * ss->mean_interval;
+			}
+
+			if (ch->pulse_active)
+			{
+				double t = now - ch->pulse_start;
+
+				if (t < ss->rise)
+					v = amplitude * t / ss->rise;
+				else
+				{
+					if (!ch->decaying)
+					{
+						ch->level = amplitude * pow(ss->decay_factor, t - ss->rise);
+						ch->decaying = 1;
+					}
+					else
+						ch->level *= ss->decay_factor;
+					v = ch->level;
+					if (v < 1e-9)
+						ch->pulse_active = 0;
+				}
+			}
+
+			if (ss->noise_scale > 0)
+				v += synth_noise(ss) * ss->noise_scale;
+
+			store_sample(src->format, buffer + f * src->frame_bytes + c * sample_bytes, v);
+		}
+	}
+}
+
+static void synth_end_of_input(struct sample_source *src)
+{
+	struct synth_source *ss = (struct synth_source *)src->priv;
+	struct timespec now;
+	uint64_t n_pulses = 0, n_lost = 0;
+	double elapsed;
+	char stats[256];
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (double)(now.tv_sec - ss->started.tv_sec) + (double)(now.tv_nsec - ss->started.tv_nsec) / 1e9;
+	for (unsigned int c = 0; c < src->channels; c++)
+	{
+		n_pulses += ss->chan[c].n_pulses;
+		n_lost += ss->chan[c].n_lost;
+	}
+
+	snprintf(stats, sizeof stats, "%llu frames, %llu pulses, %llu lost to dead time, %.3f s, %.0f frames/s",
+		 (unsigned long long)ss->frame, (unsigned long long)n_pulses, (unsigned long long)n_lost,
+		 elapsed, elapsed > 0 ? (double)ss->frame / elapsed : 0.0);
+	source_end_of_input(src, stats);
+}
+
+static snd_pcm_uframes_t synth_frames_left(struct sample_source *src, snd_pcm_uframes_t max_frames)
+{
+	struct synth_source *ss = (struct synth_source *)src->priv;
+
+	if (ss->end_frame)
+	{
+		if (ss->frame >= ss->end_frame)
+			synth_end_of_input(src);
+		if (max_frames > ss->end_frame - ss->frame)
+			max_frames = ss->end_frame - ss->frame;
+	}
+
+	return max_frames;
+}
+
+static snd_pcm_uframes_t synth_begin(struct sample_source *src, snd_pcm_uframes_t max_frames, snd_pcm_uframes_t granule, const char **frames, snd_pcm_uframes_t *offset)
+{
+	struct synth_source *ss = (struct synth_source *)src->priv;
+
+	max_frames = synth_frames_left(src, max_frames);
+	max_frames -= max_frames % granule;
+	if (max_frames == 0)
+		synth_end_of_input(src);
+
+	if (ss->buffer_frames < max_frames)
+	{
+		free(ss->buffer);
+		ss->buffer = (char *)malloc(max_frames * src->frame_bytes);
+		if (!ss->buffer)
+			error_exit("problem allocating %zu bytes of memory", max_frames * src->frame_bytes);
+		ss->buffer_frames = max_frames;
+	}
+
+	generate(src, ss->buffer, max_frames);
+	*frames = ss->buffer;
+	*offset = 0;
+	return max_frames;
+}
+
+static void synth_commit(struct sample_source *src, snd_pcm_uframes_t offset, snd_pcm_uframes_t n_frames)
+{
+}
+
+static snd_pcm_uframes_t synth_read(struct sample_source *src, char *buffer, snd_pcm_uframes_t n_frames)
+{
+	if (synth_frames_left(src, n_frames) < n_frames)
+		synth_end_of_input(src);
+	generate(src, buffer, n_frames);
+	return n_frames;
+}
+
+static void synth_stop(struct sample_source *src)
+{
+}
+
+static void synth_restart(struct sample_source *src)
+{
+}
+
+static void synth_close(struct sample_source *src)
+{
+	struct synth_source *ss = (struct synth_source *)src->priv;
+
+	free(ss->buffer);
+	free(ss);
+	src->priv = NULL;
+}
+
+const struct sample_source_ops synth_source_ops =
+{
+	.open = synth_open,
+	.begin = synth_begin,
+	.commit = synth_commit,
+	.read = synth_read,
+	.stop = synth_stop,
+	.restart = synth_restart,
+	.close = synth_close,
+};
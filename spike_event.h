@@ -0,0 +1,35 @@
+/*
+ * Spike events, as detection hands them to bit extraction.
+ *
+ * Detection scans a period of samples and appends an event for each pulse
+ * onset; extraction then turns the period's events into bits, statistics
+ * and credit.  An event carries everything extraction needs, so the same
+ * list can come from a capture, a replay, or another detector.
+ *
+ * Samples are as detection compared them: negated for negative-going
+ * spikes, so the onset is always the upward threshold crossing.
+ */
+
+#ifndef _SPIKE_EVENT_H
+#define _SPIKE_EVENT_H
+
+#include <stddef.h>
+
+#define SPIKE_EVENT_TAPS	4
+
+/* no interval before this one -- the first since startup or a gap */
+#define SPIKE_EVENT_FIRST	0x1
+/* samples[0] and samples[1] are there, for onset interpolation */
+#define SPIKE_EVENT_HISTORY	0x2
+
+struct spike_event
+{
+	unsigned int channel;
+	unsigned int flags;
+	size_t frame;			/* of the onset sample, on the source's sample clock */
+	long threshold;			/* the channel's, when it was detected */
+	/* the samples up to the onset: [2] is the one before it, [3] the onset */
+	long samples[SPIKE_EVENT_TAPS];
+};
+
+#endif
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <string.h>
+#include "spike_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+static inline int is_16bit(enum spike_prescan_kind kind)
+{
+	return kind == SPIKE_PRESCAN_S16_LE || kind == SPIKE_PRESCAN_S16_BE;
+}
+
+static inline int32_t load_sample(enum spike_prescan_kind kind, const char *p)
+{
+	uint16_t x16;
+	uint32_t x32;
+
+	switch (kind)
+	{
+	case SPIKE_PRESCAN_S16_LE:
+		memcpy(&x16, p, sizeof x16);
+		return (int16_t)x16;
+	case SPIKE_PRESCAN_S16_BE:
+		memcpy(&x16, p, sizeof x16);
+		return (int16_t)__builtin_bswap16(x16);
+	case SPIKE_PRESCAN_S24_LE:
+		memcpy(&x32, p, sizeof x32);
+		return (int32_t)(x32 << 8) >> 8;
+	default:
+		memcpy(&x32, p, sizeof x32);
+		return (int32_t)x32;
+	}
+}
+
+/* samples [from, n_samples) */
+static inline size_t find_scalar_from(const struct spike_prescan *ps, const char *frames, size_t from, size_t n_samples)
+{
+	const size_t bytes = is_16bit(ps->kind) ? 2 : 4;
+
+	for (size_t s = from; s < n_samples; ++s)
+	{
+		if ((load_sample(ps->kind, frames + s * bytes) ^ ps->flip) > ps->thr32[s % ps->channels])
+			return s / ps->channels;
+	}
+	return n_samples / ps->channels;
+}
+
+static size_t find_scalar(const struct spike_prescan *ps, const char *frames, size_t n_frames)
+{
+	return find_scalar_from(ps, frames, 0, n_frames * ps->channels);
+}
+
+#ifdef HAVE_X86_SIMD
+/* two vectors a step; the lane of the first hit is found from the mask */
+static __attribute__((target("sse2"))) size_t find_sse2(const struct spike_prescan *ps, const char *frames, size_t n_frames)
+{
+	const size_t n_samples = n_frames * ps->channels;
+	size_t s = 0;
+
+	if (is_16bit(ps->kind))
+	{
+		const __m128i thr = _mm_load_si128((const __m128i *)ps->thr16);
+		const __m128i flip = _mm_set1_epi32(ps->flip);
+		const int be = ps->kind == SPIKE_PRESCAN_S16_BE;
+
+		for (; s + 16 <= n_samples; s += 16)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(frames + s * 2));
+			__m128i b = _mm_loadu_si128((const __m128i *)(frames + s * 2 + 16));
+
+			if (be)
+			{
+				a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+				b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+			}
+			a = _mm_xor_si128(a, flip);
+			b = _mm_xor_si128(b, flip);
+			unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi16(a, thr)) |
+				((unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi16(b, thr)) << 16);
+			if (m)
+				return (s + __builtin_ctz(m) / 2) / ps->channels;
+		}
+	}
+	else if (ps->channels <= 4)
+	{
+		const __m128i thr = _mm_load_si128((const __m128i *)ps->thr32);
+		const __m128i flip = _mm_set1_epi32(ps->flip);
+		const int s24 = ps->kind == SPIKE_PRESCAN_S24_LE;
+
+		for (; s + 8 <= n_samples; s += 8)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(frames + s * 4));
+			__m128i b = _mm_loadu_si128((const __m128i *)(frames + s * 4 + 16));
+
+			if (s24)
+			{
+				a = _mm_srai_epi32(_mm_slli_epi32(a, 8), 8);
+				b = _mm_srai_epi32(_mm_slli_epi32(b, 8), 8);
+			}
+			a = _mm_xor_si128(a, flip);
+			b = _mm_xor_si128(b, flip);
+			unsigned int m = (unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi32(a, thr)) |
+				((unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi32(b, thr)) << 16);
+			if (m)
+				return (s + __builtin_ctz(m) / 4) / ps->channels;
+		}
+	}
+	return find_scalar_from(ps, frames, s, n_samples);
+}
+
+static __attribute__((target("avx2"))) size_t find_avx2(const struct spike_prescan *ps, const char *frames, size_t n_frames)
+{
+	const size_t n_samples = n_frames * ps->channels;
+	size_t s = 0;
+
+	if (is_16bit(ps->kind))
+	{
+		const __m256i thr = _mm256_load_si256((const __m256i *)ps->thr16);
+		const __m256i flip = _mm256_set1_epi32(ps->flip);
+		const int be = ps->kind == SPIKE_PRESCAN_S16_BE;
+
+		for (; s + 32 <= n_samples; s += 32)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i *)(frames + s * 2));
+			__m256i b = _mm256_loadu_si256((const __m256i *)(frames + s * 2 + 32));
+
+			if (be)
+			{
+				a = _mm256_or_si256(_mm256_slli_epi16(a, 8), _mm256_srli_epi16(a, 8));
+				b = _mm256_or_si256(_mm256_slli_epi16(b, 8), _mm256_srli_epi16(b, 8));
+			}
+			a = _mm256_xor_si256(a, flip);
+			b = _mm256_xor_si256(b, flip);
+			uint64_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi16(a, thr)) |
+				((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi16(b, thr)) << 32);
+			if (m)
+				return (s + __builtin_ctzll(m) / 2) / ps->channels;
+		}
+	}
+	else
+	{
+		const __m256i thr = _mm256_load_si256((const __m256i *)ps->thr32);
+		const __m256i flip = _mm256_set1_epi32(ps->flip);
+		const int s24 = ps->kind == SPIKE_PRESCAN_S24_LE;
+
+		for (; s + 16 <= n_samples; s += 16)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i *)(frames + s * 4));
+			__m256i b = _mm256_loadu_si256((const __m256i *)(frames + s * 4 + 32));
+
+			if (s24)
+			{
+				a = _mm256_srai_epi32(_mm256_slli_epi32(a, 8), 8);
+				b = _mm256_srai_epi32(_mm256_slli_epi32(b, 8), 8);
+			}
+			a = _mm256_xor_si256(a, flip);
+			b = _mm256_xor_si256(b, flip);
+			uint64_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi32(a, thr)) |
+				((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi32(b, thr)) << 32);
+			if (m)
+				return (s + __builtin_ctzll(m) / 4) / ps->channels;
+		}
+	}
+	return find_scalar_from(ps, frames, s, n_samples);
+}
+#endif
+
+#ifdef HAVE_NEON
+/* a nibble per byte of the comparison result */
+static inline uint64_t neon_mask(uint8x16_t m)
+{
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+
+static size_t find_neon(const struct spike_prescan *ps, const char *frames, size_t n_frames)
+{
+	const size_t n_samples = n_frames * ps->channels;
+	size_t s = 0;
+
+	if (is_16bit(ps->kind))
+	{
+		const int16x8_t thr = vld1q_s16(ps->thr16);
+		const int be = ps->kind == SPIKE_PRESCAN_S16_BE;
+
+		for (; s + 8 <= n_samples; s += 8)
+		{
+			int16x8_t a = vld1q_s16((const int16_t *)(frames + s * 2));
+
+			if (be)
+				a = vreinterpretq_s16_u8(vrev16q_u8(vreinterpretq_u8_s16(a)));
+			a = veorq_s16(a, vdupq_n_s16((int16_t)ps->flip));
+			uint64_t m = neon_mask(vreinterpretq_u8_u16(vcgtq_s16(a, thr)));
+			if (m)
+				return (s + __builtin_ctzll(m) / 8) / ps->channels;
+		}
+	}
+	else if (ps->channels <= 4)
+	{
+		const int32x4_t thr = vld1q_s32(ps->thr32);
+		const int s24 = ps->kind == SPIKE_PRESCAN_S24_LE;
+
+		for (; s + 4 <= n_samples; s += 4)
+		{
+			int32x4_t a = vld1q_s32((const int32_t *)(frames + s * 4));
+
+			if (s24)
+				a = vshrq_n_s32(vshlq_n_s32(a, 8), 8);
+			a = veorq_s32(a, vdupq_n_s32(ps->flip));
+			uint64_t m = neon_mask(vreinterpretq_u8_u32(vcgtq_s32(a, thr)));
+			if (m)
+				return (s + __builtin_ctzll(m) / 16) / ps->channels;
+		}
+	}
+	return find_scalar_from(ps, frames, s, n_samples);
+}
+#endif
+
+int spike_prescan_init(struct spike_prescan *ps, enum spike_prescan_kind kind, unsigned int channels, int negative, const char **name)
+{
+	if (channels != 1 && channels != 2 && channels != 4 && channels != 8)
+		return 0;
+
+	memset(ps, 0, sizeof *ps);
+	ps->kind = kind;
+	ps->channels = channels;
+	ps->flip = negative ? -1 : 0;
+
+	ps->find = find_scalar;
+	*name = "scalar";
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		ps->find = find_avx2;
+		*name = "avx2";
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		ps->find = find_sse2;
+		*name = "sse2";
+	}
+#endif
+#ifdef HAVE_NEON
+	ps->find = find_neon;
+	*name = "neon";
+#endif
+	return 1;
+}
+
+void spike_prescan_set_thresholds(struct spike_prescan *ps, const long *thresholds, uint32_t mask)
+{
+	for (unsigned int lane = 0; lane < 16; ++lane)
+	{
+		unsigned int channel = lane % ps->channels;
+		long t = thresholds[channel] + ps->flip;
+		long t16 = (mask & (1U << channel)) ? t : INT16_MAX;
+		long t32 = (mask & (1U << channel)) ? t : INT32_MAX;
+
+		ps->thr16[lane] = (int16_t)(t16 > INT16_MAX ? INT16_MAX : t16 < INT16_MIN ? INT16_MIN : t16);
+		if (lane < 8)
+			ps->thr32[lane] = (int32_t)(t32 > INT32_MAX ? INT32_MAX : t32 < INT32_MIN ? INT32_MIN : t32);
+	}
+	/* the scalar tail compares with the full thresholds */
+	if (is_16bit(ps->kind))
+	{
+		for (unsigned int lane = 0; lane < 8; ++lane)
+			ps->thr32[lane] = ps->thr16[lane];
+	}
+}
+
+int spike_prescan_self_test(void)
+{
+	enum { N_FRAMES = 4099 };
+	static const unsigned int channel_counts[] = { 1, 2, 4, 8 };
+	static char frames[N_FRAMES * 8 * 4];
+	static const long thresholds[8] = { 16000, 20000, 12000, 30000, 8000, 16000, 24000, 100 };
+	uint64_t x = 0x2545f4914f6cdd1dULL;
+	const char *name = "scalar";
+	int ok = 1;
+
+	for (int kind = SPIKE_PRESCAN_S16_LE; kind <= SPIKE_PRESCAN_S32_LE; ++kind)
+	for (int negative = 0; negative < 2; ++negative)
+	{
+		for (size_t c = 0; c < sizeof channel_counts / sizeof channel_counts[0]; ++c)
+		{
+			struct spike_prescan fast, ref;
+			const size_t bytes = is_16bit(kind) ? 2 : 4;
+			const size_t n_samples = N_FRAMES * channel_counts[c];
+
+			spike_prescan_init(&fast, kind, channel_counts[c], negative, &name);
+			ref = fast;
+			ref.find = find_scalar;
+			spike_prescan_set_thresholds(&fast, thresholds, 0xfffffffeU >> (c & 1));
+			spike_prescan_set_thresholds(&ref, thresholds, 0xfffffffeU >> (c & 1));
+
+			/* quiet, with the odd sample at full scale either way */
+			for (size_t s = 0; s < n_samples; ++s)
+			{
+				x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+				int32_t v = ((x >> 8) % 97 == 0) ? (int32_t)(x >> 32) : (int32_t)(int16_t)(x >> 16) / 4;
+				if (is_16bit(kind))
+				{
+					int16_t v16 = (int16_t)(v >> 16);
+					uint16_t u16;
+
+					memcpy(&u16, &v16, sizeof u16);
+					if (kind == SPIKE_PRESCAN_S16_BE)
+						u16 = __builtin_bswap16(u16);
+					memcpy(frames + s * bytes, &u16, sizeof u16);
+				}
+				else
+				{
+					if (kind == SPIKE_PRESCAN_S24_LE)
+						v = (v >> 8) ^ (int32_t)(x & 0xff000000U);	/* junk in the top byte */
+					else
+						v >>= 16 - ((x >> 4) & 15);
+					memcpy(frames + s * bytes, &v, sizeof v);
+				}
+			}
+
+			for (size_t from = 0; from < N_FRAMES && ok; )
+			{
+				size_t n = N_FRAMES - from;
+				const char *p = frames + from * channel_counts[c] * bytes;
+				size_t got = fast.find(&fast, p, n), want = ref.find(&ref, p, n);
+
+				if (got != want)
+				{
+					fprintf(stderr, "spike prescan (%s) kind %d, %u channels%s: frame %zu, expected %zu\n", name, kind, channel_counts[c], negative ? ", negative" : "", from + got, from + want);
+					ok = 0;
+				}
+				from += want + 1;
+			}
+		}
+	}
+
+	printf("spike prescan self-test (%s): %s\n", name, ok ? "ok" : "FAILED");
+	return ok;
+}
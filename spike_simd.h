@@ -0,0 +1,47 @@
+/*
+ * Vectorized threshold pre-scan for spike detection.
+ *
+ * Almost every sample is below threshold, and all a below-threshold frame
+ * does to the detector is become the previous one.  So the scan looks for
+ * the next frame with any channel above its threshold, a vector of samples
+ * at a time, and only that frame (and the one before it) go through the
+ * scalar onset and ISI logic.
+ */
+
+#ifndef _SPIKE_SIMD_H
+#define _SPIKE_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the sample layouts it handles */
+enum spike_prescan_kind
+{
+	SPIKE_PRESCAN_S16_LE,
+	SPIKE_PRESCAN_S16_BE,
+	SPIKE_PRESCAN_S24_LE,		/* in 4 bytes */
+	SPIKE_PRESCAN_S32_LE,
+};
+
+struct spike_prescan
+{
+	/* index of the first frame with a sample above threshold, or n_frames */
+	size_t (*find)(const struct spike_prescan *ps, const char *frames, size_t n_frames);
+	enum spike_prescan_kind kind;
+	unsigned int channels;
+	/* negative-going: compares ~x > threshold - 1, which is -x > threshold */
+	int32_t flip;
+
+	/* thresholds for each lane, repeating every channels lanes */
+	_Alignas(32) int16_t thr16[16];
+	_Alignas(32) int32_t thr32[8];
+};
+
+/* 0 if the layout or the channel count (1, 2, 4 or 8) isn't handled */
+int spike_prescan_init(struct spike_prescan *ps, enum spike_prescan_kind kind, unsigned int channels, int negative, const char **name);
+/* channels outside mask never count as above */
+void spike_prescan_set_thresholds(struct spike_prescan *ps, const long *thresholds, uint32_t mask);
+/* the chosen find() against the scalar one, for every kind and channel count */
+int spike_prescan_self_test(void);
+
+#endif